@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+#include "../src/smart_cmd.h"
+#include <time.h>
+
+/*
+ * JSON request body microbenchmark
+ *
+ * Compares the previous strcat-based json_request() (fixed 8 KB stack
+ * buffers, no escaping) with the json_writer path used by llm_client.c.
+ * Both build an OpenAI chat request from the same messages. Plain text
+ * shows the raw cost of each builder; terminal-like text shows the cost of
+ * the escaping the old builder skipped (its output is not valid JSON), and
+ * contexts above 4 KB show where the old builder silently truncates.
+ *
+ * Build and run: make bench-json
+ */
+
+#define MAX_BUFFER 8192
+#define MAX_CONTENT 4096
+#define MAX_MESSAGES 5
+
+typedef struct {
+    char roles[MAX_MESSAGES][12];
+    char contents[MAX_MESSAGES][MAX_CONTENT];
+    int msg_count;
+} legacy_agent_t;
+
+typedef struct {
+    const char *roles[MAX_MESSAGES];
+    const char *contents[MAX_MESSAGES];
+    int msg_count;
+} agent_t;
+
+// The request builder as it was before json_writer
+static char *legacy_json_request(const legacy_agent_t *agent, const char *model, char *out, size_t size) {
+    char messages[MAX_BUFFER] = "[";
+    for (int i = 0; i < agent->msg_count; i++) {
+        if (i > 0) strcat(messages, ",");
+        char temp[MAX_CONTENT + 100];
+        snprintf(temp, sizeof(temp), "{\"role\":\"%s\",\"content\":\"%s\"}", agent->roles[i], agent->contents[i]);
+        if (strlen(messages) + strlen(temp) + 10 < sizeof(messages)) strcat(messages, temp);
+    }
+    strcat(messages, "]");
+    snprintf(out, size, "{\"model\":\"%s\",\"messages\":%s,\"temperature\":0.7,\"max_tokens\":100}",
+             model, messages);
+    return out;
+}
+
+static const char *writer_json_request(const agent_t *agent, const char *model, json_writer_t *w) {
+    json_writer_reset(w);
+    json_writer_begin_object(w);
+    json_writer_key(w, "model");
+    json_writer_string(w, model);
+    json_writer_key(w, "messages");
+    json_writer_begin_array(w);
+    for (int i = 0; i < agent->msg_count; i++) {
+        json_writer_begin_object(w);
+        json_writer_key(w, "role");
+        json_writer_string(w, agent->roles[i]);
+        json_writer_key(w, "content");
+        json_writer_string(w, agent->contents[i]);
+        json_writer_end_object(w);
+    }
+    json_writer_end_array(w);
+    json_writer_key(w, "temperature");
+    json_writer_double(w, 0.7);
+    json_writer_key(w, "max_tokens");
+    json_writer_int(w, 100);
+    json_writer_end_object(w);
+    return json_writer_finish(w);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// Terminal-like text: command lines, paths, a quote and a tab here and there;
+// plain text has nothing that needs escaping
+static void fill_context(char *buf, size_t len, int plain) {
+    static const char *terminal_lines[] = {
+        "$ git status\n", "On branch main\n", "\tmodified:   src/llm_client.c\n",
+        "$ grep -rn \"json_request\" src/\n", "$ ls -la /var/log\n", "$ make -j8\n",
+    };
+    static const char *plain_lines[] = {
+        "$ git status; ", "On branch main; ", "modified:   src/llm_client.c; ",
+        "$ grep -rn json_request src/; ", "$ ls -la /var/log; ", "$ make -j8; ",
+    };
+    const char **lines = plain ? plain_lines : terminal_lines;
+    size_t pos = 0;
+    for (int i = 0; pos + 1 < len; i++) {
+        const char *line = lines[i % 6];
+        size_t n = strlen(line);
+        if (pos + n >= len) n = len - pos - 1;
+        memcpy(buf + pos, line, n);
+        pos += n;
+    }
+    buf[pos] = '\0';
+}
+
+static void run_case(size_t context_len, int plain, int iterations) {
+    char *context = malloc(context_len + 1);
+    legacy_agent_t *legacy = calloc(1, sizeof(legacy_agent_t));
+    char *legacy_out = malloc(MAX_BUFFER);
+    if (!context || !legacy || !legacy_out) {
+        fprintf(stderr, "ERROR: run_case: Out of memory\n");
+        exit(1);
+    }
+    fill_context(context, context_len + 1, plain);
+
+    agent_t agent = {
+        .roles = { "system", "user" },
+        .contents = { context, "git commi" },
+        .msg_count = 2,
+    };
+
+    json_writer_t w;
+    json_writer_init(&w, 4096);
+
+    // The old path copied every message into the agent first; include it
+    double start = now_ns();
+    size_t legacy_len = 0;
+    for (int i = 0; i < iterations; i++) {
+        strcpy(legacy->roles[0], "system");
+        strncpy(legacy->contents[0], context, MAX_CONTENT - 1);
+        legacy->contents[0][MAX_CONTENT - 1] = '\0';
+        strcpy(legacy->roles[1], "user");
+        strncpy(legacy->contents[1], "git commi", MAX_CONTENT - 1);
+        legacy->msg_count = 2;
+        legacy_json_request(legacy, "gpt-4.1-nano", legacy_out, MAX_BUFFER);
+        legacy_len = strlen(legacy_out);
+    }
+    double legacy_ns = (now_ns() - start) / iterations;
+
+    start = now_ns();
+    size_t writer_len = 0;
+    for (int i = 0; i < iterations; i++) {
+        const char *body = writer_json_request(&agent, "gpt-4.1-nano", &w);
+        writer_len = body ? w.len : 0;
+    }
+    double writer_ns = (now_ns() - start) / iterations;
+
+    // The old builder copied raw text into the JSON string
+    const char *legacy_note = "";
+    if (!strstr(legacy_out, context)) legacy_note = "  legacy: truncated";
+    else if (!plain) legacy_note = "  legacy: invalid JSON";
+
+    printf("%-9s %8zu %12.0f %12.0f %8.2fx %10zu %10zu%s\n",
+           plain ? "plain" : "terminal", context_len, legacy_ns, writer_ns, legacy_ns / writer_ns,
+           legacy_len, writer_len, legacy_note);
+
+    json_writer_free(&w);
+    free(legacy_out);
+    free(legacy);
+    free(context);
+}
+
+int main(void) {
+    printf("%-9s %8s %12s %12s %9s %10s %10s\n",
+           "text", "context", "legacy ns", "writer ns", "speedup", "legacy B", "writer B");
+
+    size_t sizes[] = { 256, 1024, 3000, 4000, 8000, 32000 };
+    for (int plain = 1; plain >= 0; plain--) {
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            run_case(sizes[i], plain, 20000);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,487 @@
+#define _GNU_SOURCE
+#include "../src/smart_cmd.h"
+#include <getopt.h>
+#include <glob.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * End-to-end suggestion latency benchmark
+ *
+ * Times the Ctrl+O path against bench/mock_llm_server, so the numbers show
+ * what smart-cmd itself adds on top of a provider with a known latency, on
+ * a machine without network access. Two paths are measured:
+ *
+ *   completion  what smart-cmd.bash runs: smart-cmd-completion with the
+ *               input line on stdin, one process per request
+ *   daemon      a "suggestion:" request over the daemon's socket
+ *
+ * Everything runs under a scratch HOME and TMPDIR, with a config.json that
+ * points the provider at the mock server and turns off the caches,
+ * prefetching, hedging and the local model, so every request reaches the
+ * provider. Each request types a different input. --clients runs that many
+ * requests at a time.
+ *
+ * Reports p50/p90/p99/max latency and throughput per path. Requests that
+ * fail or come back empty are counted as errors and left out of the
+ * percentiles.
+ *
+ * Build and run: make bench
+ */
+
+#define MAX_SAMPLES 100000
+#define STARTUP_TIMEOUT_MS 5000
+
+typedef struct {
+    int requests;
+    int warmup;
+    int clients;
+    int stream;
+    int candidates;
+    const char *provider;
+    const char *path;
+    const char *bin_dir;
+    const char *latency_ms;
+    const char *jitter_ms;
+    const char *chunk_delay_ms;
+    const char *error_rate;
+} bench_options_t;
+
+static bench_options_t g_options = {
+    .requests = 100,
+    .warmup = 3,
+    .clients = 1,
+    .stream = 0,
+    .candidates = 1,
+    .provider = "openai",
+    .path = "all",
+    .bin_dir = ".",
+    .latency_ms = "100",
+    .jitter_ms = "20",
+    .chunk_delay_ms = "5",
+    .error_rate = "0",
+};
+
+static char g_home[MAX_PATH / 2];
+static char g_socket_path[MAX_PATH];
+
+// Typed inputs, each made unique with the request number
+static const char *const input_formats[] = {
+    "git checkout feature-%d",
+    "docker run -p %d",
+    "kill -9 %d",
+    "tail -n %d",
+    "ssh build%d",
+};
+
+typedef struct {
+    int (*run)(int index);
+    int next;
+    int total;
+    double *samples;
+    int count;
+    int errors;
+    pthread_mutex_t lock;
+} bench_run_t;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static void make_input(int index, char *input, size_t size) {
+    int formats = (int)(sizeof(input_formats) / sizeof(input_formats[0]));
+    snprintf(input, size, input_formats[index % formats], 1000 + index);
+}
+
+static void bin_path(const char *name, char *path, size_t size) {
+    snprintf(path, size, "%s/%s", g_options.bin_dir, name);
+}
+
+// One Ctrl+O press without a daemon: the completion binary, input on stdin
+static int run_completion(int index) {
+    char input[MAX_INPUT_LEN];
+    make_input(index, input, sizeof(input));
+
+    char binary[MAX_PATH];
+    bin_path("smart-cmd-completion", binary, sizeof(binary));
+
+    int in_pipe[2], out_pipe[2];
+    if (pipe(in_pipe) != 0) return -1;
+    if (pipe(out_pipe) != 0) {
+        close(in_pipe[0]);
+        close(in_pipe[1]);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(in_pipe[0], STDIN_FILENO);
+        dup2(out_pipe[1], STDOUT_FILENO);
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd != -1) dup2(null_fd, STDERR_FILENO);
+        close(in_pipe[0]);
+        close(in_pipe[1]);
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        execl(binary, binary, (char *)NULL);
+        _exit(127);
+    }
+    close(in_pipe[0]);
+    close(out_pipe[1]);
+    if (pid == -1) {
+        close(in_pipe[1]);
+        close(out_pipe[0]);
+        return -1;
+    }
+
+    dprintf(in_pipe[1], "%s\n", input);
+    close(in_pipe[1]);
+
+    char output[MAX_CANDIDATES * MAX_SUGGESTION_LEN];
+    size_t used = 0;
+    ssize_t n;
+    while ((n = read(out_pipe[0], output + used, sizeof(output) - 1 - used)) > 0) {
+        used += (size_t)n;
+        if (used == sizeof(output) - 1) break;
+    }
+    close(out_pipe[0]);
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1) return -1;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 && used > 0 ? 0 : -1;
+}
+
+// One Ctrl+O press answered by the daemon
+static int run_daemon(int index) {
+    char request[MAX_INPUT_LEN + 16];
+    char input[MAX_INPUT_LEN];
+    make_input(index, input, sizeof(input));
+    snprintf(request, sizeof(request), "suggestion:%s", input);
+
+    char response[MAX_IPC_MESSAGE_SIZE];
+    int result = send_daemon_request(g_socket_path, request, response, sizeof(response));
+    return result > 0 && strncmp(response, "error:", 6) != 0 ? 0 : -1;
+}
+
+static void *client_thread(void *arg) {
+    bench_run_t *run = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&run->lock);
+        int index = run->next < run->total ? run->next++ : -1;
+        pthread_mutex_unlock(&run->lock);
+        if (index == -1) break;
+
+        double start = now_ms();
+        int result = run->run(index);
+        double elapsed = now_ms() - start;
+
+        pthread_mutex_lock(&run->lock);
+        if (result == 0) {
+            run->samples[run->count++] = elapsed;
+        } else {
+            run->errors++;
+        }
+        pthread_mutex_unlock(&run->lock);
+    }
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const double *sorted, int count, double p) {
+    if (count == 0) return 0.0;
+    int rank = (int)(p / 100.0 * count + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > count) rank = count;
+    return sorted[rank - 1];
+}
+
+static int bench_path(const char *name, int (*run_one)(int)) {
+    // Warm up caches and connections outside the measurement
+    for (int i = 0; i < g_options.warmup; i++) {
+        run_one(MAX_SAMPLES + i);
+    }
+
+    bench_run_t run = {
+        .run = run_one,
+        .total = g_options.requests,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+    };
+    run.samples = malloc(sizeof(double) * g_options.requests);
+    if (!run.samples) return -1;
+
+    pthread_t threads[64];
+    int clients = g_options.clients;
+    double start = now_ms();
+    for (int i = 0; i < clients; i++) {
+        pthread_create(&threads[i], NULL, client_thread, &run);
+    }
+    for (int i = 0; i < clients; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double wall = now_ms() - start;
+
+    qsort(run.samples, run.count, sizeof(double), compare_double);
+    printf("%-10s %8d %6d %9.1f %9.1f %9.1f %9.1f %9.1f\n", name, run.count, run.errors,
+           percentile(run.samples, run.count, 50), percentile(run.samples, run.count, 90),
+           percentile(run.samples, run.count, 99), run.count ? run.samples[run.count - 1] : 0.0,
+           wall > 0 ? (run.count + run.errors) * 1000.0 / wall : 0.0);
+
+    free(run.samples);
+    return 0;
+}
+
+// Start the mock provider and return its port, or -1
+static int start_mock_server(pid_t *pid) {
+    char binary[MAX_PATH];
+    bin_path("bench/mock_llm_server", binary, sizeof(binary));
+
+    int out_pipe[2];
+    if (pipe(out_pipe) != 0) return -1;
+
+    *pid = fork();
+    if (*pid == 0) {
+        dup2(out_pipe[1], STDOUT_FILENO);
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        execl(binary, binary, "--port", "0", "--latency-ms", g_options.latency_ms,
+              "--jitter-ms", g_options.jitter_ms, "--chunk-delay-ms", g_options.chunk_delay_ms,
+              "--error-rate", g_options.error_rate, (char *)NULL);
+        _exit(127);
+    }
+    close(out_pipe[1]);
+    if (*pid == -1) {
+        close(out_pipe[0]);
+        return -1;
+    }
+
+    char line[64] = "";
+    FILE *fp = fdopen(out_pipe[0], "r");
+    int port = -1;
+    if (fp && fgets(line, sizeof(line), fp) && sscanf(line, "port %d", &port) != 1) {
+        port = -1;
+    }
+    if (fp) fclose(fp);
+    return port;
+}
+
+static int write_config(int port) {
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s/.config", g_home);
+    mkdir(path, 0700);
+    snprintf(path, sizeof(path), "%s/.config/smart-cmd", g_home);
+    mkdir(path, 0700);
+    snprintf(path, sizeof(path), "%s/.config/smart-cmd/config.json", g_home);
+
+    FILE *fp = fopen(path, "w");
+    if (!fp) return -1;
+
+    int gemini = strcmp(g_options.provider, "gemini") == 0;
+    fprintf(fp,
+            "{\n"
+            "  \"llm\": {\n"
+            "    \"provider\": \"%s\",\n"
+            "    \"model\": \"mock-model\",\n"
+            "    \"endpoint\": \"http://127.0.0.1:%d%s\",\n"
+            "    \"api_key\": \"mock\"\n"
+            "  },\n"
+            "  \"enable_proxy_mode\": false,\n"
+            "  \"show_startup_messages\": false,\n"
+            "  \"enable_streaming\": %s,\n"
+            "  \"candidates\": %d,\n"
+            "  \"prefetch\": { \"enabled\": false },\n"
+            "  \"cache\": { \"enabled\": false },\n"
+            "  \"hedge\": { \"enabled\": false },\n"
+            "  \"local_model\": { \"enabled\": false }\n"
+            "}\n",
+            g_options.provider, port, gemini ? "/v1beta/models/" : "/v1/chat/completions",
+            g_options.stream ? "true" : "false", g_options.candidates);
+    fclose(fp);
+    return 0;
+}
+
+static int run_command(const char *binary, const char *arg) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd != -1) {
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        execl(binary, binary, arg, (char *)NULL);
+        _exit(127);
+    }
+    if (pid == -1) return -1;
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1) return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Start the daemon under the scratch TMPDIR and wait until it answers
+static int start_daemon(void) {
+    char binary[MAX_PATH];
+    bin_path("smart-cmd-daemon", binary, sizeof(binary));
+    if (run_command(binary, NULL) != 0) return -1;
+
+    char pattern[MAX_PATH];
+    snprintf(pattern, sizeof(pattern), "%s/tmp/%s.*", g_home, SOCKET_FILE_PREFIX);
+
+    double deadline = now_ms() + STARTUP_TIMEOUT_MS;
+    while (now_ms() < deadline) {
+        glob_t matches;
+        if (glob(pattern, 0, NULL, &matches) == 0) {
+            snprintf(g_socket_path, sizeof(g_socket_path), "%s", matches.gl_pathv[0]);
+            globfree(&matches);
+            if (ping_daemon(g_socket_path) == 0) return 0;
+        }
+        usleep(20000);
+    }
+    return -1;
+}
+
+static void stop_daemon(void) {
+    char binary[MAX_PATH];
+    bin_path("smart-cmd-daemon", binary, sizeof(binary));
+    run_command(binary, "--stop");
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+static void print_bench_usage(const char *program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  --requests N        Measured requests per path (default %d)\n", g_options.requests);
+    printf("  --warmup N          Unmeasured requests first (default %d)\n", g_options.warmup);
+    printf("  --clients N         Requests in flight at a time, up to 64 (default %d)\n", g_options.clients);
+    printf("  --path P            completion, daemon or all (default %s)\n", g_options.path);
+    printf("  --provider P        openai or gemini (default %s)\n", g_options.provider);
+    printf("  --stream            Use streaming responses\n");
+    printf("  --candidates N      Suggestions per request (default %d)\n", g_options.candidates);
+    printf("  --latency-ms N      Mock provider latency (default %s)\n", g_options.latency_ms);
+    printf("  --jitter-ms N       Mock provider jitter (default %s)\n", g_options.jitter_ms);
+    printf("  --chunk-delay-ms N  Delay between streamed events (default %s)\n", g_options.chunk_delay_ms);
+    printf("  --error-rate F      Fraction of failing provider requests (default %s)\n", g_options.error_rate);
+    printf("  --bin-dir DIR       Where the binaries were built (default %s)\n", g_options.bin_dir);
+}
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"requests", required_argument, 0, 'n'},
+        {"warmup", required_argument, 0, 'w'},
+        {"clients", required_argument, 0, 'c'},
+        {"path", required_argument, 0, 'P'},
+        {"provider", required_argument, 0, 'p'},
+        {"stream", no_argument, 0, 's'},
+        {"candidates", required_argument, 0, 'k'},
+        {"latency-ms", required_argument, 0, 'l'},
+        {"jitter-ms", required_argument, 0, 'j'},
+        {"chunk-delay-ms", required_argument, 0, 'd'},
+        {"error-rate", required_argument, 0, 'e'},
+        {"bin-dir", required_argument, 0, 'b'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "n:w:c:P:p:sk:l:j:d:e:b:h", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'n': g_options.requests = atoi(optarg); break;
+        case 'w': g_options.warmup = atoi(optarg); break;
+        case 'c': g_options.clients = atoi(optarg); break;
+        case 'P': g_options.path = optarg; break;
+        case 'p': g_options.provider = optarg; break;
+        case 's': g_options.stream = 1; break;
+        case 'k': g_options.candidates = atoi(optarg); break;
+        case 'l': g_options.latency_ms = optarg; break;
+        case 'j': g_options.jitter_ms = optarg; break;
+        case 'd': g_options.chunk_delay_ms = optarg; break;
+        case 'e': g_options.error_rate = optarg; break;
+        case 'b': g_options.bin_dir = optarg; break;
+        case 'h':
+            print_bench_usage(argv[0]);
+            return 0;
+        default:
+            print_bench_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (g_options.requests < 1 || g_options.requests > MAX_SAMPLES) g_options.requests = 100;
+    if (g_options.clients < 1 || g_options.clients > 64) g_options.clients = 1;
+
+    int bench_completion = strcmp(g_options.path, "all") == 0 || strcmp(g_options.path, "completion") == 0;
+    int bench_daemon = strcmp(g_options.path, "all") == 0 || strcmp(g_options.path, "daemon") == 0;
+
+    // Scratch HOME and TMPDIR keep the user's config, daemon and history out of it
+    snprintf(g_home, sizeof(g_home), "%s/smart-cmd-bench.XXXXXX",
+             getenv("TMPDIR") && getenv("TMPDIR")[0] ? getenv("TMPDIR") : "/tmp");
+    if (!mkdtemp(g_home)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char tmp_dir[MAX_PATH];
+    snprintf(tmp_dir, sizeof(tmp_dir), "%s/tmp", g_home);
+    mkdir(tmp_dir, 0700);
+
+    setenv("HOME", g_home, 1);
+    setenv("TMPDIR", tmp_dir, 1);
+    setenv("HISTFILE", "/dev/null", 1);
+    unsetenv("SMART_CMD_DAEMON_ACTIVE");
+    unsetenv("OPENAI_API_KEY");
+    unsetenv("GEMINI_API_KEY");
+    unsetenv("OPENROUTER_API_KEY");
+
+    int status = 1;
+    pid_t server_pid = -1;
+    int port = start_mock_server(&server_pid);
+    if (port <= 0) {
+        fprintf(stderr, "Failed to start bench/mock_llm_server\n");
+        goto cleanup;
+    }
+    if (write_config(port) != 0) {
+        fprintf(stderr, "Failed to write config.json\n");
+        goto cleanup;
+    }
+
+    printf("Mock %s provider: %s ms latency, %s ms jitter, error rate %s%s\n",
+           g_options.provider, g_options.latency_ms, g_options.jitter_ms, g_options.error_rate,
+           g_options.stream ? ", streaming" : "");
+    printf("%d requests per path, %d client%s\n\n", g_options.requests, g_options.clients,
+           g_options.clients == 1 ? "" : "s");
+    printf("%-10s %8s %6s %9s %9s %9s %9s %9s\n", "path", "ok", "errors",
+           "p50 ms", "p90 ms", "p99 ms", "max ms", "req/s");
+
+    status = 0;
+    if (bench_completion) {
+        bench_path("completion", run_completion);
+    }
+    if (bench_daemon) {
+        if (start_daemon() == 0) {
+            bench_path("daemon", run_daemon);
+        } else {
+            fprintf(stderr, "Failed to start smart-cmd-daemon\n");
+            status = 1;
+        }
+        stop_daemon();
+    }
+
+cleanup:
+    if (server_pid > 0) {
+        kill(server_pid, SIGTERM);
+        waitpid(server_pid, NULL, 0);
+    }
+    nftw(g_home, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return status;
+}
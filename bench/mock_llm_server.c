@@ -0,0 +1,417 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/*
+ * Mock LLM server
+ *
+ * Local stand-in for the providers, so the whole suggestion path can be
+ * timed on a machine without network access. It listens on 127.0.0.1 and
+ * answers in the provider's format:
+ *
+ *   POST <any path>                          OpenAI chat/completions
+ *   POST <path>:generateContent              Gemini
+ *   POST <path>:streamGenerateContent?...    Gemini, server-sent events
+ *   HEAD <any path>                          405 without delay (connection warm-up)
+ *
+ * OpenAI requests with "stream":true are answered with server-sent events,
+ * with usage in a last event only under "stream_options":{"include_usage":
+ * true}, and "n" / "candidateCount" return that many choices. The suggestion
+ * completes the INPUT of the user message, and usage counts the part of the
+ * prompt shared with the previous request as cached, so llm_client.c goes
+ * through the same parsing as with a real provider.
+ *
+ * Each request waits --latency-ms plus up to --jitter-ms before the first
+ * byte, streamed responses wait --chunk-delay-ms between events, and
+ * --error-rate of the requests fail with HTTP 500. Connections are kept
+ * alive, one thread each.
+ *
+ * Usage: mock_llm_server [--port N] [--latency-ms N] [--jitter-ms N]
+ *                        [--chunk-delay-ms N] [--error-rate F]
+ * With --port 0 (the default) a free port is picked; the first line on
+ * stdout is "port N" either way.
+ */
+
+#define MAX_HEADER 8192
+#define MAX_BODY (1024 * 1024)
+#define MAX_CHOICES 5
+#define MAX_SUGGESTION 1024
+#define MAX_PROMPT_PREFIX 65536
+
+typedef struct {
+    int latency_ms;
+    int jitter_ms;
+    int chunk_delay_ms;
+    double error_rate;
+} mock_options_t;
+
+static mock_options_t g_options = {
+    .latency_ms = 200,
+    .jitter_ms = 50,
+    .chunk_delay_ms = 10,
+    .error_rate = 0.0,
+};
+
+static pthread_mutex_t g_prompt_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+    int fd;
+    unsigned int seed;
+} connection_t;
+
+static void sleep_ms(int ms) {
+    if (ms <= 0) return;
+    struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000L};
+    while (nanosleep(&ts, &ts) != 0) {}
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n <= 0) return -1;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int write_chunk(int fd, const char *data, size_t len) {
+    char size_line[32];
+    int n = snprintf(size_line, sizeof(size_line), "%zx\r\n", len);
+    if (write_all(fd, size_line, (size_t)n) != 0) return -1;
+    if (write_all(fd, data, len) != 0) return -1;
+    return write_all(fd, "\r\n", 2);
+}
+
+// Integer value of "key": in body, or fallback
+static int json_int(const char *body, const char *key, int fallback) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char *p = strstr(body, pattern);
+    if (!p) return fallback;
+    p += strlen(pattern);
+    while (*p == ' ') p++;
+    return atoi(p);
+}
+
+// The typed input, still JSON-escaped, from "...INPUT:\n<input>" in the body
+static void extract_input(const char *body, char *out, size_t size) {
+    out[0] = '\0';
+    const char *p = strstr(body, "INPUT:\\n");
+    if (!p) return;
+    p += 8;
+
+    size_t len = 0;
+    while (p[len] && p[len] != '"' && len + 2 < size) {
+        if (p[len] == '\\' && p[len + 1]) len++;
+        len++;
+    }
+    memcpy(out, p, len);
+    out[len] = '\0';
+}
+
+// Bytes of the prompt shared with the previous request's, which a provider
+// would have served from its prompt cache
+static size_t shared_prefix(const char *body) {
+    static char last[MAX_PROMPT_PREFIX];
+    static size_t last_len;
+
+    const char *start = strstr(body, "\"messages\"");
+    if (!start) start = strstr(body, "\"contents\"");
+    if (!start) start = body;
+    size_t len = strlen(start);
+    if (len > sizeof(last)) len = sizeof(last);
+
+    pthread_mutex_lock(&g_prompt_lock);
+    size_t shared = 0;
+    while (shared < len && shared < last_len && start[shared] == last[shared]) shared++;
+    memcpy(last, start, len);
+    last_len = len;
+    pthread_mutex_unlock(&g_prompt_lock);
+    return shared;
+}
+
+static const char *const completions[MAX_CHOICES] = {
+    " --help", " -v", " --version", " -h", " --verbose",
+};
+
+static int send_error(int fd) {
+    static const char body[] = "{\"error\":{\"message\":\"mock server error\",\"type\":\"server_error\"}}";
+    char header[256];
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.1 500 Internal Server Error\r\nContent-Type: application/json\r\n"
+                     "Content-Length: %zu\r\n\r\n", sizeof(body) - 1);
+    if (write_all(fd, header, (size_t)n) != 0) return -1;
+    return write_all(fd, body, sizeof(body) - 1);
+}
+
+// Connection warm-up pings: answered at once, the way a provider answers a
+// request without credentials
+static int send_head(int fd) {
+    static const char response[] = "HTTP/1.1 405 Method Not Allowed\r\nAllow: POST\r\nContent-Length: 0\r\n\r\n";
+    return write_all(fd, response, sizeof(response) - 1);
+}
+
+static int send_json(int fd, const char *body, size_t len) {
+    char header[256];
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                     "Content-Length: %zu\r\n\r\n", len);
+    if (write_all(fd, header, (size_t)n) != 0) return -1;
+    return write_all(fd, body, len);
+}
+
+static int respond_openai(int fd, const char *input, int choices, int prompt_tokens, int cached_tokens) {
+    char body[MAX_CHOICES * (MAX_SUGGESTION + 128) + 512];
+    size_t pos = (size_t)snprintf(body, sizeof(body),
+                                  "{\"id\":\"mock\",\"object\":\"chat.completion\",\"model\":\"mock\",\"choices\":[");
+    for (int i = 0; i < choices; i++) {
+        pos += (size_t)snprintf(body + pos, sizeof(body) - pos,
+                                "%s{\"index\":%d,\"message\":{\"role\":\"assistant\",\"content\":\"+%s%s\"},"
+                                "\"finish_reason\":\"stop\"}",
+                                i > 0 ? "," : "", i, input, completions[i]);
+    }
+    pos += (size_t)snprintf(body + pos, sizeof(body) - pos,
+                            "],\"usage\":{\"prompt_tokens\":%d,\"completion_tokens\":%d,"
+                            "\"prompt_tokens_details\":{\"cached_tokens\":%d}}}",
+                            prompt_tokens, 8 * choices, cached_tokens);
+    return send_json(fd, body, pos);
+}
+
+static int respond_gemini(int fd, const char *input, int choices, int prompt_tokens, int cached_tokens) {
+    char body[MAX_CHOICES * (MAX_SUGGESTION + 128) + 512];
+    size_t pos = (size_t)snprintf(body, sizeof(body), "{\"candidates\":[");
+    for (int i = 0; i < choices; i++) {
+        pos += (size_t)snprintf(body + pos, sizeof(body) - pos,
+                                "%s{\"content\":{\"parts\":[{\"text\":\"+%s%s\"}],\"role\":\"model\"},"
+                                "\"finishReason\":\"STOP\",\"index\":%d}",
+                                i > 0 ? "," : "", input, completions[i], i);
+    }
+    pos += (size_t)snprintf(body + pos, sizeof(body) - pos,
+                            "],\"usageMetadata\":{\"promptTokenCount\":%d,\"cachedContentTokenCount\":%d,"
+                            "\"candidatesTokenCount\":%d}}",
+                            prompt_tokens, cached_tokens, 8 * choices);
+    return send_json(fd, body, pos);
+}
+
+// The suggestion in three events: the prefix, the input, the completion
+static int respond_stream(int fd, const char *input, int gemini, int usage, int prompt_tokens, int cached_tokens) {
+    static const char header[] = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                                 "Transfer-Encoding: chunked\r\n\r\n";
+    if (write_all(fd, header, sizeof(header) - 1) != 0) return -1;
+
+    const char *parts[3] = {"+", input, completions[0]};
+    char event[MAX_SUGGESTION + 512];
+    for (int i = 0; i < 3; i++) {
+        if (i > 0) sleep_ms(g_options.chunk_delay_ms);
+        int n;
+        if (gemini) {
+            n = snprintf(event, sizeof(event),
+                         "data: {\"candidates\":[{\"content\":{\"parts\":[{\"text\":\"%s\"}],\"role\":\"model\"}}]}\r\n\r\n",
+                         parts[i]);
+        } else {
+            n = snprintf(event, sizeof(event),
+                         "data: {\"choices\":[{\"index\":0,\"delta\":{\"content\":\"%s\"}}]}\n\n", parts[i]);
+        }
+        if (write_chunk(fd, event, (size_t)n) != 0) return -1;
+    }
+
+    int n;
+    if (gemini) {
+        n = snprintf(event, sizeof(event),
+                     "data: {\"candidates\":[{\"content\":{\"parts\":[{\"text\":\"\"}],\"role\":\"model\"},"
+                     "\"finishReason\":\"STOP\"}],\"usageMetadata\":{\"promptTokenCount\":%d,"
+                     "\"cachedContentTokenCount\":%d}}\r\n\r\n", prompt_tokens, cached_tokens);
+    } else if (usage) {
+        // As OpenAI does with stream_options.include_usage: an event with no choices
+        n = snprintf(event, sizeof(event),
+                     "data: {\"choices\":[{\"index\":0,\"delta\":{},\"finish_reason\":\"stop\"}],\"usage\":null}\n\n"
+                     "data: {\"choices\":[],\"usage\":{\"prompt_tokens\":%d,"
+                     "\"prompt_tokens_details\":{\"cached_tokens\":%d}}}\n\n"
+                     "data: [DONE]\n\n", prompt_tokens, cached_tokens);
+    } else {
+        n = snprintf(event, sizeof(event),
+                     "data: {\"choices\":[{\"index\":0,\"delta\":{},\"finish_reason\":\"stop\"}]}\n\n"
+                     "data: [DONE]\n\n");
+    }
+    if (write_chunk(fd, event, (size_t)n) != 0) return -1;
+    return write_all(fd, "0\r\n\r\n", 5);
+}
+
+static int handle_request(connection_t *conn, const char *path, const char *body) {
+    int gemini = strstr(path, ":generateContent") != NULL || strstr(path, ":streamGenerateContent") != NULL;
+    int stream = gemini ? strstr(path, ":streamGenerateContent") != NULL
+                        : strstr(body, "\"stream\":true") != NULL;
+
+    int choices = gemini ? json_int(body, "candidateCount", 1) : json_int(body, "n", 1);
+    if (choices < 1) choices = 1;
+    if (choices > MAX_CHOICES) choices = MAX_CHOICES;
+
+    char input[MAX_SUGGESTION];
+    extract_input(body, input, sizeof(input));
+
+    int prompt_tokens = (int)(strlen(body) / 4);
+    int cached_tokens = (int)(shared_prefix(body) / 4);
+
+    int fail = g_options.error_rate > 0.0 &&
+               (double)rand_r(&conn->seed) / RAND_MAX < g_options.error_rate;
+    int delay = g_options.latency_ms;
+    if (g_options.jitter_ms > 0) delay += rand_r(&conn->seed) % (g_options.jitter_ms + 1);
+    sleep_ms(delay);
+
+    if (fail) return send_error(conn->fd);
+    if (stream) {
+        int usage = gemini || strstr(body, "\"include_usage\":true") != NULL;
+        return respond_stream(conn->fd, input, gemini, usage, prompt_tokens, cached_tokens);
+    }
+    return gemini ? respond_gemini(conn->fd, input, choices, prompt_tokens, cached_tokens)
+                  : respond_openai(conn->fd, input, choices, prompt_tokens, cached_tokens);
+}
+
+// Serve requests on one keep-alive connection until the client closes it
+static void *connection_thread(void *arg) {
+    connection_t *conn = arg;
+    char *buffer = malloc(MAX_HEADER + MAX_BODY + 1);
+    size_t used = 0;
+
+    while (buffer) {
+        // Read until the end of the headers
+        char *headers_end = NULL;
+        while (!(headers_end = memmem(buffer, used, "\r\n\r\n", 4))) {
+            if (used >= MAX_HEADER) goto done;
+            ssize_t n = recv(conn->fd, buffer + used, MAX_HEADER + MAX_BODY - used, 0);
+            if (n <= 0) goto done;
+            used += (size_t)n;
+        }
+        *headers_end = '\0';
+        size_t header_len = (size_t)(headers_end - buffer) + 4;
+
+        char method[16] = "", path[1024] = "";
+        sscanf(buffer, "%15s %1023s", method, path);
+
+        size_t content_length = 0;
+        const char *cl = strcasestr(buffer, "\r\nContent-Length:");
+        if (cl) content_length = strtoul(cl + 17, NULL, 10);
+        if (content_length > MAX_BODY) goto done;
+
+        while (used < header_len + content_length) {
+            ssize_t n = recv(conn->fd, buffer + used, MAX_HEADER + MAX_BODY - used, 0);
+            if (n <= 0) goto done;
+            used += (size_t)n;
+        }
+
+        char saved = buffer[header_len + content_length];
+        buffer[header_len + content_length] = '\0';
+        int result = strcmp(method, "HEAD") == 0 ? send_head(conn->fd)
+                                                 : handle_request(conn, path, buffer + header_len);
+        buffer[header_len + content_length] = saved;
+        if (result != 0) goto done;
+
+        // Keep any pipelined bytes for the next request
+        used -= header_len + content_length;
+        memmove(buffer, buffer + header_len + content_length, used);
+    }
+
+done:
+    free(buffer);
+    close(conn->fd);
+    free(conn);
+    return NULL;
+}
+
+static void print_usage(const char *program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  --port N            Port on 127.0.0.1, 0 picks a free one (default 0)\n");
+    printf("  --latency-ms N      Delay before the first byte (default %d)\n", g_options.latency_ms);
+    printf("  --jitter-ms N       Extra random delay up to N ms (default %d)\n", g_options.jitter_ms);
+    printf("  --chunk-delay-ms N  Delay between streamed events (default %d)\n", g_options.chunk_delay_ms);
+    printf("  --error-rate F      Fraction of requests answered with HTTP 500 (default 0)\n");
+}
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"port", required_argument, 0, 'p'},
+        {"latency-ms", required_argument, 0, 'l'},
+        {"jitter-ms", required_argument, 0, 'j'},
+        {"chunk-delay-ms", required_argument, 0, 'c'},
+        {"error-rate", required_argument, 0, 'e'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int port = 0;
+    int c;
+    while ((c = getopt_long(argc, argv, "p:l:j:c:e:h", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'p': port = atoi(optarg); break;
+        case 'l': g_options.latency_ms = atoi(optarg); break;
+        case 'j': g_options.jitter_ms = atoi(optarg); break;
+        case 'c': g_options.chunk_delay_ms = atoi(optarg); break;
+        case 'e': g_options.error_rate = atof(optarg); break;
+        case 'h':
+            print_usage(argv[0]);
+            return 0;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_fd == -1) {
+        perror("socket");
+        return 1;
+    }
+    int one = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((unsigned short)port);
+    if (bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(server_fd, 128) == -1) {
+        perror("bind");
+        return 1;
+    }
+
+    socklen_t addr_len = sizeof(addr);
+    getsockname(server_fd, (struct sockaddr *)&addr, &addr_len);
+    printf("port %d\n", ntohs(addr.sin_port));
+    fflush(stdout);
+
+    unsigned int seed = (unsigned int)time(NULL);
+    for (;;) {
+        int fd = accept(server_fd, NULL, NULL);
+        if (fd == -1) continue;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        connection_t *conn = malloc(sizeof(connection_t));
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->seed = seed++;
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, connection_thread, conn) != 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
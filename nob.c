@@ -8,6 +8,7 @@
 const char *core_sources[] = {
     "src/config.c",
     "src/llm_client.c",
+    "src/http_client.c",
     "src/basic_context.c",
     "src/pty_proxy.c",
     "src/daemon.c",
@@ -15,7 +16,22 @@ const char *core_sources[] = {
     "src/daemon_history.c",
     "src/manager.c",
     "src/completion.c",
-    "src/utils.c"
+    "src/utils.c",
+    "src/prefetch.c",
+    "src/suggestion_cache.c",
+    "src/shm_cache.c",
+    "src/prefix_index.c",
+    "src/latency.c",
+    "src/provider_health.c",
+    "src/json_writer.c",
+    "src/json_stream.c",
+    "src/prompt.c",
+    "src/command_model.c",
+    "src/singleflight.c",
+    "src/warmup.c",
+    "src/worker_pool.c",
+    "src/ipc_server.c",
+    "src/shell_channel.c"
 };
 
 typedef struct {
@@ -52,7 +68,7 @@ bool build_target(Build_Target target)
         }
     }
 
-    nob_cmd_append(&cmd, "-lutil", "-lcurl", "-ljson-c");
+    nob_cmd_append(&cmd, "-lutil", "-lcurl", "-ljson-c", "-pthread");
 
     const char **input_paths = NULL;
     size_t input_count = 0;
@@ -10,6 +10,12 @@ _SMART_CMD_ORIGINAL_LINE=""
 _SMART_CMD_ENABLED=1
 _SMART_CMD_CURRENT_SUGGESTION=""
 _SMART_CMD_SHOWING_HINT=0
+_SMART_CMD_PREFETCH_DELAY=0
+_SMART_CMD_CLIENT_PID=""
+_SMART_CMD_CLIENT_SEQ=0
+
+# Seconds Ctrl+O waits for the coprocess to answer
+_SMART_CMD_CLIENT_TIMEOUT="${SMART_CMD_CLIENT_TIMEOUT:-3}"
 
 # Configuration and daemon state are now handled by the C binary.
 
@@ -46,15 +52,106 @@ smart-cmd-mode() {
   "$_SMART_CMD_DAEMON_BIN" --status
 }
 
-# Get command context and call smart-cmd backend
+# Start the long-lived completion client, unless it is already running. It
+# keeps one connection to the daemon open (and reopens it if the daemon
+# restarts), so requests are a write and a read on the coproc's pipes.
+_smart-cmd-start-client() {
+  if [[ -n "$_SMART_CMD_CLIENT_PID" && -n "${_SMART_CMD_CLIENT[1]}" ]] &&
+     kill -0 "$_SMART_CMD_CLIENT_PID" 2>/dev/null; then
+    return 0
+  fi
+  [[ -x "$_SMART_CMD_COMPLETION_BIN" ]] || return 1
+
+  { coproc _SMART_CMD_CLIENT { SMART_CMD_SHELL_PID=$$ exec "$_SMART_CMD_COMPLETION_BIN" --coproc 2>/dev/null; }; } 2>/dev/null
+  [[ -n "${_SMART_CMD_CLIENT[1]}" ]]
+}
+
+# Send one line to the client; 1 if it is not running
+_smart-cmd-client-send() {
+  _smart-cmd-start-client || return 1
+  printf '%s\n' "$1" >&"${_SMART_CMD_CLIENT[1]}" 2>/dev/null
+}
+
+# Get command context and call smart-cmd backend; fills _SMART_CMD_SUGGESTIONS
+# (one suggestion per entry, best first)
 _smart-cmd-get-suggestions() {
   local current_line="$1"
+  local line
+  _SMART_CMD_SUGGESTIONS=()
+
+  if _smart-cmd-start-client; then
+    local fd="${_SMART_CMD_CLIENT[0]}"
+    local seq=$((++_SMART_CMD_CLIENT_SEQ))
 
+    if _smart-cmd-client-send "complete $seq $current_line"; then
+      # Answers start with "#<seq>": skip the rest of any answer that came
+      # after an earlier request stopped waiting for it
+      while IFS= read -r -t "$_SMART_CMD_CLIENT_TIMEOUT" -u "$fd" line; do
+        [[ "$line" == "#$seq" ]] && break
+      done
+      if [[ "$line" == "#$seq" ]]; then
+        while IFS= read -r -t "$_SMART_CMD_CLIENT_TIMEOUT" -u "$fd" line && [[ -n "$line" ]]; do
+          _SMART_CMD_SUGGESTIONS+=("$line")
+        done
+      fi
+      return 0
+    fi
+  fi
+
+  # No coprocess (e.g. it could not be started): one process per request,
+  # which tells the daemon which shell it is asking for
   if [[ -x "$_SMART_CMD_COMPLETION_BIN" ]]; then
-    echo "$current_line" | "$_SMART_CMD_COMPLETION_BIN" 2>/dev/null
+    mapfile -t _SMART_CMD_SUGGESTIONS < <(echo "$current_line" |
+      SMART_CMD_SHELL_PID=$$ "$_SMART_CMD_COMPLETION_BIN" 2>/dev/null)
   fi
 }
 
+# Restart the debounce timer: the completion client waits for the configured
+# delay before telling the daemon, so every new keystroke replaces the old one.
+# Only the client prefetches; a keystroke never forks a process.
+_smart-cmd-schedule-prefetch() {
+  if [[ $_SMART_CMD_ENABLED -eq 0 ]]; then
+    return 0
+  fi
+
+  # An empty line only drops the pending prefetch. The client also publishes
+  # the line to the shell channel, when there is one.
+  if [[ -n "${_SMART_CMD_CLIENT[1]}" ]]; then
+    printf 'prefetch %s\n' "$READLINE_LINE" >&"${_SMART_CMD_CLIENT[1]}" 2>/dev/null
+  fi
+}
+
+# Insert a typed character, then schedule a prefetch
+_smart-cmd-self-insert() {
+  local ch="$1"
+  READLINE_LINE="${READLINE_LINE:0:READLINE_POINT}${ch}${READLINE_LINE:READLINE_POINT}"
+  READLINE_POINT=$((READLINE_POINT + ${#ch}))
+  _smart-cmd-schedule-prefetch
+}
+
+# Report the exit status and directory at each prompt; the client sends them
+# with its requests and publishes them to the shell channel, if there is one.
+# Runs first in PROMPT_COMMAND and keeps $?.
+_smart-cmd-prompt-hook() {
+  local status=$?
+  _smart-cmd-client-send "prompt $status $PWD"
+  return $status
+}
+
+# Bind printable keys so typing pauses can be detected. Only in the keymaps
+# where they insert text (emacs and vi insert mode): in vi command mode they
+# stay motions and commands.
+_smart-cmd-bind-prefetch-keys() {
+  local chars="abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_./=:@,+ "
+  local i ch keymap
+  for keymap in emacs vi-insert; do
+    for ((i = 0; i < ${#chars}; i++)); do
+      ch="${chars:i:1}"
+      bind -m "$keymap" -x "\"$ch\": _smart-cmd-self-insert '$ch'"
+    done
+  done
+}
+
 # Show hint below the current line
 _smart-cmd-show-hint() {
   if [[ -n "$_SMART_CMD_CURRENT_SUGGESTION" && $_SMART_CMD_SHOWING_HINT -eq 1 ]]; then
@@ -63,6 +160,12 @@ _smart-cmd-show-hint() {
     local suggestion_text="${_SMART_CMD_CURRENT_SUGGESTION:1}"
     # Remove leading spaces and any leading + or = from suggestion text for display
     suggestion_text=$(echo "$suggestion_text" | sed 's/^ *[+=]//')
+    local position=""
+    local next_hint=""
+    if [[ ${#_SMART_CMD_SUGGESTIONS[@]} -gt 1 ]]; then
+      position=" ($((_SMART_CMD_CURRENT_INDEX + 1))/${#_SMART_CMD_SUGGESTIONS[@]})"
+      next_hint=", Ctrl+O for the next one"
+    fi
 
     # Use tput to draw the hint without disturbing the current line
     tput sc
@@ -70,12 +173,12 @@ _smart-cmd-show-hint() {
     echo
     case "$suggestion_type" in
       "+")
-        echo -e "\e[90m💡 Suggestion: $current_line -> $suggestion_text\e[0m"
-        echo -e "\e[90m→ Press Right arrow to accept, ESC to dismiss\e[0m"
+        echo -e "\e[90m💡 Suggestion$position: $current_line -> $suggestion_text\e[0m"
+        echo -e "\e[90m→ Press Right arrow to accept, ESC to dismiss$next_hint\e[0m"
         ;;
       "=")
-        echo -e "\e[90m💡 Suggestion: $current_line -> $suggestion_text\e[0m"
-        echo -e "\e[90m→ Press Right arrow to accept, ESC to dismiss\e[0m"
+        echo -e "\e[90m💡 Suggestion$position: $current_line -> $suggestion_text\e[0m"
+        echo -e "\e[90m→ Press Right arrow to accept, ESC to dismiss$next_hint\e[0m"
         ;;
     esac
     tput rc
@@ -129,6 +232,18 @@ _smart-cmd-clear-hint() {
   fi
 }
 
+# Esc: dismiss the hint and abort the request the daemon is making for this line
+_smart-cmd-dismiss() {
+  _smart-cmd-clear-hint
+
+  if [[ "$_SMART_CMD_PREFETCH_DELAY" =~ ^[0-9]+$ && $_SMART_CMD_PREFETCH_DELAY -gt 0 ]]; then
+    if ! _smart-cmd-client-send "cancel"; then
+      { SMART_CMD_SHELL_PID=$$ "$_SMART_CMD_COMPLETION_BIN" --cancel >/dev/null 2>&1 & } 2>/dev/null
+      disown $! 2>/dev/null
+    fi
+  fi
+}
+
 # Main completion function triggered by Ctrl+O
 _smart-cmd-complete() {
   if [[ $_SMART_CMD_ENABLED -eq 0 ]]; then
@@ -136,13 +251,27 @@ _smart-cmd-complete() {
   fi
 
   local current_line="${READLINE_LINE}"
+
+  # Pressed again on the same line: show the next candidate without asking again
+  if [[ $_SMART_CMD_SHOWING_HINT -eq 1 && "$current_line" == "$_SMART_CMD_ORIGINAL_LINE" &&
+        ${#_SMART_CMD_SUGGESTIONS[@]} -gt 1 ]]; then
+    _SMART_CMD_CURRENT_INDEX=$(((_SMART_CMD_CURRENT_INDEX + 1) % ${#_SMART_CMD_SUGGESTIONS[@]}))
+    _SMART_CMD_CURRENT_SUGGESTION="${_SMART_CMD_SUGGESTIONS[_SMART_CMD_CURRENT_INDEX]}"
+    tput sc
+    tput ed
+    tput rc
+    _smart-cmd-show-hint
+    return 0
+  fi
+
   _smart-cmd-clear-hint
 
-  # The C binary now returns the suggestion directly as plain text.
-  local first_suggestion=$(_smart-cmd-get-suggestions "$current_line")
+  _smart-cmd-get-suggestions "$current_line"
+  _SMART_CMD_CURRENT_INDEX=0
+  _SMART_CMD_ORIGINAL_LINE="$current_line"
 
-  if [[ -n "$first_suggestion" ]]; then
-    _SMART_CMD_CURRENT_SUGGESTION="$first_suggestion"
+  if [[ -n "${_SMART_CMD_SUGGESTIONS[0]}" ]]; then
+    _SMART_CMD_CURRENT_SUGGESTION="${_SMART_CMD_SUGGESTIONS[0]}"
     _SMART_CMD_SHOWING_HINT=1
     _smart-cmd-show-hint
   fi
@@ -168,7 +297,25 @@ _smart-cmd-setup() {
 
     bind -x '"\C-o": _smart-cmd-complete'
     bind -x '"\e[C": _smart-cmd-accept-hint'
-    bind -x '"\e": _smart-cmd-clear-hint'
+    bind -x '"\e": _smart-cmd-dismiss'
+
+    # Speculative prefetch while typing (enabled via "prefetch" in config.json),
+    # and the line, directory and exit status published to the daemon through
+    # shared memory ("enable_shell_channel")
+    _SMART_CMD_PREFETCH_DELAY=$("$_SMART_CMD_COMPLETION_BIN" --prefetch-delay 2>/dev/null)
+    local shell_channel
+    shell_channel=$("$_SMART_CMD_COMPLETION_BIN" --shell-channel 2>/dev/null)
+    # The client answers for the directory the shell is in, not its own
+    if [[ "$PROMPT_COMMAND" != *_smart-cmd-prompt-hook* ]]; then
+      PROMPT_COMMAND="_smart-cmd-prompt-hook${PROMPT_COMMAND:+; $PROMPT_COMMAND}"
+    fi
+    # One completion client for the life of the shell; it does the debouncing
+    if _smart-cmd-start-client &&
+       { [[ "$_SMART_CMD_PREFETCH_DELAY" =~ ^[0-9]+$ && $_SMART_CMD_PREFETCH_DELAY -gt 0 ]] ||
+         [[ "$shell_channel" == "1" ]]; }; then
+      _smart-cmd-bind-prefetch-keys
+    fi
+
     trap '_smart-cmd-cleanup' EXIT
   fi
 }
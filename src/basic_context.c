@@ -43,7 +43,7 @@ static const char *sensitive_keywords[] = {
     NULL
 };
 
-static int is_sensitive_command(const char *command) {
+int is_sensitive_command(const char *command) {
     if (!command || strlen(command) == 0) return 0;
 
     char lower_cmd[MAX_INPUT_LEN];
@@ -65,51 +65,68 @@ static int is_sensitive_command(const char *command) {
     return 0; // Not sensitive
 }
 
-static int get_command_history(session_context_t *ctx) {
+// Append line and a newline, dropping lines that do not fit whole
+static void append_line(char *buffer, size_t size, const char *line) {
+    size_t buf_len = strlen(buffer);
+    size_t line_len = strlen(line);
+    if (buf_len + line_len + 2 > size) return;
+
+    memcpy(buffer + buf_len, line, line_len);
+    buffer[buf_len + line_len] = '\n';
+    buffer[buf_len + line_len + 1] = '\0';
+}
+
+// $HISTFILE, or ~/.bash_history, with ~ expanded
+int bash_history_path(char *path, size_t path_size) {
     const char *history_file = getenv("HISTFILE");
     if (!history_file) {
         history_file = "~/.bash_history";
     }
 
-    // Expand ~ to home directory
     wordexp_t exp_result;
-    if (wordexp(history_file, &exp_result, 0) == 0) {
-        FILE *fp = fopen(exp_result.we_wordv[0], "r");
-        wordfree(&exp_result);
+    if (wordexp(history_file, &exp_result, 0) != 0) return -1;
+    int result = exp_result.we_wordc > 0 ? safe_string_copy(path, exp_result.we_wordv[0], path_size) : -1;
+    wordfree(&exp_result);
+    return result;
+}
+
+static int get_command_history(session_context_t *ctx) {
+    char history_path[MAX_PATH];
+    if (bash_history_path(history_path, sizeof(history_path)) == 0) {
+        FILE *fp = fopen(history_path, "r");
 
         if (fp) {
+            // Keep the last MAX_HISTORY_COMMANDS non-sensitive lines; the prompt
+            // builder trims them to the history token budget from the oldest end
+            char (*recent_commands)[MAX_INPUT_LEN] = malloc(MAX_HISTORY_COMMANDS * sizeof(*recent_commands));
+            if (!recent_commands) {
+                fclose(fp);
+                return -1;
+            }
+
             char line[MAX_INPUT_LEN];
-            char recent_commands[MAX_HISTORY_MESSAGES][MAX_INPUT_LEN] = {0};
             int found = 0;
-
-            // Simple approach: read all lines and keep last MAX_HISTORY_MESSAGES non-sensitive
-            while (fgets(line, sizeof(line), fp) && found < MAX_HISTORY_MESSAGES) {
+            while (fgets(line, sizeof(line), fp)) {
                 line[strcspn(line, "\n")] = 0; // Remove newline
 
                 if (strlen(line) > 0 && !is_sensitive_command(line)) {
-                    snprintf(recent_commands[found], sizeof(recent_commands[found]), "%s", line);
+                    snprintf(recent_commands[found % MAX_HISTORY_COMMANDS], MAX_INPUT_LEN, "%s", line);
                     found++;
                 }
             }
 
-            // Store commands in context (reverse order - most recent first)
             if (found > 0) {
-                // Most recent command
-                snprintf(ctx->last_command, sizeof(ctx->last_command), "%s", recent_commands[found - 1]);
-
-                // Add to terminal buffer for context
-                snprintf(ctx->terminal_buffer, sizeof(ctx->terminal_buffer), "Recent history: ");
-                for (int i = found - 1; i >= 0; i--) {
-                    size_t buf_len = strlen(ctx->terminal_buffer);
-                    size_t remaining = sizeof(ctx->terminal_buffer) - buf_len - 1;
-
-                    if (remaining > 0) {
-                        snprintf(ctx->terminal_buffer + buf_len, remaining,
-                                "%s%s", recent_commands[i], (i > 0) ? "; " : "");
-                    }
+                snprintf(ctx->last_command, sizeof(ctx->last_command), "%s",
+                         recent_commands[(found - 1) % MAX_HISTORY_COMMANDS]);
+
+                int first = found > MAX_HISTORY_COMMANDS ? found - MAX_HISTORY_COMMANDS : 0;
+                for (int i = first; i < found; i++) {
+                    append_line(ctx->recent_history, sizeof(ctx->recent_history),
+                                recent_commands[i % MAX_HISTORY_COMMANDS]);
                 }
             }
 
+            free(recent_commands);
             fclose(fp);
         }
     }
@@ -121,12 +138,7 @@ static int detect_tmux(session_context_t *ctx) {
     const char *tmux = getenv("TMUX");
     if (tmux && strlen(tmux) > 0) {
         // In tmux session - simplified detection
-        size_t buf_len = strlen(ctx->terminal_buffer);
-        size_t remaining = sizeof(ctx->terminal_buffer) - buf_len - 1;
-
-        if (remaining > 0) {
-            snprintf(ctx->terminal_buffer + buf_len, remaining, "[tmux session] ");
-        }
+        append_line(ctx->environment, sizeof(ctx->environment), "tmux session");
         return 1;
     }
     return 0;
@@ -136,12 +148,7 @@ static int detect_screen(session_context_t *ctx) {
     const char *stty = getenv("STY");
     if (stty && strlen(stty) > 0) {
         // In screen session
-        size_t buf_len = strlen(ctx->terminal_buffer);
-        size_t remaining = sizeof(ctx->terminal_buffer) - buf_len - 1;
-
-        if (remaining > 0) {
-            snprintf(ctx->terminal_buffer + buf_len, remaining, "[screen session] ");
-        }
+        append_line(ctx->environment, sizeof(ctx->environment), "screen session");
         return 1;
     }
     return 0;
@@ -154,12 +161,9 @@ static int get_environment_info(session_context_t *ctx) {
     for (int i = 0; env_vars[i]; i++) {
         const char *value = getenv(env_vars[i]);
         if (value) {
-            size_t buf_len = strlen(ctx->terminal_buffer);
-            size_t remaining = sizeof(ctx->terminal_buffer) - buf_len - 1;
-
-            if (remaining > 0) {
-                snprintf(ctx->terminal_buffer + buf_len, remaining, "%s=%s ", env_vars[i], value);
-            }
+            char line[MAX_PATH + 16];
+            snprintf(line, sizeof(line), "%s=%s", env_vars[i], value);
+            append_line(ctx->environment, sizeof(ctx->environment), line);
         }
     }
 
@@ -177,12 +181,7 @@ static int get_git_info(session_context_t *ctx) {
             char branch[128];
             if (fgets(branch, sizeof(branch), fp)) {
                 branch[strcspn(branch, "\n")] = 0;
-                size_t buf_len = strlen(ctx->terminal_buffer);
-                size_t remaining = sizeof(ctx->terminal_buffer) - buf_len - 1;
-
-                if (remaining > 0) {
-                    snprintf(ctx->terminal_buffer + buf_len, remaining, "[git:%s] ", branch);
-                }
+                snprintf(ctx->git_info, sizeof(ctx->git_info), "branch %s\n", branch);
             }
             pclose(fp);
         }
@@ -191,6 +190,80 @@ static int get_git_info(session_context_t *ctx) {
     return 0;
 }
 
+// Resolve the commit HEAD points at by reading .git directly (no fork/exec)
+int read_git_head(const char *cwd, char *head, size_t head_size) {
+    if (!cwd || !head || head_size == 0) return -1;
+    head[0] = '\0';
+
+    char dir[MAX_PATH];
+    safe_string_copy(dir, cwd, sizeof(dir));
+
+    // Walk up until a directory containing .git/HEAD is found
+    char path[MAX_PATH + 16];
+    FILE *fp = NULL;
+    while (dir[0]) {
+        snprintf(path, sizeof(path), "%s/.git/HEAD", dir);
+        fp = fopen(path, "r");
+        if (fp) break;
+
+        char *slash = strrchr(dir, '/');
+        if (!slash) break;
+        *slash = '\0';
+    }
+    if (!fp) {
+        fp = fopen("/.git/HEAD", "r");
+        if (!fp) return -1;
+        dir[0] = '\0';
+    }
+
+    char line[256];
+    if (!fgets(line, sizeof(line), fp)) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    line[strcspn(line, "\n")] = '\0';
+
+    // Detached HEAD holds the commit id directly
+    if (!starts_with(line, "ref: ")) {
+        safe_string_copy(head, line, head_size);
+        return 0;
+    }
+
+    const char *ref = line + 5;
+    snprintf(path, sizeof(path), "%s/.git/%s", dir, ref);
+    fp = fopen(path, "r");
+    if (fp) {
+        if (fgets(head, head_size, fp)) {
+            head[strcspn(head, "\n")] = '\0';
+        }
+        fclose(fp);
+        if (head[0]) return 0;
+    }
+
+    // Fall back to packed-refs, then to the ref name itself (unborn branch)
+    snprintf(path, sizeof(path), "%s/.git/packed-refs", dir);
+    fp = fopen(path, "r");
+    if (fp) {
+        char packed[512];
+        size_t ref_len = strlen(ref);
+        while (fgets(packed, sizeof(packed), fp)) {
+            packed[strcspn(packed, "\n")] = '\0';
+            char *space = strchr(packed, ' ');
+            if (space && strlen(space + 1) == ref_len && strcmp(space + 1, ref) == 0) {
+                *space = '\0';
+                safe_string_copy(head, packed, head_size);
+                break;
+            }
+        }
+        fclose(fp);
+        if (head[0]) return 0;
+    }
+
+    safe_string_copy(head, ref, head_size);
+    return 0;
+}
+
 int collect_context(session_context_t *ctx) {
     if (!ctx) return -1;
 
@@ -0,0 +1,289 @@
+#define _GNU_SOURCE
+#include "smart_cmd.h"
+#include <pthread.h>
+
+/*
+ * Local Command Model
+ *
+ * Prefix-frequency model of the commands the user actually runs, trained
+ * incrementally from the bash history file as the shell appends to it. Each
+ * distinct command line has a score that grows with every use, where each
+ * use weighs a little more than the one before it (twice as much after about
+ * 500 commands), so habits that changed fade out. Weights are rescaled when
+ * they grow large, which keeps every ratio between scores.
+ *
+ * A completion query returns the best-scoring command that extends the
+ * input; its confidence is its share of the score of all commands that
+ * extend the input. With an empty input the model predicts the next command
+ * from a bigram over consecutive commands instead.
+ *
+ * Everything lives in fixed arrays (hash buckets for training, a linear scan
+ * for queries over at most COMMAND_MODEL_MAX_COMMANDS short strings), so a
+ * query takes microseconds. When the table is full the lowest-scoring
+ * command is replaced.
+ */
+
+#define COMMAND_MODEL_MAX_COMMANDS 1024
+#define COMMAND_MODEL_BUCKETS 1024
+#define COMMAND_MODEL_MAX_LEN 256
+#define COMMAND_MODEL_SUCCESSORS 4
+#define COMMAND_MODEL_GROWTH 1.001387 // 2^(1/500)
+#define COMMAND_MODEL_RESCALE_AT 1e9
+
+typedef struct {
+    uint64_t hash;
+    char command[COMMAND_MODEL_MAX_LEN];
+    double score;
+    unsigned count;
+    uint64_t successors[COMMAND_MODEL_SUCCESSORS]; // Commands that followed this one
+    unsigned successor_counts[COMMAND_MODEL_SUCCESSORS];
+    int hash_next;
+} command_entry_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    command_entry_t entries[COMMAND_MODEL_MAX_COMMANDS];
+    int buckets[COMMAND_MODEL_BUCKETS];
+    int count;
+    int initialized;
+    double weight;          // Score added by the next use
+    uint64_t last_command;  // Hash of the previous command, for the bigram
+    ino_t history_inode;    // History file read so far
+    off_t history_offset;
+    command_model_stats_t stats;
+} command_model_t;
+
+static command_model_t g_model = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static uint64_t command_hash(const char *command) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const unsigned char *p = (const unsigned char *)command; *p; p++) {
+        hash ^= *p;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static void model_init(void) {
+    if (g_model.initialized) return;
+
+    for (int i = 0; i < COMMAND_MODEL_BUCKETS; i++) g_model.buckets[i] = -1;
+    g_model.weight = 1.0;
+    g_model.initialized = 1;
+}
+
+static void next_weight(void) {
+    g_model.weight *= COMMAND_MODEL_GROWTH;
+    if (g_model.weight < COMMAND_MODEL_RESCALE_AT) return;
+
+    for (int i = 0; i < g_model.count; i++) g_model.entries[i].score /= g_model.weight;
+    g_model.weight = 1.0;
+}
+
+static int find_entry(uint64_t hash) {
+    for (int i = g_model.buckets[hash % COMMAND_MODEL_BUCKETS]; i != -1; i = g_model.entries[i].hash_next) {
+        if (g_model.entries[i].hash == hash) return i;
+    }
+    return -1;
+}
+
+static void bucket_unlink(int index) {
+    int *link = &g_model.buckets[g_model.entries[index].hash % COMMAND_MODEL_BUCKETS];
+    while (*link != -1 && *link != index) link = &g_model.entries[*link].hash_next;
+    if (*link == index) *link = g_model.entries[index].hash_next;
+}
+
+// A free slot, or the slot of the lowest-scoring command
+static int entry_alloc(void) {
+    if (g_model.count < COMMAND_MODEL_MAX_COMMANDS) return g_model.count++;
+
+    int victim = 0;
+    for (int i = 1; i < COMMAND_MODEL_MAX_COMMANDS; i++) {
+        if (g_model.entries[i].score < g_model.entries[victim].score) victim = i;
+    }
+    bucket_unlink(victim);
+    g_model.stats.evictions++;
+    return victim;
+}
+
+static void record_successor(command_entry_t *entry, uint64_t next) {
+    int slot = -1;
+    for (int i = 0; i < COMMAND_MODEL_SUCCESSORS; i++) {
+        if (entry->successor_counts[i] > 0 && entry->successors[i] == next) {
+            entry->successor_counts[i]++;
+            return;
+        }
+        if (slot == -1 || entry->successor_counts[i] < entry->successor_counts[slot]) slot = i;
+    }
+    entry->successors[slot] = next;
+    entry->successor_counts[slot] = 1;
+}
+
+static int should_learn(const char *command) {
+    size_t len = strlen(command);
+    if (len == 0 || len >= COMMAND_MODEL_MAX_LEN) return 0;
+    if (command[0] == ' ' || command[0] == '#') return 0; // HISTCONTROL=ignorespace, timestamps
+    return !is_sensitive_command(command);
+}
+
+static void observe_locked(const char *command) {
+    model_init();
+    if (!should_learn(command)) return;
+
+    uint64_t hash = command_hash(command);
+
+    int index = find_entry(hash);
+    command_entry_t *entry;
+    if (index == -1) {
+        index = entry_alloc();
+        entry = &g_model.entries[index];
+        memset(entry, 0, sizeof(command_entry_t));
+        entry->hash = hash;
+        safe_string_copy(entry->command, command, sizeof(entry->command));
+        entry->hash_next = g_model.buckets[hash % COMMAND_MODEL_BUCKETS];
+        g_model.buckets[hash % COMMAND_MODEL_BUCKETS] = index;
+    } else {
+        entry = &g_model.entries[index];
+    }
+    entry->score += g_model.weight;
+    entry->count++;
+    next_weight();
+
+    if (g_model.last_command != 0 && g_model.last_command != hash) {
+        int previous = find_entry(g_model.last_command);
+        if (previous != -1) record_successor(&g_model.entries[previous], hash);
+    }
+    g_model.last_command = hash;
+    g_model.stats.observed++;
+}
+
+// Learn the lines appended to the history file since the last call
+int command_model_sync_history(const char *path) {
+    if (!path) return -1;
+
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0) {
+        fclose(fp);
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_model.lock);
+    model_init();
+
+    // A new or truncated file is read from the start
+    if (st.st_ino != g_model.history_inode || st.st_size < g_model.history_offset) {
+        g_model.history_inode = st.st_ino;
+        g_model.history_offset = 0;
+    }
+    if (st.st_size == g_model.history_offset || fseeko(fp, g_model.history_offset, SEEK_SET) != 0) {
+        pthread_mutex_unlock(&g_model.lock);
+        fclose(fp);
+        return 0;
+    }
+
+    char line[MAX_INPUT_LEN];
+    int learned = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        size_t len = strlen(line);
+        if (len == 0 || line[len - 1] != '\n') break; // Still being written
+        g_model.history_offset += (off_t)len;
+
+        line[len - 1] = '\0';
+        observe_locked(line);
+        learned++;
+    }
+    pthread_mutex_unlock(&g_model.lock);
+
+    fclose(fp);
+    return learned;
+}
+
+// Most likely next command after the previous one
+static int predict_next(suggestion_t *suggestion, double *confidence) {
+    int previous = find_entry(g_model.last_command);
+    if (previous == -1) return -1;
+
+    const command_entry_t *entry = &g_model.entries[previous];
+    unsigned total = 0;
+    int best = -1;
+    for (int i = 0; i < COMMAND_MODEL_SUCCESSORS; i++) {
+        if (entry->successor_counts[i] == 0 || find_entry(entry->successors[i]) == -1) continue;
+        total += entry->successor_counts[i];
+        if (best == -1 || entry->successor_counts[i] > entry->successor_counts[best]) best = i;
+    }
+    if (best == -1) return -1;
+
+    const command_entry_t *next = &g_model.entries[find_entry(entry->successors[best])];
+    suggestion->type = '=';
+    safe_string_copy(suggestion->suggestion, next->command, sizeof(suggestion->suggestion));
+    suggestion->visible = 1;
+    *confidence = (double)entry->successor_counts[best] / total;
+    return (int)entry->successor_counts[best];
+}
+
+// Best-scoring command that extends input
+static int predict_completion(const char *input, suggestion_t *suggestion, double *confidence) {
+    size_t input_len = strlen(input);
+    double total = 0.0;
+    double best_score = 0.0;
+    int best = -1;
+
+    for (int i = 0; i < g_model.count; i++) {
+        const command_entry_t *entry = &g_model.entries[i];
+        if (strncmp(entry->command, input, input_len) != 0 || entry->command[input_len] == '\0') continue;
+
+        total += entry->score;
+        if (best == -1 || entry->score > best_score) {
+            best_score = entry->score;
+            best = i;
+        }
+    }
+    if (best == -1 || total <= 0.0) return -1;
+
+    suggestion->type = '+';
+    safe_string_copy(suggestion->suggestion, g_model.entries[best].command, sizeof(suggestion->suggestion));
+    suggestion->visible = 1;
+    *confidence = best_score / total;
+    return (int)g_model.entries[best].count;
+}
+
+int command_model_predict(const char *input, suggestion_t *suggestion, double *confidence) {
+    if (!input || !suggestion || !confidence) return -1;
+
+    memset(suggestion, 0, sizeof(suggestion_t));
+    *confidence = 0.0;
+
+    pthread_mutex_lock(&g_model.lock);
+    model_init();
+    int count = input[0] ? predict_completion(input, suggestion, confidence)
+                         : predict_next(suggestion, confidence);
+    g_model.stats.queries++;
+    if (count < 0) g_model.stats.misses++;
+    pthread_mutex_unlock(&g_model.lock);
+
+    return count;
+}
+
+void command_model_record_answer(int fallback) {
+    pthread_mutex_lock(&g_model.lock);
+    if (fallback) {
+        g_model.stats.fallbacks++;
+    } else {
+        g_model.stats.answers++;
+    }
+    pthread_mutex_unlock(&g_model.lock);
+}
+
+void command_model_get_stats(command_model_stats_t *stats) {
+    if (!stats) return;
+
+    pthread_mutex_lock(&g_model.lock);
+    *stats = g_model.stats;
+    stats->commands = g_model.count;
+    pthread_mutex_unlock(&g_model.lock);
+}
@@ -1,6 +1,8 @@
 #define _GNU_SOURCE
 #include "smart_cmd.h"
+#include "defaults.h"
 #include <getopt.h>
+#include <poll.h>
 
 #ifdef COMPLETION_BINARY
 
@@ -11,6 +13,9 @@ typedef struct {
     char hostname[256];
     char git_branch[128];
     int git_dirty;
+    int last_status;        // Of the shell's last command, -1 if unknown
+    int shell_pid;          // The shell this process works for
+    int prompts;            // Prompts it has shown since, -1 if unknown
 } completion_context_t;
 
 static void print_completion_usage(const char *program_name) {
@@ -22,6 +27,11 @@ static void print_completion_usage(const char *program_name) {
     printf("Options:\n");
     printf("  -h, --help           Show this help message\n");
     printf("  -v, --version        Show version information\n");
+    printf("  -p, --prefetch       Ask the daemon to prefetch a suggestion after the debounce delay\n");
+    printf("  -d, --prefetch-delay Print the prefetch debounce delay in ms (0 if disabled)\n");
+    printf("  -c, --cancel         Tell the daemon to abort the in-flight prefetch\n");
+    printf("  -C, --coproc         Serve requests line by line on stdin/stdout (started by smart-cmd.bash)\n");
+    printf("  -S, --shell-channel  Print 1 if shell events go to the daemon through shared memory, else 0\n");
 }
 
 static void print_completion_version() {
@@ -34,6 +44,13 @@ static int parse_context_json(const char *context_json, completion_context_t *ct
     // Initialize defaults
     memset(ctx, 0, sizeof(completion_context_t));
     getcwd(ctx->cwd, sizeof(ctx->cwd) - 1);
+    ctx->last_status = -1;
+    ctx->prompts = -1;
+
+    // The shell starts this process, directly or (for one-shot requests from
+    // a subshell) saying which shell it is
+    const char *shell_pid = getenv("SMART_CMD_SHELL_PID");
+    ctx->shell_pid = shell_pid && atoi(shell_pid) > 0 ? atoi(shell_pid) : (int)getppid();
 
     struct passwd *pw = getpwuid(getuid());
     if (pw) {
@@ -104,32 +121,532 @@ static int parse_context_json(const char *context_json, completion_context_t *ct
     return 0;
 }
 
+static void to_session_context(const completion_context_t *ctx, session_context_t *session) {
+    memset(session, 0, sizeof(session_context_t));
+    safe_string_copy(session->user.username, ctx->username, sizeof(session->user.username));
+    safe_string_copy(session->user.hostname, ctx->hostname, sizeof(session->user.hostname));
+    safe_string_copy(session->user.cwd, ctx->cwd, sizeof(session->user.cwd));
+
+    if (ctx->git_branch[0]) {
+        snprintf(session->git_info, sizeof(session->git_info), "branch %s%s\n",
+                 ctx->git_branch, ctx->git_dirty ? " dirty" : "");
+    }
+}
+
 static int get_multiple_suggestions(const char *input, const completion_context_t *ctx,
                                     const config_t *config, suggestion_t *suggestions, int max_suggestions) {
     if (!input || !ctx || !config || !suggestions || max_suggestions <= 0) return -1;
 
-    int count = 0;
+    session_context_t *session = malloc(sizeof(session_context_t));
+    if (!session) return -1;
+    to_session_context(ctx, session);
+
+    // All candidates come from one round trip, deduplicated and ranked
+    if (max_suggestions > config->candidates) max_suggestions = config->candidates;
+    int count = send_to_llm_candidates(input, session, config, suggestions, max_suggestions);
+    free(session);
+
+    return count > 0 ? count : 0;
+}
 
-    // First suggestion
-    if (send_to_llm(input, (const session_context_t*)ctx, config, &suggestions[count]) == 0) {
-        count++;
+
+// Connection to the daemon, kept open across requests in --coproc mode
+typedef struct {
+    int fd;
+    int version;          // Agreed on when it was opened
+    uint32_t next_id;     // Version 2 request ids
+    shell_channel_t *channel; // Handed to each daemon it connects to, if set
+} daemon_connection_t;
+
+static void daemon_connection_close(daemon_connection_t *conn) {
+    if (conn->fd != -1) {
+        close(conn->fd);
+        conn->fd = -1;
     }
+}
 
-    // Second suggestion
-    if (count < max_suggestions) {
-        // For now, skip to avoid complexity
+// One exchange on a version 2 connection. Responses carry the id of their
+// request, so one that comes after its request timed out is skipped here
+// and the connection stays usable.
+static int daemon_exchange_v2(daemon_connection_t *conn, uint32_t type, const char *body,
+                              const int *fds, int fd_count, char *response, size_t response_size) {
+    ipc_frame_t request = {
+        .version = (uint32_t)conn->version,
+        .type = type,
+        .request_id = ++conn->next_id,
+        .length = body ? (uint32_t)strlen(body) : 0,
+        .body = (char *)body,
+    };
+    if (ipc_send_frame_fds(conn->fd, &request, fds, fd_count) == -1) return -1;
+
+    for (;;) {
+        ipc_frame_t reply;
+        if (ipc_receive_frame(conn->fd, &reply) != 1) return -1;
+        if (reply.request_id != request.request_id) {
+            ipc_frame_free(&reply);
+            continue;
+        }
+
+        snprintf(response, response_size, "%s%s", reply.type == MSG_TYPE_ERROR ? "error:" : "", reply.body);
+        ipc_frame_free(&reply);
+        return (int)strlen(response);
     }
+}
 
-    return count;
+// Look the daemon up each time: a restarted daemon listens on a new socket
+static int daemon_connection_open(daemon_connection_t *conn) {
+    daemon_session_t info = {0};
+    if (find_running_daemon(&info) != 0) return -1;
+
+    // A suggestion may wait for a prefetch and then for the provider
+    conn->fd = connect_to_daemon_timeout(info.paths.socket_path, IPC_CONNECT_TIMEOUT_MS,
+                                         IPC_SUGGESTION_TIMEOUT_MS);
+    if (conn->fd == -1) return -1;
+
+    // A live daemon answers the offer from its event loop, as fast as it accepts
+    conn->version = ipc_negotiate(conn->fd, IPC_CONNECT_TIMEOUT_MS);
+    if (conn->version == -1) {
+        // A daemon from before version 2 does not understand the offer
+        close(conn->fd);
+        conn->fd = connect_to_daemon_timeout(info.paths.socket_path, IPC_CONNECT_TIMEOUT_MS,
+                                             IPC_SUGGESTION_TIMEOUT_MS);
+        conn->version = 1;
+    }
+    if (conn->fd == -1) return -1;
+
+    // The daemon reads the shell channel from here on; if it refuses, the
+    // events stay unread
+    if (conn->version >= 2 && conn->channel) {
+        int fds[2] = { conn->channel->memfd, conn->channel->event_fd };
+        char response[64];
+        daemon_exchange_v2(conn, MSG_TYPE_CHANNEL, NULL, fds, 2, response, sizeof(response));
+    }
+    return 0;
+}
+
+// One request/response exchange. A connection that was already open may
+// have been closed by a daemon that exited since; it is reopened and the
+// request sent once more. -1 when no daemon answered, -2 when one took the
+// request but did not answer in time.
+static int daemon_request(daemon_connection_t *conn, uint32_t type, const char *body,
+                          char *response, size_t response_size) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int reused = conn->fd != -1;
+        if (!reused && daemon_connection_open(conn) != 0) return -1;
+
+        int result = -1;
+        if (conn->version >= 2) {
+            result = daemon_exchange_v2(conn, type, body, NULL, 0, response, response_size);
+        } else {
+            char *request = ipc_request_text(type, body);
+            if (request && send_ipc_message(conn->fd, request) == 0) {
+                result = receive_ipc_message(conn->fd, response, response_size);
+            }
+            free(request);
+        }
+        if (result > 0) return result;
+        if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // Version 1 responses cannot be told apart, so a late one would
+            // be read as the next request's: that connection is not reused
+            if (conn->version < 2) daemon_connection_close(conn);
+            return -2;
+        }
+
+        daemon_connection_close(conn);
+        if (!reused) break;
+    }
+    return -1;
+}
+
+// The shell a request comes from, as JSON: its directory, git branch, last
+// exit status, pid and how many commands it has run. The caller frees it.
+static char *format_request_context(const completion_context_t *ctx) {
+    json_writer_t w;
+    if (json_writer_init(&w, 256) != 0) return NULL;
+
+    json_writer_begin_object(&w);
+    json_writer_key(&w, "cwd");
+    json_writer_string(&w, ctx->cwd);
+    if (ctx->git_branch[0]) {
+        json_writer_key(&w, "git");
+        json_writer_begin_object(&w);
+        json_writer_key(&w, "branch");
+        json_writer_string(&w, ctx->git_branch);
+        json_writer_key(&w, "dirty");
+        json_writer_bool(&w, ctx->git_dirty);
+        json_writer_end_object(&w);
+    }
+    if (ctx->last_status >= 0) {
+        json_writer_key(&w, "last_status");
+        json_writer_int(&w, ctx->last_status);
+    }
+    if (ctx->shell_pid > 0) {
+        json_writer_key(&w, "shell_pid");
+        json_writer_int(&w, ctx->shell_pid);
+    }
+    if (ctx->prompts >= 0) {
+        json_writer_key(&w, "prompts");
+        json_writer_int(&w, ctx->prompts);
+    }
+    json_writer_end_object(&w);
+
+    const char *json = json_writer_finish(&w);
+    char *result = json ? strdup(json) : NULL;
+    json_writer_free(&w);
+    return result;
+}
+
+// A request made in the shell ctx describes: a suggestion or prefetch for
+// input, or a cancel (input NULL). The daemon's own directory and history
+// are not the user's, and each shell has its own prefetch, so from version
+// 3 on the context follows the input on a second line; older daemons get
+// the input alone. A connection still to be opened is opened first, to know
+// which one it is.
+static int daemon_input_request(daemon_connection_t *conn, uint32_t type, const char *input,
+                                const completion_context_t *ctx, char *response, size_t response_size) {
+    if (conn->fd == -1 && daemon_connection_open(conn) != 0) return -1;
+    if (conn->version < IPC_VERSION_CONTEXT || !ctx) {
+        return daemon_request(conn, type, input, response, response_size);
+    }
+
+    char *context = format_request_context(ctx);
+    char *body = context ? malloc((input ? strlen(input) : 0) + strlen(context) + 2) : NULL;
+    if (!body) {
+        free(context);
+        return daemon_request(conn, type, input, response, response_size);
+    }
+    if (input) {
+        sprintf(body, "%s\n%s", input, context);
+    } else {
+        strcpy(body, context);
+    }
+
+    int result = daemon_request(conn, type, body, response, response_size);
+    free(body);
+    free(context);
+    return result;
+}
+
+static void send_prefetch(daemon_connection_t *conn, const char *input, const completion_context_t *ctx) {
+    char response[256];
+    daemon_input_request(conn, MSG_TYPE_PREFETCH, input, ctx, response, sizeof(response));
+}
+
+static int run_prefetch(const char *input, const completion_context_t *ctx, const config_t *config) {
+    if (!config->prefetch.enabled || strlen(input) == 0) return 0;
+
+    // The shell kills this process when another key arrives, which is what
+    // turns the sleep into a debounce
+    usleep((useconds_t)config->prefetch.debounce_ms * 1000);
+
+    daemon_connection_t conn = { .fd = -1 };
+    send_prefetch(&conn, input, ctx);
+    daemon_connection_close(&conn);
+    return 0;
+}
+
+static void send_cancel(daemon_connection_t *conn, const completion_context_t *ctx) {
+    char response[64];
+    daemon_input_request(conn, MSG_TYPE_CANCEL, NULL, ctx, response, sizeof(response));
+}
+
+static int run_cancel(void) {
+    completion_context_t ctx;
+    parse_context_json(NULL, &ctx);
+
+    daemon_connection_t conn = { .fd = -1 };
+    send_cancel(&conn, &ctx);
+    daemon_connection_close(&conn);
+    return 0;
 }
 
+// Ask the daemon, which has the shell's history, its caches, any prefetch
+// for this input and warm provider connections. It answers with one
+// suggestion per line, best first. The number of suggestions, 0 when it
+// answered without one, -1 when no daemon answered.
+static int get_daemon_suggestions(daemon_connection_t *conn, const char *input, const completion_context_t *ctx,
+                                  suggestion_t *suggestions, int max_suggestions) {
+    char response[MAX_CANDIDATES * (MAX_SUGGESTION_LEN + 2)];
+    int result = daemon_input_request(conn, MSG_TYPE_SUGGESTION, input, ctx, response, sizeof(response));
+    if (result == -1) return -1;
+    if (result <= 0 || starts_with(response, "error:")) return 0;
+
+    int count = 0;
+    char *line = response;
+    while (line && count < max_suggestions) {
+        char *next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+
+        if (strlen(line) >= 2) {
+            suggestion_t *suggestion = &suggestions[count++];
+            memset(suggestion, 0, sizeof(suggestion_t));
+            suggestion->type = line[0];
+            safe_string_copy(suggestion->suggestion, line + 1, sizeof(suggestion->suggestion));
+            suggestion->visible = 1;
+        }
+        line = next;
+    }
+    return count;
+}
 
+// One suggestion per line, best first; the shell cycles through them
 static void print_suggestions_plain(suggestion_t *suggestions, int count) {
-    if (count > 0) {
-        printf("%c%s", suggestions[0].type, suggestions[0].suggestion);
+    for (int i = 0; i < count; i++) {
+        printf("%s%c%s", i > 0 ? "\n" : "", suggestions[i].type, suggestions[i].suggestion);
     }
 }
 
+// Print the suggestions for one input typed in the shell ctx describes; the
+// number printed, or -1 without a usable configuration (config NULL)
+static int complete_input(daemon_connection_t *conn, const char *input, const completion_context_t *ctx,
+                          const config_t *loaded) {
+    if (!loaded) {
+        fprintf(stderr, "Failed to load configuration\n");
+        return -1;
+    }
+    config_t config = *loaded;
+
+    // A running daemon answers; direct mode is only for when none does
+    suggestion_t answers[MAX_CANDIDATES];
+    int answered = get_daemon_suggestions(conn, input, ctx, answers, MAX_CANDIDATES);
+    if (answered > 0) {
+        print_suggestions_plain(answers, answered);
+        return answered;
+    }
+    if (answered == 0) return 0;
+
+    // Repeated completions are served from the shared on-disk cache, so they
+    // skip the LLM even without a daemon
+    uint64_t cache_key = 0;
+    int use_shared_cache = config.cache.enabled && config.cache.persistent && shm_cache_open() == 0;
+    if (use_shared_cache) {
+        cache_key = shm_cache_key(input, ctx->cwd);
+
+        suggestion_t cached;
+        if (shm_cache_get(cache_key, &cached) == 0) {
+            print_suggestions_plain(&cached, 1);
+            return 1;
+        }
+    }
+
+    // Commands the user runs all the time are answered from the history file
+    suggestion_t local;
+    double local_confidence = 0.0;
+    int local_count = -1;
+    char history_path[MAX_PATH];
+    if (config.local_model.enabled && bash_history_path(history_path, sizeof(history_path)) == 0 &&
+        command_model_sync_history(history_path) >= 0) {
+        local_count = command_model_predict(input, &local, &local_confidence);
+        if (local_count >= config.local_model.min_count &&
+            local_confidence >= config.local_model.min_confidence) {
+            print_suggestions_plain(&local, 1);
+            return 1;
+        }
+    }
+
+    // Get suggestions
+    suggestion_t suggestions[MAX_CANDIDATES];
+    int suggestion_count = get_multiple_suggestions(input, ctx, &config, suggestions, MAX_CANDIDATES);
+
+    if (suggestion_count > 0) {
+        print_suggestions_plain(suggestions, suggestion_count);
+        if (use_shared_cache) {
+            shm_cache_put(cache_key, &suggestions[0], config.cache.ttl_seconds);
+        }
+        return suggestion_count;
+    }
+    if (local_count >= 0) {
+        // Provider unreachable or broken: the local model is better than nothing
+        print_suggestions_plain(&local, 1);
+        return 1;
+    }
+    return 0;
+}
+
+// The coprocess's configuration: read when it starts, and again only when
+// the file's modification time changes, not for every request and keystroke
+typedef struct {
+    config_t config;
+    int loaded;              // load_config() found the file
+    char *path;
+    struct timespec mtime;   // Of the file when it was read; zero if missing
+    int read;                // Read at least once
+} coproc_config_t;
+
+// The current configuration, or NULL if there is no usable one
+static const config_t *coproc_config(coproc_config_t *cached) {
+    struct stat st;
+    struct timespec mtime = {0};
+    if (cached->path && stat(cached->path, &st) == 0) mtime = st.st_mtim;
+
+    if (!cached->read || mtime.tv_sec != cached->mtime.tv_sec || mtime.tv_nsec != cached->mtime.tv_nsec) {
+        cached->loaded = load_config(&cached->config) == 0;
+        cached->mtime = mtime;
+        cached->read = 1;
+    }
+    return cached->loaded ? &cached->config : NULL;
+}
+
+// Next newline-terminated line from the buffer, in place; NULL if there is none
+static char *next_line(char *buffer, size_t *len, size_t *consumed) {
+    char *newline = memchr(buffer + *consumed, '\n', *len - *consumed);
+    if (!newline) return NULL;
+
+    char *line = buffer + *consumed;
+    *newline = '\0';
+    *consumed = (size_t)(newline - buffer) + 1;
+    return line;
+}
+
+// "prompt <status> <cwd>": the shell is back at its prompt. Its directory
+// and exit status go with the requests that follow, and to the shell
+// channel when there is one.
+static void handle_prompt(completion_context_t *shell, shell_channel_t *channel, const char *args,
+                          char *last_cwd, size_t last_cwd_size) {
+    char *cwd;
+    long status = strtol(args, &cwd, 10);
+    if (cwd == args) return;
+    if (*cwd == ' ') cwd++;
+
+    shell->last_status = (int)status;
+    shell->prompts++;
+    if (*cwd) safe_string_copy(shell->cwd, cwd, sizeof(shell->cwd));
+    if (!channel) return;
+
+    shell_channel_publish(channel, SHELL_EVENT_EXIT, (int)status, NULL);
+    if (*cwd && strcmp(cwd, last_cwd) != 0) {
+        shell_channel_publish(channel, SHELL_EVENT_CWD, 0, cwd);
+        safe_string_copy(last_cwd, cwd, last_cwd_size);
+    }
+}
+
+/*
+ * Coprocess mode: smart-cmd.bash starts one of these per interactive shell
+ * (`coproc`) and talks to it over its stdin/stdout, so Ctrl+O is a write and
+ * a read on pipes the shell already has instead of a fork and exec, and the
+ * connection to the daemon stays open between requests. One request per
+ * line:
+ *
+ *   complete <seq> <line>
+ *                     "#<seq>", the suggestions one per line, then an empty
+ *                     line; the shell tells a late answer to an earlier
+ *                     request by its sequence number
+ *   prefetch <line>   prefetch <line> once the debounce delay passes without
+ *                     another prefetch (no reply)
+ *   cancel            drop the pending prefetch, abort the daemon's (no reply)
+ *   prompt <status> <cwd>
+ *                     the shell is back at its prompt (no reply)
+ *
+ * The directory and exit status of the last prompt go with each request,
+ * since this process stays in the directory the shell started in. The
+ * configuration is read again only when config.json changes.
+ *
+ * With enable_shell_channel, typed lines and prompts are also published to
+ * the daemon through the shell channel, which is handed to every daemon
+ * this process connects to.
+ *
+ * The process exits when the shell closes its end of the pipe.
+ */
+static int run_coproc(void) {
+    daemon_connection_t conn = { .fd = -1 };
+
+    coproc_config_t settings = { .path = get_config_file_path() };
+    const config_t *config = coproc_config(&settings);
+
+    // Line, directory and exit status go to the daemon through shared memory
+    shell_channel_t channel = { .memfd = -1, .event_fd = -1 };
+    if (config && config->enable_shell_channel && shell_channel_create(&channel) == 0) {
+        conn.channel = &channel;
+    }
+    char last_cwd[MAX_PATH] = {0};
+
+    // Until the first prompt the shell is where it started this process
+    completion_context_t shell;
+    parse_context_json(NULL, &shell);
+    shell.prompts = 0;
+
+    daemon_connection_open(&conn); // Connected before the first Ctrl+O needs it
+
+    char buffer[MAX_INPUT_LEN + 16];
+    size_t len = 0;
+    int discarding = 0;            // Rest of a line too long for the buffer
+
+    char pending[MAX_INPUT_LEN] = {0};
+    uint64_t prefetch_at = 0;      // monotonic_ms() to send pending at, 0 if none
+
+    for (;;) {
+        int timeout = -1;
+        if (prefetch_at) {
+            uint64_t now = monotonic_ms();
+            timeout = prefetch_at > now ? (int)(prefetch_at - now) : 0;
+        }
+
+        struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+        int ready = poll(&pfd, 1, timeout);
+        if (ready == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (ready == 0) {
+            send_prefetch(&conn, pending, &shell);
+            prefetch_at = 0;
+            continue;
+        }
+
+        ssize_t received = read(STDIN_FILENO, buffer + len, sizeof(buffer) - 1 - len);
+        if (received == -1 && errno == EINTR) continue;
+        if (received <= 0) break; // The shell exited
+        len += (size_t)received;
+
+        size_t consumed = 0;
+        char *line;
+        while ((line = next_line(buffer, &len, &consumed)) != NULL) {
+            if (discarding) {
+                discarding = 0;
+                continue;
+            }
+
+            if (starts_with(line, "complete ")) {
+                char *input;
+                unsigned long seq = strtoul(line + 9, &input, 10);
+                if (input == line + 9 || *input != ' ') continue;
+
+                prefetch_at = 0; // The line is asked for now
+                printf("#%lu\n", seq);
+                if (complete_input(&conn, input + 1, &shell, coproc_config(&settings)) > 0) printf("\n");
+                printf("\n");
+                fflush(stdout);
+            } else if (starts_with(line, "prefetch ")) {
+                if (conn.channel) shell_channel_publish(conn.channel, SHELL_EVENT_LINE, 0, line + 9);
+                prefetch_at = 0;
+                config = line[9] ? coproc_config(&settings) : NULL;
+                if (config && config->prefetch.enabled) {
+                    safe_string_copy(pending, line + 9, sizeof(pending));
+                    prefetch_at = monotonic_ms() + (uint64_t)config->prefetch.debounce_ms;
+                }
+            } else if (strcmp(line, "cancel") == 0) {
+                prefetch_at = 0;
+                send_cancel(&conn, &shell);
+            } else if (starts_with(line, "prompt ")) {
+                handle_prompt(&shell, conn.channel, line + 7, last_cwd, sizeof(last_cwd));
+            }
+        }
+
+        len -= consumed;
+        memmove(buffer, buffer + consumed, len);
+        if (len == sizeof(buffer) - 1) {
+            // No newline in a full buffer: not a request this process can take
+            len = 0;
+            discarding = 1;
+        }
+    }
+
+    daemon_connection_close(&conn);
+    shell_channel_destroy(&channel);
+    free(settings.path);
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     char input[MAX_INPUT_LEN] = {0};
     char context_json[MAX_CONTEXT_LEN] = {0};
@@ -137,13 +654,19 @@ int main(int argc, char *argv[]) {
     static struct option long_options[] = {
         {"help", no_argument, 0, 'h'},
         {"version", no_argument, 0, 'v'},
+        {"prefetch", no_argument, 0, 'p'},
+        {"prefetch-delay", no_argument, 0, 'd'},
+        {"cancel", no_argument, 0, 'c'},
+        {"coproc", no_argument, 0, 'C'},
+        {"shell-channel", no_argument, 0, 'S'},
         {0, 0, 0, 0}
     };
 
     int option_index = 0;
     int c;
+    int prefetch_mode = 0;
 
-    while ((c = getopt_long(argc, argv, "hv", long_options, &option_index)) != -1) {
+    while ((c = getopt_long(argc, argv, "hvpdcCS", long_options, &option_index)) != -1) {
         switch (c) {
         case 'h':
             print_completion_usage(argv[0]);
@@ -151,6 +674,25 @@ int main(int argc, char *argv[]) {
         case 'v':
             print_completion_version();
             return 0;
+        case 'p':
+            prefetch_mode = 1;
+            break;
+        case 'd': {
+            config_t config;
+            load_config(&config);
+            printf("%d\n", config.prefetch.enabled ? config.prefetch.debounce_ms : 0);
+            return 0;
+        }
+        case 'c':
+            return run_cancel();
+        case 'C':
+            return run_coproc();
+        case 'S': {
+            config_t config;
+            load_config(&config);
+            printf("%d\n", config.enable_shell_channel ? 1 : 0);
+            return 0;
+        }
         case '?':
             fprintf(stderr, "Unknown option. Use -h for help.\n");
             return 1;
@@ -175,37 +717,27 @@ int main(int argc, char *argv[]) {
         context_json[strcspn(context_json, "\n")] = '\0';
     }
 
-    // Load configuration
-    config_t config;
-    if (load_config(&config) == -1) {
-        fprintf(stderr, "Failed to load configuration\n");
+    // Started by the shell, so in its directory unless the JSON says otherwise
+    completion_context_t ctx;
+    if (parse_context_json(context_json[0] ? context_json : NULL, &ctx) == -1) {
+        fprintf(stderr, "Failed to parse context JSON\n");
         return 1;
     }
 
-    // Parse context
-    completion_context_t ctx;
-    if (strlen(context_json) > 0) {
-        if (parse_context_json(context_json, &ctx) == -1) {
-            fprintf(stderr, "Failed to parse context JSON\n");
-            return 1;
-        }
-    } else {
-        // Use default context if no JSON provided
-        if (parse_context_json(NULL, &ctx) == -1) {
-            fprintf(stderr, "Failed to create default context\n");
+    if (prefetch_mode) {
+        config_t config;
+        if (load_config(&config) == -1) {
+            fprintf(stderr, "Failed to load configuration\n");
             return 1;
         }
+        return run_prefetch(input, &ctx, &config);
     }
 
-    // Get suggestions
-    suggestion_t suggestions[5];
-    int suggestion_count = get_multiple_suggestions(input, &ctx, &config, suggestions, 5);
-
-    if (suggestion_count > 0) {
-        print_suggestions_plain(suggestions, suggestion_count);
-    }
-
-    return 0;
+    config_t config;
+    daemon_connection_t conn = { .fd = -1 };
+    int result = complete_input(&conn, input, &ctx, load_config(&config) == 0 ? &config : NULL);
+    daemon_connection_close(&conn);
+    return result == -1 ? 1 : 0;
 }
 
 #endif // COMPLETION_BINARY
@@ -219,7 +751,7 @@ int parse_completion_context(const char *context_json, session_context_t *ctx) {
     json_object *root = json_tokener_parse(context_json);
     if (!root) return -1;
 
-    json_object *cwd, *user, *host;
+    json_object *cwd, *user, *host, *git, *status, *shell_pid, *prompts;
     if (json_object_object_get_ex(root, "cwd", &cwd)) {
         strncpy(ctx->user.cwd, json_object_get_string(cwd), sizeof(ctx->user.cwd) - 1);
     }
@@ -230,6 +762,24 @@ int parse_completion_context(const char *context_json, session_context_t *ctx) {
         strncpy(ctx->user.hostname, json_object_get_string(host), sizeof(ctx->user.hostname) - 1);
     }
 
+    json_object *branch, *dirty;
+    if (json_object_object_get_ex(root, "git", &git) &&
+        json_object_object_get_ex(git, "branch", &branch)) {
+        int is_dirty = json_object_object_get_ex(git, "dirty", &dirty) && json_object_get_boolean(dirty);
+        snprintf(ctx->git_info, sizeof(ctx->git_info), "branch %s%s\n",
+                 json_object_get_string(branch), is_dirty ? " dirty" : "");
+    }
+    if (json_object_object_get_ex(root, "last_status", &status)) {
+        snprintf(ctx->environment, sizeof(ctx->environment), "Last exit status: %d",
+                 json_object_get_int(status));
+    }
+    if (json_object_object_get_ex(root, "shell_pid", &shell_pid)) {
+        ctx->shell_pid = json_object_get_int(shell_pid);
+    }
+    if (json_object_object_get_ex(root, "prompts", &prompts)) {
+        ctx->shell_prompts = json_object_get_int(prompts);
+    }
+
     json_object_put(root);
     return 0;
 }
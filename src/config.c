@@ -50,6 +50,47 @@ static int parse_keybinding(const char* key_str) {
     return 15;
 }
 
+static const char* provider_env_api_key(const char* provider) {
+    const char* env_api_key = NULL;
+    if (strcmp(provider, "openai") == 0) {
+        env_api_key = getenv("OPENAI_API_KEY");
+    } else if (strcmp(provider, "gemini") == 0) {
+        env_api_key = getenv("GEMINI_API_KEY");
+    } else if (strcmp(provider, "openrouter") == 0) {
+        env_api_key = getenv("OPENROUTER_API_KEY");
+    }
+    return (env_api_key && strlen(env_api_key) > 0) ? env_api_key : NULL;
+}
+
+// Fill llm from the providers table entry for provider
+static void load_provider_config(json_object* root, const char* provider, llm_config_t* llm) {
+    memset(llm, 0, sizeof(llm_config_t));
+    snprintf(llm->provider, sizeof(llm->provider), "%s", provider);
+    if (strcmp(provider, "openrouter") == 0) {
+        snprintf(llm->endpoint, sizeof(llm->endpoint), "%s", DEFAULT_OPENROUTER_ENDPOINT);
+    }
+
+    json_object *providers_obj, *provider_config;
+    if (json_object_object_get_ex(root, "providers", &providers_obj) &&
+        json_object_object_get_ex(providers_obj, provider, &provider_config)) {
+        json_object *value_obj;
+        if (json_object_object_get_ex(provider_config, "model", &value_obj)) {
+            snprintf(llm->model, sizeof(llm->model), "%s", json_object_get_string(value_obj));
+        }
+        if (json_object_object_get_ex(provider_config, "endpoint", &value_obj)) {
+            snprintf(llm->endpoint, sizeof(llm->endpoint), "%s", json_object_get_string(value_obj));
+        }
+        if (json_object_object_get_ex(provider_config, "api_key", &value_obj)) {
+            snprintf(llm->api_key, sizeof(llm->api_key), "%s", json_object_get_string(value_obj));
+        }
+    }
+
+    const char* env_api_key = provider_env_api_key(provider);
+    if (env_api_key) {
+        snprintf(llm->api_key, sizeof(llm->api_key), "%s", env_api_key);
+    }
+}
+
 int load_config(config_t *config) {
     if (!config) return -1;
 
@@ -62,6 +103,28 @@ int load_config(config_t *config) {
     config->trigger_key_value = parse_keybinding("ctrl+o");
     config->enable_proxy_mode = 1;
     config->show_startup_messages = 1;
+    config->enable_streaming = 0;
+    config->enable_shell_channel = 0;
+    config->candidates = DEFAULT_CANDIDATES;
+    config->local_model.enabled = 1;
+    config->local_model.min_confidence = DEFAULT_LOCAL_MODEL_MIN_CONFIDENCE;
+    config->local_model.min_count = DEFAULT_LOCAL_MODEL_MIN_COUNT;
+    memset(&config->hedge, 0, sizeof(config->hedge));
+    config->hedge.delay_ms = DEFAULT_HEDGE_DELAY_MS;
+    config->hedge.adaptive = 1;
+    config->prefetch.enabled = 0;
+    config->prefetch.debounce_ms = DEFAULT_PREFETCH_DEBOUNCE_MS;
+    config->warmup.enabled = 1;
+    config->warmup.interval_seconds = DEFAULT_WARMUP_INTERVAL_SECONDS;
+    config->cache.enabled = 1;
+    config->cache.max_entries = DEFAULT_CACHE_MAX_ENTRIES;
+    config->cache.ttl_seconds = DEFAULT_CACHE_TTL_SECONDS;
+    config->cache.negative_ttl_seconds = DEFAULT_CACHE_NEGATIVE_TTL_SECONDS;
+    config->cache.persistent = 1;
+    config->prompt.history_tokens = DEFAULT_PROMPT_HISTORY_TOKENS;
+    config->prompt.terminal_tokens = DEFAULT_PROMPT_TERMINAL_TOKENS;
+    config->prompt.environment_tokens = DEFAULT_PROMPT_ENVIRONMENT_TOKENS;
+    config->prompt.git_tokens = DEFAULT_PROMPT_GIT_TOKENS;
 
     char *config_path = expand_path(CONFIG_FILE_PATH);
     FILE *fp = fopen(config_path, "r");
@@ -146,17 +209,32 @@ int load_config(config_t *config) {
     }
 
     // Environment variables have highest priority for API keys
-    const char *env_api_key = NULL;
-    if (strcmp(config->llm.provider, "openai") == 0) {
-        env_api_key = getenv("OPENAI_API_KEY");
-    } else if (strcmp(config->llm.provider, "gemini") == 0) {
-        env_api_key = getenv("GEMINI_API_KEY");
-    } else if (strcmp(config->llm.provider, "openrouter") == 0) {
-        env_api_key = getenv("OPENROUTER_API_KEY");
+    const char *env_api_key = provider_env_api_key(config->llm.provider);
+    if (env_api_key) {
+        snprintf(config->llm.api_key, sizeof(config->llm.api_key), "%s", env_api_key);
     }
 
-    if (env_api_key && strlen(env_api_key) > 0) {
-        snprintf(config->llm.api_key, sizeof(config->llm.api_key), "%s", env_api_key);
+    // Parse request hedging settings; the secondary comes from the providers table
+    json_object *hedge_obj;
+    if (json_object_object_get_ex(root, "hedge", &hedge_obj)) {
+        json_object *value_obj;
+        if (json_object_object_get_ex(hedge_obj, "enabled", &value_obj)) {
+            config->hedge.enabled = json_object_get_boolean(value_obj);
+        }
+        if (json_object_object_get_ex(hedge_obj, "delay_ms", &value_obj)) {
+            int delay_ms = json_object_get_int(value_obj);
+            if (delay_ms >= 0) config->hedge.delay_ms = delay_ms;
+        }
+        if (json_object_object_get_ex(hedge_obj, "adaptive", &value_obj)) {
+            config->hedge.adaptive = json_object_get_boolean(value_obj);
+        }
+        if (json_object_object_get_ex(hedge_obj, "provider", &value_obj)) {
+            load_provider_config(root, json_object_get_string(value_obj), &config->hedge.llm);
+        }
+    }
+    if (config->hedge.llm.provider[0] == '\0' ||
+        strcmp(config->hedge.llm.provider, config->llm.provider) == 0) {
+        config->hedge.enabled = 0; // Nothing to hedge against
     }
 
     // Parse trigger key
@@ -179,6 +257,111 @@ int load_config(config_t *config) {
         config->show_startup_messages = json_object_get_boolean(startup_obj);
     }
 
+    // Parse streaming setting
+    json_object *streaming_obj;
+    if (json_object_object_get_ex(root, "enable_streaming", &streaming_obj)) {
+        config->enable_streaming = json_object_get_boolean(streaming_obj);
+    }
+
+    // Parse the shared-memory shell channel setting
+    json_object *shell_channel_obj;
+    if (json_object_object_get_ex(root, "enable_shell_channel", &shell_channel_obj)) {
+        config->enable_shell_channel = json_object_get_boolean(shell_channel_obj);
+    }
+
+    // Parse the number of suggestions to request at once
+    json_object *candidates_obj;
+    if (json_object_object_get_ex(root, "candidates", &candidates_obj)) {
+        int candidates = json_object_get_int(candidates_obj);
+        if (candidates >= 1 && candidates <= MAX_CANDIDATES) config->candidates = candidates;
+    }
+
+    // Parse speculative prefetch settings
+    json_object *prefetch_obj;
+    if (json_object_object_get_ex(root, "prefetch", &prefetch_obj)) {
+        json_object *enabled_obj;
+        if (json_object_object_get_ex(prefetch_obj, "enabled", &enabled_obj)) {
+            config->prefetch.enabled = json_object_get_boolean(enabled_obj);
+        }
+        json_object *debounce_obj;
+        if (json_object_object_get_ex(prefetch_obj, "debounce_ms", &debounce_obj)) {
+            int debounce_ms = json_object_get_int(debounce_obj);
+            if (debounce_ms >= 0) config->prefetch.debounce_ms = debounce_ms;
+        }
+    }
+
+    // Parse connection warm-up settings
+    json_object *warmup_obj;
+    if (json_object_object_get_ex(root, "warmup", &warmup_obj)) {
+        json_object *value_obj;
+        if (json_object_object_get_ex(warmup_obj, "enabled", &value_obj)) {
+            config->warmup.enabled = json_object_get_boolean(value_obj);
+        }
+        if (json_object_object_get_ex(warmup_obj, "interval_seconds", &value_obj)) {
+            int interval = json_object_get_int(value_obj);
+            if (interval > 0) config->warmup.interval_seconds = interval;
+        }
+    }
+
+    // Parse suggestion cache settings
+    json_object *cache_obj;
+    if (json_object_object_get_ex(root, "cache", &cache_obj)) {
+        json_object *value_obj;
+        if (json_object_object_get_ex(cache_obj, "enabled", &value_obj)) {
+            config->cache.enabled = json_object_get_boolean(value_obj);
+        }
+        if (json_object_object_get_ex(cache_obj, "max_entries", &value_obj)) {
+            int max_entries = json_object_get_int(value_obj);
+            if (max_entries > 0) config->cache.max_entries = max_entries;
+        }
+        if (json_object_object_get_ex(cache_obj, "ttl_seconds", &value_obj)) {
+            int ttl = json_object_get_int(value_obj);
+            if (ttl >= 0) config->cache.ttl_seconds = ttl;
+        }
+        if (json_object_object_get_ex(cache_obj, "negative_ttl_seconds", &value_obj)) {
+            int ttl = json_object_get_int(value_obj);
+            if (ttl >= 0) config->cache.negative_ttl_seconds = ttl;
+        }
+        if (json_object_object_get_ex(cache_obj, "persistent", &value_obj)) {
+            config->cache.persistent = json_object_get_boolean(value_obj);
+        }
+    }
+
+    // Parse local command model settings
+    json_object *local_model_obj;
+    if (json_object_object_get_ex(root, "local_model", &local_model_obj)) {
+        json_object *value_obj;
+        if (json_object_object_get_ex(local_model_obj, "enabled", &value_obj)) {
+            config->local_model.enabled = json_object_get_boolean(value_obj);
+        }
+        if (json_object_object_get_ex(local_model_obj, "min_confidence", &value_obj)) {
+            double confidence = json_object_get_double(value_obj);
+            if (confidence >= 0.0 && confidence <= 1.0) config->local_model.min_confidence = confidence;
+        }
+        if (json_object_object_get_ex(local_model_obj, "min_count", &value_obj)) {
+            int min_count = json_object_get_int(value_obj);
+            if (min_count >= 1) config->local_model.min_count = min_count;
+        }
+    }
+
+    // Parse prompt token budgets
+    json_object *prompt_obj;
+    if (json_object_object_get_ex(root, "prompt", &prompt_obj)) {
+        struct { const char *key; int *value; } budgets[] = {
+            { "history_tokens", &config->prompt.history_tokens },
+            { "terminal_tokens", &config->prompt.terminal_tokens },
+            { "environment_tokens", &config->prompt.environment_tokens },
+            { "git_tokens", &config->prompt.git_tokens },
+        };
+        for (size_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++) {
+            json_object *value_obj;
+            if (json_object_object_get_ex(prompt_obj, budgets[i].key, &value_obj)) {
+                int tokens = json_object_get_int(value_obj);
+                if (tokens >= 0) *budgets[i].value = tokens;
+            }
+        }
+    }
+
     json_object_put(root);
     return 0;
 }
@@ -121,6 +121,32 @@ int get_recent_commands(command_history_manager_t *manager, char *recent_command
     return found;
 }
 
+// Commands newer than max_age, one per line with the oldest first
+int get_recent_history(command_history_manager_t *manager, char *history, size_t history_size, time_t max_age) {
+    if (!manager || !history || history_size == 0) return -1;
+
+    time_t cutoff_time = (max_age > 0) ? (time(NULL) - max_age) : 0;
+    history[0] = '\0';
+    size_t len = 0;
+    int found = 0;
+
+    for (int i = manager->count - 1; i >= 0; i--) {
+        int index = (manager->current_index - 1 - i + MAX_HISTORY_COMMANDS) % MAX_HISTORY_COMMANDS;
+        const command_history_t *entry = &manager->commands[index];
+        if (entry->command[0] == '\0' || entry->timestamp < cutoff_time) continue;
+
+        int written = snprintf(history + len, history_size - len, "%s\n", entry->command);
+        if (written < 0 || (size_t)written >= history_size - len) {
+            history[len] = '\0'; // Drop a command that does not fit whole
+            break;
+        }
+        len += (size_t)written;
+        found++;
+    }
+
+    return found;
+}
+
 int save_command_history(command_history_manager_t *manager) {
     if (!manager || manager->count == 0) return 0;
 
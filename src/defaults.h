@@ -9,6 +9,19 @@
 #define DEFAULT_SESSION_TIMEOUT 3600
 #define DEFAULT_DAEMON_STARTUP_ATTEMPTS 10
 #define DEFAULT_DAEMON_STARTUP_DELAY 500000
+#define DEFAULT_PREFETCH_DEBOUNCE_MS 300
+#define DEFAULT_WARMUP_INTERVAL_SECONDS 30
+#define DEFAULT_CACHE_MAX_ENTRIES 256
+#define DEFAULT_CACHE_TTL_SECONDS 300
+#define DEFAULT_CACHE_NEGATIVE_TTL_SECONDS 10
+#define DEFAULT_HEDGE_DELAY_MS 800
+#define DEFAULT_CANDIDATES 3
+#define DEFAULT_LOCAL_MODEL_MIN_CONFIDENCE 0.6
+#define DEFAULT_LOCAL_MODEL_MIN_COUNT 3
+#define DEFAULT_PROMPT_HISTORY_TOKENS 150
+#define DEFAULT_PROMPT_TERMINAL_TOKENS 600
+#define DEFAULT_PROMPT_ENVIRONMENT_TOKENS 60
+#define DEFAULT_PROMPT_GIT_TOKENS 30
 
 #define MSG_CONFIG_NOT_FOUND "No configuration file found, using defaults"
 #define MSG_DAEMON_START_FAILED "Failed to start daemon"
@@ -0,0 +1,508 @@
+#define _GNU_SOURCE
+#include "smart_cmd.h"
+#include <curl/curl.h>
+#include <pthread.h>
+
+/*
+ * HTTP Client
+ *
+ * In-process HTTP transport built on libcurl. A single share handle keeps the
+ * DNS cache and TLS session cache alive for the lifetime of the process, and
+ * pooled easy handles keep their open connections between requests, so the
+ * daemon only pays for DNS/TCP/TLS setup on the first request to each
+ * provider. The share handle is locked per kind of data, so threads may use
+ * it at the same time. Connections are not shared: libcurl's shared
+ * connection cache is not safe to use from several threads, so each one
+ * stays with the easy handle that opened it, and an easy handle is used by
+ * one thread at a time (the pool is locked).
+ *
+ * http_post_hedged() races the same request against two providers: the
+ * secondary is only sent once the primary has been quiet for the hedge delay
+ * (or has failed), the first good answer wins and the other transfer is
+ * cancelled.
+ *
+ * A request with a cancel flag is driven through curl's multi interface and
+ * the flag is checked every HTTP_CANCEL_POLL_MS, so a caller on another
+ * thread can abort a transfer whose answer is no longer wanted right away
+ * instead of at curl's once-a-second progress tick.
+ *
+ * http_prewarm() opens a connection without sending a request body, which
+ * lets the daemon pay for DNS, TCP and TLS before the first suggestion is
+ * asked for (see warmup.c).
+ */
+
+#define HTTP_MAX_RESPONSE_SIZE (1024 * 1024)
+// Every worker may hold a handle (two with a hedge); a handle that does not
+// fit back in the pool is closed together with its connections
+#define HTTP_EASY_POOL_SIZE (2 * WORKER_POOL_THREADS)
+
+static CURLSH *g_share = NULL;
+static CURL *g_easy_pool[HTTP_EASY_POOL_SIZE];
+static int g_easy_pool_count = 0;
+static pthread_mutex_t g_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t g_share_locks[CURL_LOCK_DATA_LAST];
+static int g_initialized = 0;
+
+static void share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+    (void)handle; (void)access; (void)userptr;
+    pthread_mutex_lock(&g_share_locks[data]);
+}
+
+static void share_unlock(CURL *handle, curl_lock_data data, void *userptr) {
+    (void)handle; (void)userptr;
+    pthread_mutex_unlock(&g_share_locks[data]);
+}
+
+int http_client_init(void) {
+    pthread_mutex_lock(&g_pool_lock);
+    if (g_initialized) {
+        pthread_mutex_unlock(&g_pool_lock);
+        return 0;
+    }
+
+    if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+        pthread_mutex_unlock(&g_pool_lock);
+        fprintf(stderr, "ERROR: http_client_init: curl_global_init failed\n");
+        return -1;
+    }
+
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&g_share_locks[i], NULL);
+    }
+
+    g_share = curl_share_init();
+    if (g_share) {
+        curl_share_setopt(g_share, CURLSHOPT_LOCKFUNC, share_lock);
+        curl_share_setopt(g_share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+        curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+
+    g_initialized = 1;
+    pthread_mutex_unlock(&g_pool_lock);
+    return 0;
+}
+
+void http_client_cleanup(void) {
+    pthread_mutex_lock(&g_pool_lock);
+    if (!g_initialized) {
+        pthread_mutex_unlock(&g_pool_lock);
+        return;
+    }
+
+    for (int i = 0; i < g_easy_pool_count; i++) {
+        curl_easy_cleanup(g_easy_pool[i]);
+    }
+    g_easy_pool_count = 0;
+    if (g_share) {
+        curl_share_cleanup(g_share);
+        g_share = NULL;
+    }
+    curl_global_cleanup();
+    g_initialized = 0;
+    pthread_mutex_unlock(&g_pool_lock);
+}
+
+// Take a handle for the calling thread alone until it is released. The one
+// released last comes first: it is the most likely to have a live
+// connection, e.g. the one a warm-up ping just opened.
+static CURL *acquire_easy_handle(void) {
+    CURL *easy = NULL;
+
+    pthread_mutex_lock(&g_pool_lock);
+    if (g_easy_pool_count > 0) {
+        easy = g_easy_pool[--g_easy_pool_count];
+    }
+    pthread_mutex_unlock(&g_pool_lock);
+
+    if (easy) {
+        // Reset options but keep the handle (and its caches) alive
+        curl_easy_reset(easy);
+        return easy;
+    }
+
+    return curl_easy_init();
+}
+
+static void release_easy_handle(CURL *easy) {
+    pthread_mutex_lock(&g_pool_lock);
+    if (g_easy_pool_count < HTTP_EASY_POOL_SIZE) {
+        g_easy_pool[g_easy_pool_count++] = easy;
+        easy = NULL;
+    }
+    pthread_mutex_unlock(&g_pool_lock);
+
+    if (easy) {
+        curl_easy_cleanup(easy);
+    }
+}
+
+typedef struct {
+    const http_request_t *req;
+    http_response_t *resp;
+} transfer_t;
+
+static size_t write_callback(char *data, size_t size, size_t nmemb, void *userdata) {
+    transfer_t *transfer = (transfer_t *)userdata;
+    http_response_t *resp = transfer->resp;
+    size_t len = size * nmemb;
+
+    if (transfer->req->on_data) {
+        // Streaming consumers see the bytes as they arrive and may end the transfer
+        int action = transfer->req->on_data(data, len, transfer->req->userdata);
+        if (action == 1) {
+            resp->stopped_early = 1;
+            return 0;
+        }
+        return action == 0 ? len : 0;
+    }
+
+    if (resp->len + len + 1 > HTTP_MAX_RESPONSE_SIZE) {
+        return 0; // Abort oversized responses
+    }
+
+    if (resp->len + len + 1 > resp->cap) {
+        size_t new_cap = resp->cap ? resp->cap * 2 : 4096;
+        while (new_cap < resp->len + len + 1) new_cap *= 2;
+        char *new_body = realloc(resp->body, new_cap);
+        if (!new_body) return 0;
+        resp->body = new_body;
+        resp->cap = new_cap;
+    }
+
+    memcpy(resp->body + resp->len, data, len);
+    resp->len += len;
+    resp->body[resp->len] = '\0';
+    return len;
+}
+
+static double usec_to_ms(curl_off_t usec) {
+    return (double)usec / 1000.0;
+}
+
+static void collect_timings(CURL *easy, http_timings_t *timings) {
+    curl_off_t dns = 0, connect = 0, tls = 0, ttfb = 0, total = 0;
+
+    curl_easy_getinfo(easy, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+    curl_easy_getinfo(easy, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(easy, CURLINFO_APPCONNECT_TIME_T, &tls);
+    curl_easy_getinfo(easy, CURLINFO_STARTTRANSFER_TIME_T, &ttfb);
+    curl_easy_getinfo(easy, CURLINFO_TOTAL_TIME_T, &total);
+
+    // curl reports cumulative times from the start of the transfer;
+    // convert DNS/connect/TLS into per-phase durations
+    timings->dns_ms = usec_to_ms(dns);
+    timings->connect_ms = connect > dns ? usec_to_ms(connect - dns) : 0.0;
+    timings->tls_ms = tls > connect ? usec_to_ms(tls - connect) : 0.0;
+    timings->ttfb_ms = usec_to_ms(ttfb);
+    timings->total_ms = usec_to_ms(total);
+
+    long connects = 0;
+    curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &connects);
+    timings->reused_connection = (connects == 0);
+}
+
+// Transport options shared by requests and warm-up pings, so both draw on
+// (and add to) the same pooled connections
+static void setup_connection(CURL *easy, const char *url, long timeout_ms) {
+    curl_easy_setopt(easy, CURLOPT_URL, url);
+    curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, timeout_ms);
+    curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT_MS, (long)HTTP_CONNECT_TIMEOUT_MS);
+    curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(easy, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(easy, CURLOPT_TCP_NODELAY, 1L);
+    curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(easy, CURLOPT_DNS_CACHE_TIMEOUT, (long)HTTP_DNS_CACHE_TIMEOUT);
+    // A connection does not outlive the DNS entry it was made from, so the
+    // first request after that re-resolves the host
+    curl_easy_setopt(easy, CURLOPT_MAXLIFETIME_CONN, (long)HTTP_DNS_CACHE_TIMEOUT);
+    if (g_share) {
+        curl_easy_setopt(easy, CURLOPT_SHARE, g_share);
+    }
+}
+
+static struct curl_slist *setup_easy_handle(CURL *easy, const http_request_t *req, transfer_t *transfer) {
+    struct curl_slist *headers = NULL;
+    headers = curl_slist_append(headers, "Content-Type: application/json");
+    // Avoid the extra round trip of "Expect: 100-continue" on larger bodies
+    headers = curl_slist_append(headers, "Expect:");
+    for (int i = 0; i < req->header_count; i++) {
+        headers = curl_slist_append(headers, req->headers[i]);
+    }
+
+    long timeout_ms = req->timeout_ms > 0 ? req->timeout_ms : HTTP_DEFAULT_TIMEOUT_MS;
+
+    setup_connection(easy, req->url, timeout_ms);
+    curl_easy_setopt(easy, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(easy, CURLOPT_POSTFIELDS, req->body);
+    curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)strlen(req->body));
+    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, transfer);
+
+    return headers;
+}
+
+// Aborting from the write callback is how a streaming consumer finishes early
+static CURLcode transfer_result(CURLcode res, const http_response_t *resp) {
+    if (res == CURLE_WRITE_ERROR && resp->stopped_early) {
+        return CURLE_OK;
+    }
+    return res;
+}
+
+static int finish_response(http_response_t *resp) {
+    if (!resp->body) {
+        // Keep callers from having to special-case empty bodies
+        resp->body = strdup("");
+        if (!resp->body) return -1;
+    }
+    return 0;
+}
+
+static int transfer_cancelled(const transfer_t *transfer) {
+    return transfer->req->cancel && *transfer->req->cancel;
+}
+
+// curl_easy_perform() that gives up as soon as the cancel flag is set
+static CURLcode perform_cancellable(CURL *easy, transfer_t *transfer) {
+    CURLM *multi = curl_multi_init();
+    if (!multi) return curl_easy_perform(easy);
+    if (curl_multi_add_handle(multi, easy) != CURLM_OK) {
+        curl_multi_cleanup(multi);
+        return curl_easy_perform(easy);
+    }
+
+    CURLcode res = CURLE_OK;
+    int done = 0;
+    while (!done) {
+        if (transfer_cancelled(transfer)) {
+            transfer->resp->cancelled = 1;
+            res = CURLE_ABORTED_BY_CALLBACK;
+            break;
+        }
+
+        int running = 0;
+        curl_multi_perform(multi, &running);
+
+        CURLMsg *msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            res = msg->data.result;
+            done = 1;
+        }
+        if (!done) {
+            curl_multi_poll(multi, NULL, 0, HTTP_CANCEL_POLL_MS, NULL);
+        }
+    }
+
+    // Removing an unfinished handle aborts its transfer
+    curl_multi_remove_handle(multi, easy);
+    curl_multi_cleanup(multi);
+    return res;
+}
+
+int http_post(const http_request_t *req, http_response_t *resp) {
+    if (!req || !req->url || !req->body || !resp) return -1;
+
+    memset(resp, 0, sizeof(http_response_t));
+
+    if (http_client_init() != 0) return -1;
+
+    CURL *easy = acquire_easy_handle();
+    if (!easy) {
+        fprintf(stderr, "ERROR: http_post: curl_easy_init failed\n");
+        return -1;
+    }
+
+    transfer_t transfer = { req, resp };
+    struct curl_slist *headers = setup_easy_handle(easy, req, &transfer);
+
+    CURLcode res = req->cancel ? perform_cancellable(easy, &transfer) : curl_easy_perform(easy);
+    curl_slist_free_all(headers);
+
+    collect_timings(easy, &resp->timings);
+    curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &resp->status);
+    release_easy_handle(easy);
+
+    res = transfer_result(res, resp);
+    if (res != CURLE_OK && resp->cancelled) {
+        return -1; // Not a transport failure: the caller asked for it
+    }
+    if (res != CURLE_OK) {
+        resp->failed = 1;
+        resp->timed_out = (res == CURLE_OPERATION_TIMEDOUT);
+        fprintf(stderr, "ERROR: http_post: %s\n", curl_easy_strerror(res));
+        return -1;
+    }
+
+    return finish_response(resp);
+}
+
+// HEAD request that leaves a connection to the URL's host in the pooled
+// handle the next request takes first. Any
+// HTTP status means the connection works (the ping carries no credentials,
+// so most providers answer 401, 404 or 405); -1 is a transport failure.
+int http_prewarm(const char *url, http_response_t *resp) {
+    if (!url || !resp) return -1;
+
+    memset(resp, 0, sizeof(http_response_t));
+
+    if (http_client_init() != 0) return -1;
+
+    CURL *easy = acquire_easy_handle();
+    if (!easy) return -1;
+
+    setup_connection(easy, url, HTTP_PREWARM_TIMEOUT_MS);
+    curl_easy_setopt(easy, CURLOPT_NOBODY, 1L);
+
+    CURLcode res = curl_easy_perform(easy);
+
+    collect_timings(easy, &resp->timings);
+    curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &resp->status);
+    release_easy_handle(easy);
+
+    if (res != CURLE_OK) {
+        resp->failed = 1;
+        resp->timed_out = (res == CURLE_OPERATION_TIMEDOUT);
+        return -1;
+    }
+    return finish_response(resp);
+}
+
+typedef struct {
+    CURL *easy;
+    struct curl_slist *headers;
+    transfer_t transfer;
+    int started;
+    int done;
+} hedge_leg_t;
+
+// A leg that fails to start is marked done right away
+static int start_hedge_leg(CURLM *multi, hedge_leg_t *leg) {
+    leg->started = 1;
+    leg->easy = acquire_easy_handle();
+    if (!leg->easy) {
+        leg->done = 1;
+        leg->transfer.resp->failed = 1;
+        return -1;
+    }
+
+    leg->headers = setup_easy_handle(leg->easy, leg->transfer.req, &leg->transfer);
+    if (curl_multi_add_handle(multi, leg->easy) != CURLM_OK) {
+        curl_slist_free_all(leg->headers);
+        release_easy_handle(leg->easy);
+        leg->easy = NULL;
+        leg->done = 1;
+        leg->transfer.resp->failed = 1;
+        return -1;
+    }
+
+    return 0;
+}
+
+int http_post_hedged(const http_request_t *primary, const http_request_t *secondary, int delay_ms,
+                     http_response_t *primary_resp, http_response_t *secondary_resp,
+                     int *winner, int *secondary_sent) {
+    if (!primary || !secondary || !primary_resp || !secondary_resp || !winner || !secondary_sent) return -1;
+
+    memset(primary_resp, 0, sizeof(http_response_t));
+    memset(secondary_resp, 0, sizeof(http_response_t));
+    *winner = -1;
+    *secondary_sent = 0;
+
+    if (http_client_init() != 0) return -1;
+
+    CURLM *multi = curl_multi_init();
+    if (!multi) {
+        fprintf(stderr, "ERROR: http_post_hedged: curl_multi_init failed\n");
+        return -1;
+    }
+
+    hedge_leg_t legs[2] = {
+        { .transfer = { primary, primary_resp } },
+        { .transfer = { secondary, secondary_resp } },
+    };
+
+    uint64_t hedge_at = monotonic_ms() + (uint64_t)(delay_ms > 0 ? delay_ms : 0);
+    start_hedge_leg(multi, &legs[0]);
+
+    while (*winner == -1) {
+        if (transfer_cancelled(&legs[0].transfer)) {
+            for (int i = 0; i < 2; i++) {
+                if (legs[i].started && !legs[i].done) legs[i].transfer.resp->cancelled = 1;
+            }
+            break;
+        }
+
+        if (!legs[1].started && monotonic_ms() >= hedge_at) {
+            start_hedge_leg(multi, &legs[1]);
+        }
+
+        int running = 0;
+        curl_multi_perform(multi, &running);
+
+        CURLMsg *msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi, &queued)) && *winner == -1) {
+            if (msg->msg != CURLMSG_DONE) continue;
+
+            int index = (msg->easy_handle == legs[0].easy) ? 0 : 1;
+            hedge_leg_t *leg = &legs[index];
+            http_response_t *resp = leg->transfer.resp;
+            leg->done = 1;
+
+            curl_easy_getinfo(leg->easy, CURLINFO_RESPONSE_CODE, &resp->status);
+            CURLcode res = transfer_result(msg->data.result, resp);
+            if (res == CURLE_OK && resp->status < 400) {
+                *winner = index;
+            } else {
+                resp->failed = (res != CURLE_OK);
+                resp->timed_out = (res == CURLE_OPERATION_TIMEDOUT);
+                fprintf(stderr, "ERROR: http_post_hedged: %s request failed: %s (status %ld)\n",
+                        index == 0 ? "primary" : "secondary",
+                        curl_easy_strerror(msg->data.result), resp->status);
+            }
+        }
+
+        if (*winner != -1) break;
+
+        // A failed primary is not worth waiting out the hedge delay for
+        int pending = !legs[0].done || (legs[1].started && !legs[1].done);
+        if (!pending) {
+            if (legs[1].started) break; // Both legs failed
+            start_hedge_leg(multi, &legs[1]);
+            continue;
+        }
+
+        int timeout_ms = 1000;
+        if (!legs[1].started) {
+            uint64_t now = monotonic_ms();
+            timeout_ms = hedge_at > now ? (int)(hedge_at - now) : 0;
+            if (timeout_ms > 1000) timeout_ms = 1000;
+        }
+        if (primary->cancel && timeout_ms > HTTP_CANCEL_POLL_MS) timeout_ms = HTTP_CANCEL_POLL_MS;
+        curl_multi_poll(multi, NULL, 0, timeout_ms, NULL);
+    }
+
+    // Removing the losing handle cancels its transfer
+    for (int i = 0; i < 2; i++) {
+        if (!legs[i].easy) continue;
+        collect_timings(legs[i].easy, &legs[i].transfer.resp->timings);
+        curl_multi_remove_handle(multi, legs[i].easy);
+        curl_slist_free_all(legs[i].headers);
+        release_easy_handle(legs[i].easy);
+    }
+    curl_multi_cleanup(multi);
+
+    *secondary_sent = legs[1].started;
+    if (*winner == -1) return -1;
+    return finish_response(legs[*winner].transfer.resp);
+}
+
+void http_response_free(http_response_t *resp) {
+    if (!resp) return;
+    SAFE_FREE(resp->body);
+    resp->len = 0;
+    resp->cap = 0;
+}
@@ -6,22 +6,13 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <time.h>
+#include <poll.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
-#define MAX_IPC_MESSAGE_SIZE 4096
 #define IPC_TIMEOUT_MS 5000
 
-// Message types
-typedef enum {
-    MSG_TYPE_PING = 1,
-    MSG_TYPE_SUGGESTION = 2,
-    MSG_TYPE_CONTEXT = 3,
-    MSG_TYPE_COMMAND = 4,
-    MSG_TYPE_RESPONSE = 5,
-    MSG_TYPE_ERROR = 6
-} ipc_message_type_t;
-
-// IPC message header
+// Version 1 header: a 52-byte header before every message
 typedef struct {
     uint32_t magic;      // Magic number for validation
     uint32_t version;    // Protocol version
@@ -31,31 +22,54 @@ typedef struct {
     char session_id[32]; // Session identifier
 } ipc_header_t;
 
+// Version 2 header: the same first four fields, then the id of the request,
+// which its response carries too, so responses can come back in any order
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t type;
+    uint32_t length;
+    uint32_t request_id;
+    uint32_t flags;      // Reserved, 0
+} ipc_header_v2_t;
+
 #define IPC_MAGIC 0x534D5443  // "SMTC"
-#define IPC_VERSION 1
+#define IPC_PREFIX_SIZE 16    // magic, version, type and length: the same in every version
+
+// Typed requests and the text commands they stand for; version 1 has only
+// the text, and a MSG_TYPE_COMMAND body is the text itself. A request
+// without a body of its own may still carry the client's context, which
+// goes on a second line after the command.
+static const struct {
+    uint32_t type;
+    const char *command;
+    int has_body;
+} g_request_types[] = {
+    { MSG_TYPE_PING, "ping", 0 },
+    { MSG_TYPE_SUGGESTION, "suggestion:", 1 },
+    { MSG_TYPE_CONTEXT, "context", 0 },
+    { MSG_TYPE_PREFETCH, "prefetch:", 1 },
+    { MSG_TYPE_CANCEL, "cancel", 0 },
+};
+
+// Transport check only: a body is text of the length its header gives, so
+// it may not contain NUL bytes. What the text says (a command line with
+// "..", "~" or "$(", terminal output with escape sequences) is for the
+// receiver to handle.
+static int validate_payload(const char *message, size_t len) {
+    return memchr(message, '\0', len) ? -1 : 0;
+}
 
 int validate_ipc_message(const char *message) {
     if (!message) return -1;
 
-    // Basic validation: check for null bytes and reasonable length
+    // Basic validation: reasonable length
     size_t len = strlen(message);
-    if (len == 0 || len > MAX_IPC_MESSAGE_SIZE - sizeof(ipc_header_t)) {
+    if (len == 0 || len > ipc_max_payload(IPC_VERSION_MIN)) {
         return -1;
     }
 
-    // Check for potential injection attempts
-    for (size_t i = 0; i < len; i++) {
-        if ((unsigned char)message[i] < 32 && message[i] != '\t' && message[i] != '\n') {
-            return -1; // Control characters not allowed
-        }
-    }
-
-    // Check for suspicious patterns
-    if (strstr(message, "..") || strstr(message, "~") || strstr(message, "$(")) {
-        return -1; // Potential path traversal or command injection
-    }
-
-    return 0;
+    return validate_payload(message, len);
 }
 
 int create_ipc_socket(const char *socket_path) {
@@ -92,7 +106,8 @@ int create_ipc_socket(const char *socket_path) {
     // Set strict permissions on socket file
     chmod(socket_path, 0600);
 
-    if (listen(server_fd, 5) == -1) {
+    // Many shells may connect at once (shared hosts); the daemon accepts them all per wake-up
+    if (listen(server_fd, SOMAXCONN) == -1) {
         perror("listen");
         close(server_fd);
         unlink(socket_path);
@@ -140,99 +155,306 @@ int accept_ipc_connection(int server_fd) {
     return client_fd;
 }
 
-int send_ipc_message(int fd, const char *message) {
-    if (fd == -1 || !message) return -1;
+size_t ipc_header_size(uint32_t version) {
+    return version >= 2 ? sizeof(ipc_header_v2_t) : sizeof(ipc_header_t);
+}
+
+// Longest body a frame of this version may carry
+size_t ipc_max_payload(uint32_t version) {
+    return version >= 2 ? IPC_MAX_PAYLOAD : MAX_IPC_MESSAGE_SIZE - sizeof(ipc_header_t);
+}
 
-    int err;
-    if ((err = validate_ipc_message(message)) != 0) {
-        fprintf(stderr, "ERROR: send_ipc_message: Invalid IPC message rejected\n");
+// Header for frame into dst (ipc_header_size() bytes); its size, or -1
+int ipc_encode_header(const ipc_frame_t *frame, char *dst) {
+    if (!frame || !dst) return -1;
+    if (frame->version < IPC_VERSION_MIN || frame->version > IPC_VERSION ||
+        frame->length > ipc_max_payload(frame->version)) {
         return -1;
     }
 
-    size_t msg_len = strlen(message);
-    if (msg_len > MAX_IPC_MESSAGE_SIZE - sizeof(ipc_header_t)) {
-        fprintf(stderr, "ERROR: send_ipc_message: Message too long\n");
-        return -1;
+    if (frame->version == 1) {
+        ipc_header_t header;
+        header.magic = IPC_MAGIC;
+        header.version = 1;
+        header.type = frame->type;
+        header.length = frame->length;
+        header.timestamp = time(NULL);
+        memset(header.session_id, 0, sizeof(header.session_id));
+        memcpy(dst, &header, sizeof(header));
+        return (int)sizeof(header);
     }
 
-    // Prepare header
-    ipc_header_t header;
-    header.magic = IPC_MAGIC;
-    header.version = IPC_VERSION;
-    header.type = MSG_TYPE_SUGGESTION;
-    header.length = msg_len;
-    header.timestamp = time(NULL);
-    memset(header.session_id, 0, sizeof(header.session_id));
+    ipc_header_v2_t header = {
+        .magic = IPC_MAGIC,
+        .version = frame->version,
+        .type = frame->type,
+        .length = frame->length,
+        .request_id = frame->request_id,
+        .flags = 0,
+    };
+    memcpy(dst, &header, sizeof(header));
+    return (int)sizeof(header);
+}
 
-    // Send header
-    ssize_t sent = send(fd, &header, sizeof(header), MSG_NOSIGNAL);
-    if (sent != sizeof(header)) {
-        perror("send header");
+// Header of the frame at the start of data into frame (body not set): the
+// header size once it is complete, 0 while more bytes are needed, -1 for a
+// malformed header or a version this side does not speak
+int ipc_parse_header(const char *data, size_t len, ipc_frame_t *frame) {
+    if (!data || !frame) return -1;
+    if (len < IPC_PREFIX_SIZE) return 0;
+
+    uint32_t prefix[4];
+    memcpy(prefix, data, sizeof(prefix));
+    uint32_t version = prefix[1];
+    if (prefix[0] != IPC_MAGIC || version < IPC_VERSION_MIN || version > IPC_VERSION) {
+        fprintf(stderr, "ERROR: ipc_parse_header: Invalid IPC header\n");
         return -1;
     }
-
-    // Send message
-    sent = send(fd, message, msg_len, MSG_NOSIGNAL);
-    if (sent != (ssize_t)msg_len) {
-        perror("send message");
+    if (prefix[3] > ipc_max_payload(version)) {
+        fprintf(stderr, "ERROR: ipc_parse_header: Message too long: %u bytes\n", prefix[3]);
         return -1;
     }
 
-    return 0;
+    size_t header_size = ipc_header_size(version);
+    if (len < header_size) return 0;
+
+    memset(frame, 0, sizeof(ipc_frame_t));
+    frame->version = version;
+    frame->type = prefix[2];
+    frame->length = prefix[3];
+    if (version >= 2) {
+        ipc_header_v2_t header;
+        memcpy(&header, data, sizeof(header));
+        frame->request_id = header.request_id;
+    }
+    return (int)header_size;
 }
 
-int receive_ipc_message(int fd, char *buffer, size_t buffer_size) {
-    if (fd == -1 || !buffer || buffer_size < sizeof(ipc_header_t) + 1) {
-        return -1;
+// A body must be text; version 1 bodies also may not be empty
+int ipc_validate_body(const ipc_frame_t *frame) {
+    if (!frame || (frame->length > 0 && !frame->body)) return -1;
+    if (frame->length == 0) return frame->version >= 2 ? 0 : -1;
+    if (strlen(frame->body) != frame->length) return -1;
+    return validate_payload(frame->body, frame->length);
+}
+
+// Text command for a request; malloc'd, or NULL for an unknown type
+char *ipc_request_text(uint32_t type, const char *body) {
+    if (!body) body = "";
+    if (type == MSG_TYPE_COMMAND) return strdup(body);
+
+    for (size_t i = 0; i < sizeof(g_request_types) / sizeof(g_request_types[0]); i++) {
+        if (g_request_types[i].type != type) continue;
+
+        const char *command = g_request_types[i].command;
+        if (!g_request_types[i].has_body && !body[0]) return strdup(command);
+
+        const char *separator = g_request_types[i].has_body ? "" : "\n";
+        size_t size = strlen(command) + strlen(separator) + strlen(body) + 1;
+        char *text = malloc(size);
+        if (text) snprintf(text, size, "%s%s%s", command, separator, body);
+        return text;
     }
+    return NULL;
+}
 
-    // Receive header
-    ipc_header_t header;
-    ssize_t received = recv(fd, &header, sizeof(header), 0);
-    if (received != sizeof(header)) {
-        if (received == 0) {
-            return 0;
+// Write all of an iovec array; partial writes and interruptions are resumed.
+// Descriptors (SCM_RIGHTS) go with the first byte.
+static int send_all(int fd, struct iovec *iov, int count, const int *fds, int fd_count) {
+    union {
+        char buffer[CMSG_SPACE(sizeof(int) * IPC_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+
+    while (count > 0) {
+        struct msghdr msg = { .msg_iov = iov, .msg_iovlen = (size_t)count };
+        if (fd_count > 0) {
+            memset(&control, 0, sizeof(control));
+            msg.msg_control = control.buffer;
+            msg.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+            memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
         }
-        perror("recv header");
+
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        fd_count = 0;
+
+        while (count > 0 && (size_t)sent >= iov->iov_len) {
+            sent -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + sent;
+            iov->iov_len -= (size_t)sent;
+        }
+    }
+    return 0;
+}
+
+// Read exactly len bytes: 1 when done, 0 on end of stream before the first
+// byte, -1 on error or end of stream part way
+static int recv_all(int fd, char *data, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t received = recv(fd, data + done, len - done, 0);
+        if (received > 0) {
+            done += (size_t)received;
+        } else if (received == 0) {
+            return done == 0 ? 0 : -1;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+int ipc_send_frame(int fd, const ipc_frame_t *frame) {
+    return ipc_send_frame_fds(fd, frame, NULL, 0);
+}
+
+// Send a frame with descriptors attached (at most IPC_MAX_FDS)
+int ipc_send_frame_fds(int fd, const ipc_frame_t *frame, const int *fds, int fd_count) {
+    if (fd == -1 || !frame || fd_count < 0 || fd_count > IPC_MAX_FDS || (fd_count > 0 && !fds)) return -1;
+
+    if (ipc_validate_body(frame) != 0) {
+        fprintf(stderr, "ERROR: ipc_send_frame: Invalid IPC message rejected\n");
         return -1;
     }
 
-    // Validate header
-    if (header.magic != IPC_MAGIC || header.version != IPC_VERSION) {
-        fprintf(stderr, "ERROR: receive_ipc_message: Invalid IPC header\n");
+    char header[sizeof(ipc_header_t)];
+    int header_size = ipc_encode_header(frame, header);
+    if (header_size == -1) {
+        fprintf(stderr, "ERROR: ipc_send_frame: Message too long\n");
         return -1;
     }
 
-    if (header.length > MAX_IPC_MESSAGE_SIZE - sizeof(ipc_header_t)) {
-        fprintf(stderr, "ERROR: receive_ipc_message: Message too long: %u bytes\n", header.length);
+    // Header and body in one call
+    struct iovec iov[2] = {
+        { .iov_base = header, .iov_len = (size_t)header_size },
+        { .iov_base = frame->body, .iov_len = frame->length },
+    };
+    if (send_all(fd, iov, frame->length > 0 ? 2 : 1, fds, fd_count) == -1) {
+        perror("send message");
         return -1;
     }
+    return 0;
+}
 
-    if (header.length > buffer_size - 1) {
-        fprintf(stderr, "ERROR: receive_ipc_message: Buffer too small for message\n");
+// Next frame from fd, whole; its body is malloc'd and NUL-terminated (free
+// with ipc_frame_free()). 1 for a frame, 0 at end of stream, -1 on error.
+int ipc_receive_frame(int fd, ipc_frame_t *frame) {
+    if (fd == -1 || !frame) return -1;
+    memset(frame, 0, sizeof(ipc_frame_t));
+
+    char header[sizeof(ipc_header_t)];
+    int result = recv_all(fd, header, IPC_PREFIX_SIZE);
+    if (result <= 0) {
+        if (result == -1) perror("recv header");
+        return result;
+    }
+
+    uint32_t version;
+    memcpy(&version, header + sizeof(uint32_t), sizeof(version));
+    size_t header_size = version >= IPC_VERSION_MIN && version <= IPC_VERSION ? ipc_header_size(version) : IPC_PREFIX_SIZE;
+    if (header_size > IPC_PREFIX_SIZE &&
+        recv_all(fd, header + IPC_PREFIX_SIZE, header_size - IPC_PREFIX_SIZE) != 1) {
+        perror("recv header");
         return -1;
     }
+    if (ipc_parse_header(header, header_size, frame) <= 0) return -1;
 
-    // Receive message body
-    received = recv(fd, buffer, header.length, 0);
-    if (received != (ssize_t)header.length) {
-        if (received == 0) {
-            return 0;
-        }
+    frame->body = malloc(frame->length + 1);
+    if (!frame->body) return -1;
+    if (frame->length > 0 && recv_all(fd, frame->body, frame->length) != 1) {
         perror("recv message");
+        ipc_frame_free(frame);
+        return -1;
+    }
+    frame->body[frame->length] = '\0';
+
+    if (ipc_validate_body(frame) != 0) {
+        fprintf(stderr, "ERROR: ipc_receive_frame: Received invalid IPC message\n");
+        ipc_frame_free(frame);
+        return -1;
+    }
+    return 1;
+}
+
+void ipc_frame_free(ipc_frame_t *frame) {
+    if (!frame) return;
+    free(frame->body);
+    frame->body = NULL;
+}
+
+// Offer this side's protocol version on a new connection; the version both
+// sides speak, or -1 when the peer does not answer the offer within
+// timeout_ms. The offer goes in a version 2 frame, which every daemon that
+// negotiates can read. A daemon that only speaks version 1 drops the
+// connection or waits for the rest of a version 1 header, so it must then be
+// reopened.
+int ipc_negotiate(int fd, int timeout_ms) {
+    char offer[16];
+    snprintf(offer, sizeof(offer), "%d", IPC_VERSION);
+
+    ipc_frame_t hello = {
+        .version = 2,
+        .type = MSG_TYPE_HELLO,
+        .length = (uint32_t)strlen(offer),
+        .body = offer,
+    };
+    if (ipc_send_frame(fd, &hello) == -1) return -1;
+
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    if (poll(&pfd, 1, timeout_ms) != 1) return -1;
+
+    ipc_frame_t reply;
+    if (ipc_receive_frame(fd, &reply) != 1) return -1;
+    int version = reply.type == MSG_TYPE_HELLO ? atoi(reply.body) : -1;
+    ipc_frame_free(&reply);
+
+    return version >= IPC_VERSION_MIN && version <= IPC_VERSION ? version : -1;
+}
+
+int send_ipc_message(int fd, const char *message) {
+    if (fd == -1 || !message) return -1;
+
+    // Version 1 with a text command: understood by every daemon
+    ipc_frame_t frame = {
+        .version = IPC_VERSION_MIN,
+        .type = MSG_TYPE_COMMAND,
+        .length = (uint32_t)strlen(message),
+        .body = (char *)message,
+    };
+    return ipc_send_frame(fd, &frame);
+}
+
+int receive_ipc_message(int fd, char *buffer, size_t buffer_size) {
+    if (fd == -1 || !buffer || buffer_size == 0) {
         return -1;
     }
 
-    buffer[received] = '\0';
+    ipc_frame_t frame;
+    int result = ipc_receive_frame(fd, &frame);
+    if (result <= 0) return result;
 
-    // Validate received message
-    int err;
-    if ((err = validate_ipc_message(buffer)) != 0) {
-        fprintf(stderr, "ERROR: receive_ipc_message: Received invalid IPC message\n");
+    if (frame.length > buffer_size - 1) {
+        fprintf(stderr, "ERROR: receive_ipc_message: Buffer too small for message\n");
+        ipc_frame_free(&frame);
         return -1;
     }
 
-    return received;
+    memcpy(buffer, frame.body, frame.length + 1);
+    int length = (int)frame.length;
+    ipc_frame_free(&frame);
+    return length;
 }
 
 void cleanup_ipc_socket(const char *socket_path) {
@@ -242,10 +464,14 @@ void cleanup_ipc_socket(const char *socket_path) {
 }
 
 // Client-side functions for connecting to daemon
-int connect_to_daemon(const char *socket_path) {
+
+// Connect, giving up after connect_timeout_ms: a daemon that is alive
+// accepts at once, so a short limit tells a hung one from a live one.
+// Sends and receives then time out after io_timeout_ms.
+int connect_to_daemon_timeout(const char *socket_path, int connect_timeout_ms, int io_timeout_ms) {
     if (!socket_path) return -1;
 
-    int client_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    int client_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (client_fd == -1) {
         perror("socket");
         return -1;
@@ -256,16 +482,27 @@ int connect_to_daemon(const char *socket_path) {
     addr.sun_family = AF_UNIX;
     strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
 
-    if (connect(client_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    int waited_ms = 0;
+    while (connect(client_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN && waited_ms < connect_timeout_ms) {
+            // Backlog full: give the daemon a moment to accept
+            poll(NULL, 0, 1);
+            waited_ms++;
+            continue;
+        }
         perror("connect");
         close(client_fd);
         return -1;
     }
 
-    // Set timeout for operations
+    // Blocking from here on, with a timeout for operations
+    int flags = fcntl(client_fd, F_GETFL, 0);
+    if (flags != -1) fcntl(client_fd, F_SETFL, flags & ~O_NONBLOCK);
+
     struct timeval timeout;
-    timeout.tv_sec = IPC_TIMEOUT_MS / 1000;
-    timeout.tv_usec = (IPC_TIMEOUT_MS % 1000) * 1000;
+    timeout.tv_sec = io_timeout_ms / 1000;
+    timeout.tv_usec = (io_timeout_ms % 1000) * 1000;
 
     setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
     setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
@@ -273,6 +510,10 @@ int connect_to_daemon(const char *socket_path) {
     return client_fd;
 }
 
+int connect_to_daemon(const char *socket_path) {
+    return connect_to_daemon_timeout(socket_path, IPC_TIMEOUT_MS, IPC_TIMEOUT_MS);
+}
+
 int send_daemon_request(const char *socket_path, const char *request, char *response, size_t response_size) {
     if (!socket_path || !request || !response) return -1;
 
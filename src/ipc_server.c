@@ -0,0 +1,585 @@
+#define _GNU_SOURCE
+#include "smart_cmd.h"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+/*
+ * IPC Server
+ *
+ * Daemon side of the Unix socket: every client connection is a small state
+ * machine driven by the daemon's epoll loop, so any number of shells can be
+ * attached and none of them waits for another one's request.
+ *
+ * A connection reads whatever its socket has into an input buffer of
+ * IPC_CLIENT_BUFFER bytes, which is also its request queue: once it is full
+ * the socket is no longer read until requests have been answered. A frame
+ * that does not fit (version 2 bodies may be up to IPC_MAX_PAYLOAD) grows
+ * the buffer until it has arrived. Responses are queued in an output buffer
+ * and written without blocking; a partial write waits for EPOLLOUT.
+ * Connections stay open after a response, so a client may send its next
+ * request on the same socket, and close when the client closes its end.
+ *
+ * Version 1 requests are answered one at a time and in order, since their
+ * responses carry nothing to match them by. Version 2 requests carry an id
+ * that their response echoes, so up to IPC_MAX_PIPELINED of them per
+ * connection are handled at once and each is answered when it is done. A
+ * MSG_TYPE_HELLO frame is answered here with the version both sides speak.
+ * Descriptors a client passes (SCM_RIGHTS) are kept until the
+ * MSG_TYPE_CHANNEL frame they came with is handled, which hands them to the
+ * channel handler.
+ *
+ * Requests are handed to a callback as text commands. It answers right away
+ * through ipc_server_respond(), says the answer will come later
+ * (IPC_REQUEST_ASYNC), or that the daemon cannot take it now
+ * (IPC_REQUEST_BUSY). A busy connection keeps its request and joins a FIFO
+ * of waiting connections, which ipc_server_resume() serves in turn once
+ * capacity frees up, so every shell gets its turn instead of the one that
+ * retried most often.
+ *
+ * Connections live in a table of IPC_MAX_CLIENTS slots, whatever their
+ * descriptor numbers, and epoll reports a connection by its slot
+ * (IPC_EVENT_CLIENT | slot in epoll_data.u64). A client id carries a
+ * generation too, so a late answer for a closed connection cannot reach a
+ * new one that got the same slot.
+ */
+
+typedef struct {
+    int active;
+    int fd;
+    int slot;             // Index in the table
+    uint32_t generation;
+    char *in;             // Received, not yet handled
+    size_t in_len;
+    size_t in_cap;        // IPC_CLIENT_BUFFER, more while a large frame arrives
+    char *out;            // Responses not yet written
+    size_t out_len;
+    size_t out_sent;
+    size_t out_cap;
+    int in_flight;        // Requests waiting for their response
+    int busy;             // In the waiting FIFO
+    int peer_closed;
+    int watched;          // Registered with epoll
+    int broken;           // A response could not be queued; close when possible
+    int fds[IPC_MAX_FDS]; // Received, for the next MSG_TYPE_CHANNEL frame
+    int fd_count;
+    uint32_t events;      // Registered with epoll
+    uint64_t partial_since_ms; // When a request started arriving, 0 if none
+} ipc_client_t;
+
+typedef struct {
+    int epoll_fd;
+    int listen_fd;
+    ipc_request_fn on_request;
+    ipc_channel_fn on_channel;
+    void *userdata;
+    ipc_client_t clients[IPC_MAX_CLIENTS];  // Indexed by slot
+    int busy_slots[IPC_MAX_CLIENTS];        // Waiting FIFO (ring)
+    int busy_head;
+    int busy_count;
+    int dispatching;                        // Inside the callback
+    ipc_server_stats_t stats;
+} ipc_server_t;
+
+static ipc_server_t g_server = {
+    .epoll_fd = -1,
+    .listen_fd = -1,
+};
+
+static uint64_t client_id(const ipc_client_t *client) {
+    return ((uint64_t)client->generation << 32) | (uint32_t)client->slot;
+}
+
+static ipc_client_t *client_by_id(uint64_t id) {
+    uint32_t slot = (uint32_t)id;
+    if (slot >= IPC_MAX_CLIENTS) return NULL;
+
+    ipc_client_t *client = &g_server.clients[slot];
+    if (!client->active || client->generation != (uint32_t)(id >> 32)) return NULL;
+    return client;
+}
+
+static void client_watch(ipc_client_t *client) {
+    // Read while there is room to queue; write while a response is pending
+    uint32_t events = 0;
+    if (!client->peer_closed && client->in_len < client->in_cap) events |= EPOLLIN;
+    if (client->out_sent < client->out_len) events |= EPOLLOUT;
+
+    // A hangup is reported whatever the mask asks for, and keeps being
+    // reported, so a closed peer waiting for its responses is not watched
+    if (client->peer_closed && events == 0) {
+        if (client->watched) epoll_ctl(g_server.epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+        client->watched = 0;
+        return;
+    }
+    if (client->watched && events == client->events) return;
+
+    struct epoll_event event = { .events = events, .data.u64 = IPC_EVENT_CLIENT | (uint64_t)client->slot };
+    epoll_ctl(g_server.epoll_fd, client->watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, client->fd, &event);
+    client->watched = 1;
+    client->events = events;
+}
+
+static void client_close_fds(ipc_client_t *client) {
+    for (int i = 0; i < client->fd_count; i++) close(client->fds[i]);
+    client->fd_count = 0;
+}
+
+static void client_close(ipc_client_t *client) {
+    // Closing the only reference to the socket also takes it out of epoll
+    close(client->fd);
+    client_close_fds(client);
+    free(client->in);
+    free(client->out);
+    client->in = NULL;
+    client->out = NULL;
+    client->active = 0;
+    g_server.stats.clients--;
+    // A busy entry for it is skipped when the FIFO reaches it
+}
+
+// Give a buffer holding len bytes the capacity asked for; -1 without memory
+static int buffer_resize(char **buffer, size_t *cap, size_t capacity) {
+    if (capacity == *cap) return 0;
+
+    char *resized = realloc(*buffer, capacity);
+    if (!resized) return -1;
+    *buffer = resized;
+    *cap = capacity;
+    return 0;
+}
+
+// Write as much of the pending output as the socket takes; -1 on error
+static int client_flush(ipc_client_t *client) {
+    while (client->out_sent < client->out_len) {
+        ssize_t sent = send(client->fd, client->out + client->out_sent,
+                            client->out_len - client->out_sent, MSG_NOSIGNAL);
+        if (sent > 0) {
+            client->out_sent += (size_t)sent;
+        } else if (sent == -1 && errno == EINTR) {
+            continue;
+        } else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        } else {
+            return -1;
+        }
+    }
+    client->out_len = 0;
+    client->out_sent = 0;
+    // A large response is not kept around for the next one
+    if (client->out_cap > IPC_CLIENT_BUFFER) {
+        buffer_resize(&client->out, &client->out_cap, IPC_CLIENT_BUFFER);
+    }
+    return 0;
+}
+
+// Queue a frame behind the pending output; -1 without memory
+static int client_queue_frame(ipc_client_t *client, const ipc_frame_t *frame) {
+    size_t header_size = ipc_header_size(frame->version);
+    size_t needed = client->out_len + header_size + frame->length;
+    if (needed > client->out_cap) {
+        size_t capacity = client->out_cap ? client->out_cap : IPC_CLIENT_BUFFER;
+        while (capacity < needed) capacity *= 2;
+        if (buffer_resize(&client->out, &client->out_cap, capacity) == -1) return -1;
+    }
+
+    if (ipc_encode_header(frame, client->out + client->out_len) == -1) return -1;
+    if (frame->length > 0) memcpy(client->out + client->out_len + header_size, frame->body, frame->length);
+    client->out_len = needed;
+    return 0;
+}
+
+// Queue the response to a request; version 2 errors are typed, without the
+// "error:" prefix, and version 1 responses are cut to fit its frame
+static int client_queue_response(ipc_client_t *client, const ipc_reply_to_t *reply_to,
+                                 const char *response) {
+    ipc_frame_t frame = {
+        .version = reply_to->version,
+        .type = MSG_TYPE_RESPONSE,
+        .request_id = reply_to->request_id,
+    };
+    if (frame.version >= 2 && strncmp(response, "error:", 6) == 0) {
+        frame.type = MSG_TYPE_ERROR;
+        response += 6;
+    }
+
+    char v1_body[MAX_IPC_MESSAGE_SIZE];
+    if (frame.version == 1) {
+        snprintf(v1_body, ipc_max_payload(1) + 1, "%s", response);
+        response = v1_body;
+    }
+    frame.body = (char *)response;
+    frame.length = (uint32_t)strlen(response);
+
+    if (frame.length > ipc_max_payload(frame.version) || ipc_validate_body(&frame) != 0) {
+        // Still answer, so the client is not left waiting
+        frame.type = frame.version >= 2 ? MSG_TYPE_ERROR : MSG_TYPE_RESPONSE;
+        frame.body = frame.version >= 2 ? "Invalid response" : "error:Invalid response";
+        frame.length = (uint32_t)strlen(frame.body);
+    }
+    return client_queue_frame(client, &frame);
+}
+
+static void busy_push(ipc_client_t *client) {
+    if (client->busy || g_server.busy_count == IPC_MAX_CLIENTS) return;
+
+    g_server.busy_slots[(g_server.busy_head + g_server.busy_count) % IPC_MAX_CLIENTS] = client->slot;
+    g_server.busy_count++;
+    client->busy = 1;
+    g_server.stats.busy_waits++;
+}
+
+// Answer a hello with the version both sides speak
+static int client_hello(ipc_client_t *client, const ipc_frame_t *frame, const char *offer) {
+    int version = atoi(offer);
+    if (version > IPC_VERSION) version = IPC_VERSION;
+    if (version < IPC_VERSION_MIN) version = IPC_VERSION_MIN;
+    if (version >= 2) g_server.stats.v2_clients++;
+
+    char answer[16];
+    snprintf(answer, sizeof(answer), "%d", version);
+    ipc_frame_t reply = {
+        .version = frame->version,
+        .type = MSG_TYPE_HELLO,
+        .request_id = frame->request_id,
+        .length = (uint32_t)strlen(answer),
+        .body = answer,
+    };
+    return client_queue_frame(client, &reply);
+}
+
+// Body of the frame at data as a text command (malloc'd); NULL when the
+// body is invalid or its type unknown
+static char *frame_request(const ipc_frame_t *frame, const char *data) {
+    char *body = malloc(frame->length + 1);
+    if (!body) return NULL;
+    memcpy(body, data, frame->length);
+    body[frame->length] = '\0';
+
+    ipc_frame_t checked = *frame;
+    checked.body = body;
+    if (ipc_validate_body(&checked) != 0) {
+        free(body);
+        return NULL;
+    }
+
+    // Version 1 bodies are text commands whatever the type says
+    if (frame->version == 1 || frame->type == MSG_TYPE_HELLO || frame->type == MSG_TYPE_CHANNEL) return body;
+
+    char *request = ipc_request_text(frame->type, body);
+    free(body);
+    return request;
+}
+
+// Hand the descriptors that came with a channel frame over
+static const char *client_channel(ipc_client_t *client) {
+    if (!g_server.on_channel || client->fd_count == 0) {
+        client_close_fds(client);
+        return "error:Channel rejected";
+    }
+
+    // The handler owns the descriptors from here on
+    int result = g_server.on_channel(client_id(client), client->fds, client->fd_count, g_server.userdata);
+    client->fd_count = 0;
+    return result == 0 ? "ok" : "error:Channel rejected";
+}
+
+// Handle queued requests while the connection may have more in flight; 0
+// when it was closed
+static int client_process(ipc_client_t *client) {
+    while (client->active && !client->busy && !client->broken) {
+        ipc_frame_t frame;
+        int header_size = ipc_parse_header(client->in, client->in_len, &frame);
+        if (header_size == -1) {
+            g_server.stats.malformed++;
+            client_close(client);
+            return 0;
+        }
+
+        size_t frame_len = header_size > 0 ? (size_t)header_size + frame.length : 0;
+        if (frame_len == 0 || client->in_len < frame_len) {
+            // Make room for all of a large frame
+            if (frame_len > client->in_cap &&
+                buffer_resize(&client->in, &client->in_cap, frame_len) == -1) {
+                client_close(client);
+                return 0;
+            }
+            if (client->in_len == 0) client->partial_since_ms = 0;
+            break;
+        }
+
+        // One version 1 request at a time; no more while output piles up
+        int limit = frame.version == 1 ? 1 : IPC_MAX_PIPELINED;
+        if (client->in_flight >= limit || client->out_len - client->out_sent >= IPC_CLIENT_BUFFER) break;
+
+        char *request = frame_request(&frame, client->in + header_size);
+        int result = IPC_REQUEST_DONE;
+        if (!request && frame.version == 1) {
+            g_server.stats.malformed++;
+            client_close(client);
+            return 0;
+        } else if (!request) {
+            // Unknown type or invalid body; the connection itself is fine
+            ipc_reply_to_t reply_to = { client_id(client), frame.request_id, frame.version };
+            if (client_queue_response(client, &reply_to, "error:Invalid request") == -1) client->broken = 1;
+        } else if (frame.type == MSG_TYPE_HELLO && frame.version >= 2) {
+            if (client_hello(client, &frame, request) == -1) client->broken = 1;
+        } else if (frame.type == MSG_TYPE_CHANNEL && frame.version >= 2) {
+            ipc_reply_to_t reply_to = { client_id(client), frame.request_id, frame.version };
+            if (client_queue_response(client, &reply_to, client_channel(client)) == -1) client->broken = 1;
+        } else {
+            ipc_reply_to_t reply_to = { client_id(client), frame.request_id, frame.version };
+            client->in_flight++;
+            if (client->in_flight > g_server.stats.max_in_flight) g_server.stats.max_in_flight = client->in_flight;
+
+            g_server.dispatching = 1;
+            result = g_server.on_request(&reply_to, request, g_server.userdata);
+            g_server.dispatching = 0;
+        }
+        free(request);
+
+        if (result == IPC_REQUEST_BUSY) {
+            // Keep the request; the connection waits for its turn
+            client->in_flight--;
+            busy_push(client);
+            break;
+        }
+
+        g_server.stats.requests++;
+        client->in_len -= frame_len;
+        memmove(client->in, client->in + frame_len, client->in_len);
+        client->partial_since_ms = client->in_len > 0 ? monotonic_ms() : 0;
+        if (client->in_cap > IPC_CLIENT_BUFFER && client->in_len <= IPC_CLIENT_BUFFER) {
+            buffer_resize(&client->in, &client->in_cap, IPC_CLIENT_BUFFER);
+        }
+    }
+
+    if (!client->active) return 0;
+
+    if (client->broken || client_flush(client) == -1) {
+        client_close(client);
+        return 0;
+    }
+
+    // Nothing left to answer and nothing more will come
+    if (client->peer_closed && client->in_flight == 0 && client->out_len == 0) {
+        client_close(client);
+        return 0;
+    }
+
+    client_watch(client);
+    return 1;
+}
+
+// Keep descriptors passed with the data just read; any beyond IPC_MAX_FDS
+// are closed
+static void client_take_fds(ipc_client_t *client, struct msghdr *msg) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+
+        int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        for (int i = 0; i < count; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (client->fd_count < IPC_MAX_FDS) {
+                client->fds[client->fd_count++] = fd;
+            } else {
+                close(fd);
+            }
+        }
+    }
+}
+
+static void client_read(ipc_client_t *client) {
+    union {
+        char buffer[CMSG_SPACE(sizeof(int) * IPC_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+
+    while (client->in_len < client->in_cap) {
+        struct iovec iov = { .iov_base = client->in + client->in_len, .iov_len = client->in_cap - client->in_len };
+        struct msghdr msg = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control.buffer,
+            .msg_controllen = sizeof(control.buffer),
+        };
+        ssize_t received = recvmsg(client->fd, &msg, MSG_CMSG_CLOEXEC);
+        if (received > 0 && msg.msg_controllen > 0) client_take_fds(client, &msg);
+        if (received > 0) {
+            if (client->in_len == 0) client->partial_since_ms = monotonic_ms();
+            client->in_len += (size_t)received;
+            // Handling what is complete may also make room for a large frame
+            if (client->in_len == client->in_cap && !client_process(client)) return;
+            continue;
+        }
+        if (received == -1 && errno == EINTR) continue;
+        if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+        // End of stream or a reset: answer what is already queued, then close
+        client->peer_closed = 1;
+        if (received == -1) {
+            client_close(client);
+            return;
+        }
+        break;
+    }
+
+    client_process(client);
+}
+
+static void accept_clients(void) {
+    for (;;) {
+        int fd = accept_ipc_connection(g_server.listen_fd);
+        if (fd == 0) return; // Backlog drained
+        if (fd == -1) {
+            g_server.stats.rejected++;
+            if (errno == EMFILE || errno == ENFILE) return; // Retried on the next event
+            continue;
+        }
+
+        ipc_client_t *client = NULL;
+        for (int slot = 0; slot < IPC_MAX_CLIENTS && !client; slot++) {
+            if (!g_server.clients[slot].active) client = &g_server.clients[slot];
+        }
+        char *in = client ? malloc(IPC_CLIENT_BUFFER) : NULL;
+        int flags = fcntl(fd, F_GETFL, 0);
+        if (!in || flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+            g_server.stats.rejected++;
+            free(in);
+            close(fd);
+            continue;
+        }
+
+        uint32_t generation = client->generation + 1;
+        memset(client, 0, sizeof(ipc_client_t));
+        client->active = 1;
+        client->fd = fd;
+        client->slot = (int)(client - g_server.clients);
+        client->generation = generation;
+        client->in = in;
+        client->in_cap = IPC_CLIENT_BUFFER;
+        client->events = EPOLLIN;
+        client->watched = 1;
+
+        struct epoll_event event = { .events = EPOLLIN, .data.u64 = IPC_EVENT_CLIENT | (uint64_t)client->slot };
+        if (epoll_ctl(g_server.epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            g_server.stats.rejected++;
+            free(in);
+            close(fd);
+            client->in = NULL;
+            client->active = 0;
+            continue;
+        }
+
+        g_server.stats.accepted++;
+        g_server.stats.clients++;
+        if (g_server.stats.clients > g_server.stats.max_clients) g_server.stats.max_clients = g_server.stats.clients;
+    }
+}
+
+int ipc_server_init(int epoll_fd, int listen_fd, ipc_request_fn on_request, void *userdata) {
+    if (epoll_fd == -1 || listen_fd == -1 || !on_request) return -1;
+
+    g_server.epoll_fd = epoll_fd;
+    g_server.listen_fd = listen_fd;
+    g_server.on_request = on_request;
+    g_server.userdata = userdata;
+
+    struct epoll_event event = { .events = EPOLLIN, .data.u64 = (uint64_t)listen_fd };
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+}
+
+// 1 when key (epoll_data.u64) is the listening socket or a client
+// connection and was handled
+int ipc_server_handle_event(uint64_t key, uint32_t events) {
+    if (key == (uint64_t)g_server.listen_fd) {
+        accept_clients();
+        return 1;
+    }
+    uint64_t slot = key - IPC_EVENT_CLIENT;
+    if (key < IPC_EVENT_CLIENT || slot >= IPC_MAX_CLIENTS || !g_server.clients[slot].active) return 0;
+
+    ipc_client_t *client = &g_server.clients[slot];
+    if (events & EPOLLOUT) {
+        if (client_flush(client) == -1) {
+            client_close(client);
+            return 1;
+        }
+        if (!client_process(client)) return 1;
+    }
+    if (client->peer_closed) {
+        // Nothing more to read: only pending output (or its failure) is left
+        if (events & (EPOLLHUP | EPOLLERR)) client_process(client);
+    } else if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        client_read(client);
+    }
+    return 1;
+}
+
+// Descriptors passed with MSG_TYPE_CHANNEL go to on_channel; without one
+// such frames are refused
+void ipc_server_set_channel_handler(ipc_channel_fn on_channel) {
+    g_server.on_channel = on_channel;
+}
+
+// Queue the response to a request in flight; -1 if the client is gone
+int ipc_server_respond(const ipc_reply_to_t *reply_to, const char *response) {
+    ipc_client_t *client = reply_to ? client_by_id(reply_to->client_id) : NULL;
+    if (!client || client->in_flight == 0) return -1;
+
+    client->in_flight--;
+    g_server.stats.responses++;
+    if (client_queue_response(client, reply_to, response) == -1) client->broken = 1;
+
+    // Responses given from the callback are written by client_process()
+    if (!g_server.dispatching) client_process(client);
+    return 0;
+}
+
+// Give waiting connections their turn, oldest first, until one is busy again
+void ipc_server_resume(void) {
+    while (g_server.busy_count > 0) {
+        int slot = g_server.busy_slots[g_server.busy_head];
+        g_server.busy_head = (g_server.busy_head + 1) % IPC_MAX_CLIENTS;
+        g_server.busy_count--;
+
+        ipc_client_t *client = &g_server.clients[slot];
+        if (!client->active || !client->busy) continue;
+        client->busy = 0;
+
+        client_process(client);
+        if (client->active && client->busy) {
+            // Still no capacity: it went to the back, but keeps its place at the front
+            g_server.busy_count--;
+            g_server.busy_head = (g_server.busy_head + IPC_MAX_CLIENTS - 1) % IPC_MAX_CLIENTS;
+            g_server.busy_slots[g_server.busy_head] = slot;
+            g_server.busy_count++;
+            g_server.stats.busy_waits--;
+            break;
+        }
+    }
+}
+
+// Close connections whose request stopped arriving halfway
+void ipc_server_sweep(void) {
+    uint64_t now = monotonic_ms();
+    for (int slot = 0; slot < IPC_MAX_CLIENTS; slot++) {
+        ipc_client_t *client = &g_server.clients[slot];
+        if (!client->active || client->in_flight || client->busy || client->partial_since_ms == 0) continue;
+        if (now - client->partial_since_ms < IPC_STALL_TIMEOUT_MS) continue;
+
+        g_server.stats.stalled++;
+        client_close(client);
+    }
+}
+
+void ipc_server_get_stats(ipc_server_stats_t *stats) {
+    if (stats) *stats = g_server.stats;
+}
+
+void ipc_server_shutdown(void) {
+    for (int slot = 0; slot < IPC_MAX_CLIENTS; slot++) {
+        if (g_server.clients[slot].active) client_close(&g_server.clients[slot]);
+    }
+    g_server.busy_count = 0;
+}
@@ -0,0 +1,424 @@
+#define _GNU_SOURCE
+#include "smart_cmd.h"
+
+/*
+ * Streaming JSON Reader
+ *
+ * Resumable, SAX-style JSON tokenizer. Bytes are fed in whatever pieces the
+ * transport delivers them; the reader keeps its position in the document
+ * (container stack, current key or array index, string and escape state)
+ * between calls, so nothing is buffered beyond the current object key.
+ *
+ * Callers register target paths such as "choices.0.message.content" or
+ * "candidates.*.content.parts.0.text" (segments are object keys, array
+ * indices or "*"). When a string value sits at a target path, its decoded
+ * bytes are handed to the callback in chunks as they are parsed; the final
+ * chunk is flagged as done. Numbers, true, false and null at a target path
+ * are passed the same way as their literal text. The callback may return
+ * non-zero to stop.
+ */
+
+enum {
+    JS_VALUE = 0,       // Expecting a value
+    JS_VALUE_OR_END,    // After '[': a value or ']'
+    JS_KEY_OR_END,      // After '{': a key or '}'
+    JS_KEY,             // After ',' in an object
+    JS_COLON,
+    JS_AFTER_VALUE,     // Expecting ',' or a closing bracket
+    JS_STRING,
+    JS_ESCAPE,
+    JS_UNICODE,
+    JS_LITERAL,         // Numbers, true, false, null
+    JS_DONE,
+    JS_ERROR
+};
+
+static int path_parse(json_path_t *path, const char *pattern) {
+    memset(path, 0, sizeof(json_path_t));
+
+    const char *p = pattern;
+    while (*p) {
+        if (path->segment_count >= JSON_STREAM_MAX_SEGMENTS) return -1;
+
+        const char *dot = strchr(p, '.');
+        size_t len = dot ? (size_t)(dot - p) : strlen(p);
+        if (len == 0 || len >= JSON_STREAM_KEY_LEN) return -1;
+
+        memcpy(path->segments[path->segment_count], p, len);
+        path->segments[path->segment_count][len] = '\0';
+        path->segment_count++;
+
+        p += len;
+        if (*p == '.') p++;
+    }
+    return 0;
+}
+
+int json_stream_init(json_stream_t *js, const char *const *patterns, int pattern_count,
+                     json_stream_string_cb on_string, void *userdata) {
+    if (!js || !patterns || pattern_count <= 0 || pattern_count > JSON_STREAM_MAX_TARGETS) return -1;
+
+    memset(js, 0, sizeof(json_stream_t));
+    for (int i = 0; i < pattern_count; i++) {
+        if (path_parse(&js->paths[i], patterns[i]) != 0) {
+            fprintf(stderr, "ERROR: json_stream_init: Invalid path '%s'\n", patterns[i]);
+            return -1;
+        }
+    }
+    js->path_count = pattern_count;
+    js->on_string = on_string;
+    js->userdata = userdata;
+    json_stream_reset(js);
+    return 0;
+}
+
+void json_stream_reset(json_stream_t *js) {
+    if (!js) return;
+
+    js->state = JS_VALUE;
+    js->depth = 0;
+    js->string_target = -1;
+    js->chunk_len = 0;
+    js->high_surrogate = 0;
+    js->stopped = 0;
+}
+
+int json_stream_done(const json_stream_t *js) {
+    return js && js->state == JS_DONE;
+}
+
+// Targets still on track after matching the current member of level
+static unsigned level_match(const json_stream_t *js, int level) {
+    const json_stream_level_t *l = &js->levels[level];
+    unsigned parent = level == 0 ? (1u << js->path_count) - 1 : js->levels[level - 1].match;
+    unsigned match = 0;
+
+    for (int t = 0; t < js->path_count; t++) {
+        if (!(parent & (1u << t)) || js->paths[t].segment_count <= level) continue;
+
+        const char *segment = js->paths[t].segments[level];
+        int matches;
+        if (strcmp(segment, "*") == 0) {
+            matches = 1;
+        } else if (l->type == '[') {
+            char *end;
+            long index = strtol(segment, &end, 10);
+            matches = (*end == '\0' && index == l->index);
+        } else {
+            matches = !l->key_truncated && strcmp(segment, l->key) == 0;
+        }
+        if (matches) match |= 1u << t;
+    }
+    return match;
+}
+
+// Index of the first target whose full path ends at the current depth
+static int value_target(const json_stream_t *js) {
+    if (js->depth == 0) return -1;
+
+    unsigned match = js->levels[js->depth - 1].match;
+    for (int t = 0; t < js->path_count; t++) {
+        if ((match & (1u << t)) && js->paths[t].segment_count == js->depth) return t;
+    }
+    return -1;
+}
+
+static int flush_chunk(json_stream_t *js, int done) {
+    if (js->string_target < 0 || !js->on_string) return 0;
+    if (js->chunk_len == 0 && !done) return 0;
+
+    int stop = js->on_string(js->string_target, js->chunk, js->chunk_len, done, js->userdata);
+    js->chunk_len = 0;
+    if (stop) js->stopped = 1;
+    return stop;
+}
+
+static int emit_byte(json_stream_t *js, char c) {
+    if (js->string_target >= 0) {
+        js->chunk[js->chunk_len++] = c;
+        if (js->chunk_len == sizeof(js->chunk)) return flush_chunk(js, 0);
+    } else if (js->string_is_key) {
+        json_stream_level_t *l = &js->levels[js->depth - 1];
+        if (js->key_len + 1 < sizeof(l->key)) {
+            l->key[js->key_len++] = c;
+            l->key[js->key_len] = '\0';
+        } else {
+            l->key_truncated = 1;
+        }
+    }
+    return 0;
+}
+
+static int emit_codepoint(json_stream_t *js, unsigned codepoint) {
+    char utf8[4];
+    int len;
+    if (codepoint < 0x80) {
+        utf8[0] = (char)codepoint;
+        len = 1;
+    } else if (codepoint < 0x800) {
+        utf8[0] = (char)(0xc0 | (codepoint >> 6));
+        utf8[1] = (char)(0x80 | (codepoint & 0x3f));
+        len = 2;
+    } else if (codepoint < 0x10000) {
+        utf8[0] = (char)(0xe0 | (codepoint >> 12));
+        utf8[1] = (char)(0x80 | ((codepoint >> 6) & 0x3f));
+        utf8[2] = (char)(0x80 | (codepoint & 0x3f));
+        len = 3;
+    } else {
+        utf8[0] = (char)(0xf0 | (codepoint >> 18));
+        utf8[1] = (char)(0x80 | ((codepoint >> 12) & 0x3f));
+        utf8[2] = (char)(0x80 | ((codepoint >> 6) & 0x3f));
+        utf8[3] = (char)(0x80 | (codepoint & 0x3f));
+        len = 4;
+    }
+
+    for (int i = 0; i < len; i++) {
+        if (emit_byte(js, utf8[i])) return 1;
+    }
+    return 0;
+}
+
+// A high surrogate not followed by a low one becomes U+FFFD
+static int flush_surrogate(json_stream_t *js) {
+    if (!js->high_surrogate) return 0;
+    js->high_surrogate = 0;
+    return emit_codepoint(js, 0xfffd);
+}
+
+static int push_level(json_stream_t *js, char type) {
+    if (js->depth >= JSON_STREAM_MAX_DEPTH) return -1;
+
+    json_stream_level_t *l = &js->levels[js->depth++];
+    l->type = type;
+    l->index = 0;
+    l->key[0] = '\0';
+    l->key_truncated = 0;
+    l->match = 0;
+    if (type == '[') l->match = level_match(js, js->depth - 1);
+    return 0;
+}
+
+// After a complete value: the document ends or the container continues
+static void value_done(json_stream_t *js) {
+    js->state = js->depth == 0 ? JS_DONE : JS_AFTER_VALUE;
+}
+
+static int literal_done(json_stream_t *js) {
+    int stop = flush_chunk(js, 1);
+    js->string_target = -1;
+    value_done(js);
+    return stop;
+}
+
+static int start_value(json_stream_t *js, char c) {
+    switch (c) {
+    case '{':
+        if (push_level(js, '{') != 0) return -1;
+        js->state = JS_KEY_OR_END;
+        return 0;
+    case '[':
+        if (push_level(js, '[') != 0) return -1;
+        js->state = JS_VALUE_OR_END;
+        return 0;
+    case '"':
+        js->string_is_key = 0;
+        js->string_target = value_target(js);
+        js->chunk_len = 0;
+        js->state = JS_STRING;
+        return 0;
+    default:
+        if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n') {
+            js->string_is_key = 0;
+            js->string_target = value_target(js);
+            js->chunk_len = 0;
+            js->state = JS_LITERAL;
+            return emit_byte(js, c);
+        }
+        return -1;
+    }
+}
+
+static int close_container(json_stream_t *js, char c) {
+    if (js->depth == 0) return -1;
+    char expected = js->levels[js->depth - 1].type == '{' ? '}' : ']';
+    if (c != expected) return -1;
+
+    js->depth--;
+    value_done(js);
+    return 0;
+}
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Returns 0 to continue, 1 when stopped by the callback, -1 on a syntax error
+static int step(json_stream_t *js, char c) {
+    switch (js->state) {
+    case JS_STRING:
+        if (c == '"') {
+            if (flush_surrogate(js)) return 1;
+            if (js->string_is_key) {
+                js->state = JS_COLON;
+                return 0;
+            }
+            int stop = flush_chunk(js, 1);
+            js->string_target = -1;
+            value_done(js);
+            return stop;
+        }
+        if (c == '\\') {
+            js->state = JS_ESCAPE;
+            return 0;
+        }
+        if ((unsigned char)c < 0x20) return -1;
+        if (flush_surrogate(js)) return 1;
+        return emit_byte(js, c);
+
+    case JS_ESCAPE: {
+        js->state = JS_STRING;
+        if (c == 'u') {
+            js->unicode_digits = 0;
+            js->unicode_value = 0;
+            js->state = JS_UNICODE;
+            return 0;
+        }
+        if (flush_surrogate(js)) return 1;
+
+        char decoded;
+        switch (c) {
+        case '"': decoded = '"'; break;
+        case '\\': decoded = '\\'; break;
+        case '/': decoded = '/'; break;
+        case 'b': decoded = '\b'; break;
+        case 'f': decoded = '\f'; break;
+        case 'n': decoded = '\n'; break;
+        case 'r': decoded = '\r'; break;
+        case 't': decoded = '\t'; break;
+        default: return -1;
+        }
+        return emit_byte(js, decoded);
+    }
+
+    case JS_UNICODE: {
+        int digit = hex_value(c);
+        if (digit < 0) return -1;
+        js->unicode_value = (js->unicode_value << 4) | (unsigned)digit;
+        if (++js->unicode_digits < 4) return 0;
+
+        js->state = JS_STRING;
+        unsigned value = js->unicode_value;
+        if (value >= 0xd800 && value <= 0xdbff) {
+            if (flush_surrogate(js)) return 1;
+            js->high_surrogate = value;
+            return 0;
+        }
+        if (value >= 0xdc00 && value <= 0xdfff) {
+            if (!js->high_surrogate) return emit_codepoint(js, 0xfffd);
+            unsigned codepoint = 0x10000 + ((js->high_surrogate - 0xd800) << 10) + (value - 0xdc00);
+            js->high_surrogate = 0;
+            return emit_codepoint(js, codepoint);
+        }
+        if (flush_surrogate(js)) return 1;
+        return emit_codepoint(js, value);
+    }
+
+    case JS_LITERAL:
+        if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '.' || c == '-' ||
+            c == '+' || c == 'E') {
+            return emit_byte(js, c);
+        }
+        if (literal_done(js)) return 1;
+        return step(js, c); // The delimiter belongs to the enclosing state
+
+    default:
+        break;
+    }
+
+    if (is_space(c)) return 0;
+
+    switch (js->state) {
+    case JS_VALUE:
+        return start_value(js, c);
+
+    case JS_VALUE_OR_END:
+        if (c == ']') return close_container(js, c);
+        return start_value(js, c);
+
+    case JS_KEY_OR_END:
+        if (c == '}') return close_container(js, c);
+        // fall through
+    case JS_KEY:
+        if (c != '"') return -1;
+        js->levels[js->depth - 1].key[0] = '\0';
+        js->levels[js->depth - 1].key_truncated = 0;
+        js->key_len = 0;
+        js->string_is_key = 1;
+        js->string_target = -1;
+        js->state = JS_STRING;
+        return 0;
+
+    case JS_COLON:
+        if (c != ':') return -1;
+        js->levels[js->depth - 1].match = level_match(js, js->depth - 1);
+        js->state = JS_VALUE;
+        return 0;
+
+    case JS_AFTER_VALUE: {
+        json_stream_level_t *l = &js->levels[js->depth - 1];
+        if (c == ',') {
+            if (l->type == '[') {
+                l->index++;
+                l->match = level_match(js, js->depth - 1);
+                js->state = JS_VALUE;
+            } else {
+                js->state = JS_KEY;
+            }
+            return 0;
+        }
+        return close_container(js, c);
+    }
+
+    case JS_DONE:
+        return -1; // Trailing garbage
+
+    default:
+        return -1;
+    }
+}
+
+int json_stream_feed(json_stream_t *js, const char *data, size_t len) {
+    if (!js || !data) return -1;
+    if (js->state == JS_ERROR) return -1;
+    if (js->stopped) return 1;
+
+    for (size_t i = 0; i < len; i++) {
+        int result = step(js, data[i]);
+        if (result == 1) return 1;
+        if (result < 0) {
+            js->state = JS_ERROR;
+            return -1;
+        }
+    }
+
+    // Hand over what has been decoded so far instead of waiting for more input
+    if (js->state == JS_STRING || js->state == JS_ESCAPE || js->state == JS_UNICODE) {
+        if (flush_chunk(js, 0)) return 1;
+    }
+    return 0;
+}
+
+int json_stream_finish(json_stream_t *js) {
+    if (!js) return -1;
+
+    // A number at the very end of the document has no delimiter after it
+    if (js->state == JS_LITERAL) literal_done(js);
+    return js->state == JS_DONE || js->stopped ? 0 : -1;
+}
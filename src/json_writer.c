@@ -0,0 +1,311 @@
+#define _GNU_SOURCE
+#include "smart_cmd.h"
+
+/*
+ * JSON Writer
+ *
+ * Single-pass JSON serializer into a growable buffer. Strings are escaped as
+ * they are copied (quotes, backslashes, control characters) and invalid
+ * UTF-8 is replaced with U+FFFD, so terminal output with escape sequences or
+ * split multibyte characters still produces a valid request body. Commas are
+ * inserted automatically from the nesting state. An allocation failure marks
+ * the writer as failed and json_writer_finish() then returns NULL.
+ */
+
+int json_writer_init(json_writer_t *w, size_t initial_cap) {
+    if (!w) return -1;
+
+    memset(w, 0, sizeof(json_writer_t));
+    if (initial_cap < 64) initial_cap = 64;
+    w->data = malloc(initial_cap);
+    if (!w->data) {
+        w->failed = 1;
+        return -1;
+    }
+    w->cap = initial_cap;
+    w->data[0] = '\0';
+    return 0;
+}
+
+void json_writer_reset(json_writer_t *w) {
+    if (!w) return;
+
+    // Keep the buffer so a reused writer does not allocate again
+    w->len = 0;
+    w->depth = 0;
+    w->after_key = 0;
+    w->needs_comma[0] = 0;
+    w->failed = (w->data == NULL);
+    if (w->data) w->data[0] = '\0';
+}
+
+void json_writer_free(json_writer_t *w) {
+    if (!w) return;
+    SAFE_FREE(w->data);
+    w->len = 0;
+    w->cap = 0;
+}
+
+const char *json_writer_finish(json_writer_t *w) {
+    if (!w || w->failed || w->depth != 0) return NULL;
+    return w->data;
+}
+
+static int reserve(json_writer_t *w, size_t extra) {
+    if (w->failed) return -1;
+    if (w->len + extra + 1 <= w->cap) return 0;
+
+    size_t new_cap = w->cap ? w->cap * 2 : 256;
+    while (new_cap < w->len + extra + 1) new_cap *= 2;
+
+    char *new_data = realloc(w->data, new_cap);
+    if (!new_data) {
+        w->failed = 1;
+        return -1;
+    }
+    w->data = new_data;
+    w->cap = new_cap;
+    return 0;
+}
+
+static void put_bytes(json_writer_t *w, const char *bytes, size_t len) {
+    if (reserve(w, len) != 0) return;
+    memcpy(w->data + w->len, bytes, len);
+    w->len += len;
+    w->data[w->len] = '\0';
+}
+
+static void put_char(json_writer_t *w, char c) {
+    if (reserve(w, 1) != 0) return;
+    w->data[w->len++] = c;
+    w->data[w->len] = '\0';
+}
+
+// Separate values inside objects and arrays
+static void begin_value(json_writer_t *w) {
+    if (w->after_key) {
+        w->after_key = 0;
+        return;
+    }
+    if (w->needs_comma[w->depth]) put_char(w, ',');
+    w->needs_comma[w->depth] = 1;
+}
+
+static void open_container(json_writer_t *w, char c) {
+    begin_value(w);
+    put_char(w, c);
+    if (w->depth + 1 >= JSON_WRITER_MAX_DEPTH) {
+        w->failed = 1;
+        return;
+    }
+    w->needs_comma[++w->depth] = 0;
+}
+
+static void close_container(json_writer_t *w, char c) {
+    if (w->depth == 0) {
+        w->failed = 1;
+        return;
+    }
+    w->depth--;
+    put_char(w, c);
+}
+
+void json_writer_begin_object(json_writer_t *w) { open_container(w, '{'); }
+void json_writer_end_object(json_writer_t *w) { close_container(w, '}'); }
+void json_writer_begin_array(json_writer_t *w) { open_container(w, '['); }
+void json_writer_end_array(json_writer_t *w) { close_container(w, ']'); }
+
+// Length of the valid UTF-8 sequence at s, or 0 if it is invalid or truncated
+static size_t utf8_sequence_length(const unsigned char *s) {
+    if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+        return (s[1] & 0xc0) == 0x80 ? 2 : 0;
+    }
+    if (s[0] >= 0xe0 && s[0] <= 0xef) {
+        if ((s[1] & 0xc0) != 0x80 || (s[2] & 0xc0) != 0x80) return 0;
+        if (s[0] == 0xe0 && s[1] < 0xa0) return 0; // Overlong
+        if (s[0] == 0xed && s[1] >= 0xa0) return 0; // Surrogates
+        return 3;
+    }
+    if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+        if ((s[1] & 0xc0) != 0x80 || (s[2] & 0xc0) != 0x80 || (s[3] & 0xc0) != 0x80) return 0;
+        if (s[0] == 0xf0 && s[1] < 0x90) return 0; // Overlong
+        if (s[0] == 0xf4 && s[1] >= 0x90) return 0; // Above U+10FFFF
+        return 4;
+    }
+    return 0;
+}
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// Non-zero if any of the eight bytes may need escaping: a control character,
+// a quote, a backslash or a non-ASCII byte (false positives are fine, the
+// byte loop sorts them out)
+static int word_needs_escape(uint64_t x) {
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    uint64_t control = (x - ones * 0x20) & ~x;
+    uint64_t quote = x ^ (ones * '"');
+    uint64_t backslash = x ^ (ones * '\\');
+    quote = (quote - ones) & ~quote;
+    backslash = (backslash - ones) & ~backslash;
+    return ((control | quote | backslash | x) & highs) != 0;
+}
+
+static void put_escaped(json_writer_t *w, const char *str, size_t len) {
+    // Worst case every byte becomes a six-byte \uXXXX escape; reserving that
+    // once keeps the loop free of bounds checks
+    if (reserve(w, len * 6) != 0) return;
+
+    const unsigned char *s = (const unsigned char *)str;
+    char *out = w->data + w->len;
+    size_t i = 0;
+
+    while (i < len) {
+        // Copy bytes that need no escaping a word at a time, then byte by byte
+        while (i + 8 <= len) {
+            uint64_t word;
+            memcpy(&word, s + i, sizeof(word));
+            if (word_needs_escape(word)) break;
+            memcpy(out, &word, sizeof(word));
+            out += 8;
+            i += 8;
+        }
+        while (i < len && s[i] >= 0x20 && s[i] < 0x80 && s[i] != '"' && s[i] != '\\') {
+            *out++ = (char)s[i++];
+        }
+        if (i >= len) break;
+
+        unsigned char c = s[i];
+        if (c >= 0x80) {
+            // The NUL terminator stops a truncated sequence from reading past the end
+            size_t seq = utf8_sequence_length(s + i);
+            if (seq > 0 && i + seq <= len) {
+                memcpy(out, str + i, seq);
+                out += seq;
+                i += seq;
+            } else {
+                memcpy(out, "\\ufffd", 6);
+                out += 6;
+                i++;
+            }
+            continue;
+        }
+
+        *out++ = '\\';
+        switch (c) {
+        case '"': *out++ = '"'; break;
+        case '\\': *out++ = '\\'; break;
+        case '\n': *out++ = 'n'; break;
+        case '\r': *out++ = 'r'; break;
+        case '\t': *out++ = 't'; break;
+        case '\b': *out++ = 'b'; break;
+        case '\f': *out++ = 'f'; break;
+        default:
+            *out++ = 'u';
+            *out++ = '0';
+            *out++ = '0';
+            *out++ = hex_digits[c >> 4];
+            *out++ = hex_digits[c & 0xf];
+            break;
+        }
+        i++;
+    }
+
+    w->len = (size_t)(out - w->data);
+    w->data[w->len] = '\0';
+}
+
+void json_writer_key(json_writer_t *w, const char *key) {
+    begin_value(w);
+    put_char(w, '"');
+    put_escaped(w, key ? key : "", key ? strlen(key) : 0);
+    put_bytes(w, "\":", 2);
+    w->after_key = 1;
+}
+
+void json_writer_string(json_writer_t *w, const char *str) {
+    json_writer_string_begin(w);
+    json_writer_string_append(w, str);
+    json_writer_string_end(w);
+}
+
+void json_writer_string_begin(json_writer_t *w) {
+    begin_value(w);
+    put_char(w, '"');
+}
+
+void json_writer_string_append(json_writer_t *w, const char *str) {
+    if (str) put_escaped(w, str, strlen(str));
+}
+
+void json_writer_string_end(json_writer_t *w) {
+    put_char(w, '"');
+}
+
+// Digits of value at the end of buf; returns the start
+static char *format_unsigned(char *end, unsigned long value) {
+    char *p = end;
+    do {
+        *--p = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    return p;
+}
+
+void json_writer_int(json_writer_t *w, long value) {
+    char number[24];
+    char *end = number + sizeof(number);
+    unsigned long magnitude = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+    char *p = format_unsigned(end, magnitude);
+    if (value < 0) *--p = '-';
+
+    begin_value(w);
+    put_bytes(w, p, (size_t)(end - p));
+}
+
+void json_writer_double(json_writer_t *w, double value) {
+    begin_value(w);
+    if (value != value || value > 1e308 || value < -1e308) {
+        put_bytes(w, "null", 4); // JSON has no NaN or infinity
+        return;
+    }
+
+    // Values like 0.7 are written exactly with up to six decimals without
+    // going through printf; anything else falls back to %.15g
+    double magnitude = value < 0 ? -value : value;
+    if (magnitude < 1e12) {
+        unsigned long scaled = (unsigned long)(magnitude * 1e6 + 0.5);
+        if ((double)scaled / 1e6 == magnitude) {
+            char number[40];
+            char *end = number + sizeof(number);
+            char *p = end;
+            unsigned long fraction = scaled % 1000000;
+            if (fraction) {
+                int digits = 6;
+                while (fraction % 10 == 0) {
+                    fraction /= 10;
+                    digits--;
+                }
+                for (int i = 0; i < digits; i++) {
+                    *--p = (char)('0' + fraction % 10);
+                    fraction /= 10;
+                }
+                *--p = '.';
+            }
+            p = format_unsigned(p, scaled / 1000000);
+            if (value < 0) *--p = '-';
+            put_bytes(w, p, (size_t)(end - p));
+            return;
+        }
+    }
+
+    char number[32];
+    int len = snprintf(number, sizeof(number), "%.15g", value);
+    put_bytes(w, number, (size_t)len);
+}
+
+void json_writer_bool(json_writer_t *w, int value) {
+    begin_value(w);
+    if (value) put_bytes(w, "true", 4);
+    else put_bytes(w, "false", 5);
+}
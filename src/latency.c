@@ -0,0 +1,59 @@
+#define _GNU_SOURCE
+#include "smart_cmd.h"
+
+/*
+ * Latency Histograms
+ *
+ * Log-scale latency histogram with four buckets per power of two, from 1ms
+ * up to about a minute. Percentiles are read back as the upper bound of the
+ * bucket they fall in, which is at most ~19% above the true value. Once the
+ * histogram holds LATENCY_WINDOW samples all counts are halved, so old
+ * samples fade out and the percentiles follow the provider's current state.
+ */
+
+static double bucket_upper_bound(int bucket) {
+    double bound = 1.0;
+    for (int i = 0; i <= bucket; i++) {
+        bound *= 1.189207115; // 2^(1/4)
+    }
+    return bound;
+}
+
+void latency_histogram_record(latency_histogram_t *hist, double ms) {
+    if (!hist || ms < 0) return;
+
+    int bucket = 0;
+    double bound = 1.189207115;
+    while (bucket < LATENCY_BUCKETS - 1 && ms > bound) {
+        bound *= 1.189207115;
+        bucket++;
+    }
+
+    if (hist->total >= LATENCY_WINDOW) {
+        hist->total = 0;
+        for (int i = 0; i < LATENCY_BUCKETS; i++) {
+            hist->counts[i] /= 2;
+            hist->total += hist->counts[i];
+        }
+    }
+
+    hist->counts[bucket]++;
+    hist->total++;
+}
+
+double latency_histogram_percentile(const latency_histogram_t *hist, double percentile) {
+    if (!hist || hist->total == 0) return 0.0;
+
+    // The nearest-rank sample: p99 of 50 samples is the 50th, not the 49th
+    double rank = percentile * (double)hist->total / 100.0;
+    unsigned long target = (unsigned long)rank;
+    if ((double)target < rank) target++;
+    if (target == 0) target = 1;
+
+    unsigned long seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= target) return bucket_upper_bound(i);
+    }
+    return bucket_upper_bound(LATENCY_BUCKETS - 1);
+}
@@ -3,189 +3,312 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #define MAX_BUFFER 8192
 #define MAX_CONTENT 4096
+#define LLM_REQUEST_INITIAL_SIZE 4096
 
+// Messages point at caller-owned strings; nothing is copied until the
+// request body is serialized
 typedef struct {
-    char roles[5][12];
-    char contents[2+MAX_HISTORY_MESSAGES][MAX_CONTENT];
+    const char* roles[2+MAX_HISTORY_MESSAGES];
+    const char* contents[2+MAX_HISTORY_MESSAGES];
     int msg_count;
+    int candidate_count; // Completions asked for in one call
 } Agent;
 
 
-static char* json_find(const char* json, const char* key, char* out, size_t size) {
-    if (!json || !key || !out) return NULL;
-    char pattern[64];
-    snprintf(pattern, 64, "\"%s\":", key);
-    const char* start = strstr(json, pattern);
-    if (!start) return NULL;
-    start += strlen(pattern);
-    while (*start == ' ' || *start == '\t') start++;
-
-    if (*start == '"') {
-        start++;
-        const char* end = start;
-        while (*end && *end != '"') {
-            if (*end == '\\' && end[1]) end += 2;
-            else end++;
-        }
-        size_t len = end - start;
-        if (len >= size) len = size - 1;
-        strncpy(out, start, len);
-        out[len] = '\0';
-
-        for (char* p = out; *p; p++) {
-            if (*p == '\\' && p[1]) {
-                switch (p[1]) {
-                case 'n': *p = '\n'; memmove(p+1, p+2, strlen(p+1)); break;
-                case 't': *p = '\t'; memmove(p+1, p+2, strlen(p+1)); break;
-                case 'r': *p = '\r'; memmove(p+1, p+2, strlen(p+1)); break;
-                case '\\': case '"': memmove(p, p+1, strlen(p)); break;
-                }
-            }
-        }
-    } else {
-        const char* end = start;
-        while (*end && *end != ',' && *end != '}' && *end != ' ' && *end != '\n') end++;
-        size_t len = end - start;
-        if (len >= size) len = size - 1;
-        strncpy(out, start, len);
-        out[len] = '\0';
-    }
-    return out;
-}
-
-static void build_system_prompt(char* buffer, size_t buffer_size, const session_context_t* ctx) {
-    int pos = 0;
+// Volatile context goes after the constant instructions so the prompt prefix
+// stays cacheable on the provider side
+static char* build_user_message(const char* input, const session_context_t* ctx, const config_t* config) {
+    // Each context source is trimmed to its token budget from config.json
+    char* context = prompt_build_context(ctx, &config->prompt);
+    if (!context) return NULL;
 
-    pos += snprintf(buffer + pos, buffer_size - pos,
-                    "You are an AI command-line assistant. Your goal is to complete the user's command or suggest the next one.\n\n"
-                    "CONTEXT:\n");
-
-    if (strlen(ctx->terminal_buffer) > 0) {
-        pos += snprintf(buffer + pos, buffer_size - pos, "Command History:\n%s\n", ctx->terminal_buffer);
+    char* message = NULL;
+    if (asprintf(&message, "CONTEXT:\n%s\nINPUT:\n%s", context[0] ? context : "(none)\n", input) == -1) {
+        message = NULL;
     }
-
-    snprintf(buffer + pos, buffer_size - pos,
-             "\nRULES:\n"
-             "1. Your response must be a single command-line suggestion.\n"
-             "2. If you are completing the user's partial command, your response MUST start with '+' followed by the ENTIRE completed command. Example: If the user input is 'git commi', your response should be '+git commit'.\n"
-             "3. If you are suggesting a new command (not a completion of partial input), your response MUST start with '='. Example: '=git status'.\n"
-             "4. Do NOT add any explanation. Your entire output must be just the prefix ('+' or '=') and the command.\n");
+    free(context);
+    return message;
 }
 
-static char* json_request(const Agent* agent, const config_t* config, char* out, size_t size) {
-    if (!agent || !out) return NULL;
+static const char* json_request(const Agent* agent, const config_t* config, json_writer_t* w) {
+    if (!agent || !w) return NULL;
 
+    json_writer_begin_object(w);
     if (strcmp(config->llm.provider, "gemini") == 0) {
         // Gemini format: combine system+user into single message with parts
-        char combined_prompt[MAX_CONTENT * 2] = "";
+        json_writer_key(w, "contents");
+        json_writer_begin_array(w);
+        json_writer_begin_object(w);
+        json_writer_key(w, "parts");
+        json_writer_begin_array(w);
+        json_writer_begin_object(w);
+        json_writer_key(w, "text");
+        json_writer_string_begin(w);
         for (int i = 0; i < agent->msg_count; i++) {
             if (strcmp(agent->roles[i], "system") == 0) {
-                strcat(combined_prompt, agent->contents[i]);
-                strcat(combined_prompt, "\n\n");
+                json_writer_string_append(w, agent->contents[i]);
+                json_writer_string_append(w, "\n\n");
             } else if (strcmp(agent->roles[i], "user") == 0) {
-                strcat(combined_prompt, agent->contents[i]);
+                json_writer_string_append(w, agent->contents[i]);
             }
         }
-        snprintf(out, size, "{\"contents\":[{\"parts\":[{\"text\":\"%s\"}]}],\"generationConfig\":{\"temperature\":0.7,\"maxOutputTokens\":100}}", combined_prompt);
+        json_writer_string_end(w);
+        json_writer_end_object(w);
+        json_writer_end_array(w);
+        json_writer_end_object(w);
+        json_writer_end_array(w);
+
+        json_writer_key(w, "generationConfig");
+        json_writer_begin_object(w);
+        json_writer_key(w, "temperature");
+        json_writer_double(w, 0.7);
+        json_writer_key(w, "maxOutputTokens");
+        json_writer_int(w, 100);
+        if (agent->candidate_count > 1) {
+            json_writer_key(w, "candidateCount");
+            json_writer_int(w, agent->candidate_count);
+        }
+        json_writer_end_object(w);
     } else {
         // OpenAI format: standard messages array
-        char messages[MAX_BUFFER] = "[";
+        json_writer_key(w, "model");
+        json_writer_string(w, config->llm.model[0] ? config->llm.model : "gpt-4.1-nano");
+        json_writer_key(w, "messages");
+        json_writer_begin_array(w);
         for (int i = 0; i < agent->msg_count; i++) {
-            if (i > 0) strcat(messages, ",");
-            char temp[MAX_CONTENT + 100];
-            snprintf(temp, sizeof(temp), "{\"role\":\"%s\",\"content\":\"%s\"}", agent->roles[i], agent->contents[i]);
-            if (strlen(messages) + strlen(temp) + 10 < sizeof(messages)) strcat(messages, temp);
+            json_writer_begin_object(w);
+            json_writer_key(w, "role");
+            json_writer_string(w, agent->roles[i]);
+            json_writer_key(w, "content");
+            json_writer_string(w, agent->contents[i]);
+            json_writer_end_object(w);
+        }
+        json_writer_end_array(w);
+        json_writer_key(w, "temperature");
+        json_writer_double(w, 0.7);
+        json_writer_key(w, "max_tokens");
+        json_writer_int(w, 100);
+        if (agent->candidate_count > 1) {
+            json_writer_key(w, "n");
+            json_writer_int(w, agent->candidate_count);
+        }
+        if (config->enable_streaming) {
+            json_writer_key(w, "stream");
+            json_writer_bool(w, 1);
+            // Streams report usage only when asked, in a last event of its own
+            json_writer_key(w, "stream_options");
+            json_writer_begin_object(w);
+            json_writer_key(w, "include_usage");
+            json_writer_bool(w, 1);
+            json_writer_end_object(w);
         }
-        strcat(messages, "]");
-        const char* model = config->llm.model[0] ? config->llm.model : "gpt-4.1-nano";
-        snprintf(out, size, "{\"model\":\"%s\",\"messages\":%s,\"temperature\":0.7,\"max_tokens\":100}", model, messages);
     }
+    json_writer_end_object(w);
 
-    return out;
+    return json_writer_finish(w);
 }
 
-static char* json_content(const char* response, char* out, size_t size) {
-    if (!response || !out) return NULL;
+// Timings of the last request made by the calling thread
+static __thread http_timings_t g_last_timings;
+
+// Response fields read by the streaming JSON reader
+enum {
+    TARGET_ERROR_MESSAGE = 0,
+    TARGET_OPENAI_PROMPT_TOKENS,
+    TARGET_OPENAI_CACHED_TOKENS,
+    TARGET_GEMINI_PROMPT_TOKENS,
+    TARGET_GEMINI_CACHED_TOKENS,
+    TARGET_OPENAI_CONTENT,                                  // One per candidate
+    TARGET_GEMINI_TEXT = TARGET_OPENAI_CONTENT + MAX_CANDIDATES,
+    TARGET_COUNT = TARGET_GEMINI_TEXT + MAX_CANDIDATES
+};
+
+static const char* const usage_paths[TARGET_OPENAI_CONTENT] = {
+    "error.message",
+    "usage.prompt_tokens",
+    "usage.prompt_tokens_details.cached_tokens",
+    "usageMetadata.promptTokenCount",
+    "usageMetadata.cachedContentTokenCount"
+};
+
+// One request to one provider, with everything it needs kept alive until the
+// transfer is done (hedged requests have two of these in flight)
+typedef struct {
+    const config_t* config;
+    char endpoint[512];
+    char auth_header[MAX_HEADER_LENGTH];
+    json_writer_t body;
+    http_request_t request;
+    http_response_t response;
+
+    json_stream_t json;
+    int json_error;
+    int candidate_count;
+    char content[MAX_CANDIDATES][MAX_CONTENT];
+    size_t content_len[MAX_CANDIDATES];
+    int content_done;
+    char error[256];
+    size_t error_len;
+    char number[32];
+    size_t number_len;
+    long prompt_tokens;   // -1 until the provider reports usage
+    long cached_tokens;
+
+    // Server-sent events state for streaming responses
+    char line[MAX_BUFFER];
+    size_t line_len;
+    int in_event;
+    int done;
+} llm_call_t;
+
+static void append_text(char* buffer, size_t size, size_t* len, const char* data, size_t data_len) {
+    if (*len + data_len >= size) data_len = size - *len - 1;
+    memcpy(buffer + *len, data, data_len);
+    *len += data_len;
+    buffer[*len] = '\0';
+}
+
+static int on_response_string(int target, const char* data, size_t len, int done, void* userdata) {
+    llm_call_t* call = (llm_call_t*)userdata;
 
-    // Try OpenAI format: choices[0].message.content
-    const char* choices = strstr(response, "\"choices\":");
-    if (choices) {
-        const char* message = strstr(choices, "\"message\":");
-        if (message) {
-            return json_find(message, "content", out, size);
+    if (target == TARGET_ERROR_MESSAGE) {
+        append_text(call->error, sizeof(call->error), &call->error_len, data, len);
+        return 0;
+    }
+
+    if (target < TARGET_OPENAI_CONTENT) {
+        append_text(call->number, sizeof(call->number), &call->number_len, data, len);
+        if (!done) return 0;
+
+        long value = strtol(call->number, NULL, 10);
+        call->number_len = 0;
+        if (target == TARGET_OPENAI_PROMPT_TOKENS || target == TARGET_GEMINI_PROMPT_TOKENS) {
+            call->prompt_tokens = value;
+        } else {
+            call->cached_tokens = value;
         }
+        return 0;
     }
 
-    // Try Gemini format: candidates[0].content.parts[0].text
-    const char* candidates = strstr(response, "\"candidates\":");
-    if (candidates) {
-        const char* content = strstr(candidates, "\"content\":");
-        if (content) {
-            const char* parts = strstr(content, "\"parts\":");
-            if (parts) {
-                char temp[1024];
-                if (json_find(parts, "text", temp, sizeof(temp))) {
-                    strncpy(out, temp, size - 1);
-                    out[size - 1] = '\0';
-                    return out;
-                }
-            }
+    int candidate = (target - TARGET_OPENAI_CONTENT) % MAX_CANDIDATES;
+    append_text(call->content[candidate], sizeof(call->content[candidate]),
+                &call->content_len[candidate], data, len);
+
+    if (!call->config->enable_streaming) {
+        // Read on to the usage block: it is a few bytes more, and ending the
+        // transfer early would also close the keep-alive connection
+        if (done && candidate == 0) call->content_done = 1;
+        return 0;
+    }
+
+    // Only the first line is used as the suggestion, so stop once it is
+    // complete; the usage event at the end is not worth waiting for
+    const char* text = call->content[0];
+    while (*text == ' ' || *text == '\n' || *text == '\r' || *text == '\t') text++;
+    if (*text && strchr(text, '\n')) {
+        call->content_done = 1;
+        return 1;
+    }
+    return 0;
+}
+
+// Feed response bytes to the JSON reader; 1 ends the transfer early
+static int feed_json(llm_call_t* call, const char* data, size_t len) {
+    if (call->json_error) return 0;
+
+    int result = json_stream_feed(&call->json, data, len);
+    if (result < 0) {
+        // Keep draining the body; the missing content is reported afterwards
+        call->json_error = 1;
+        return 0;
+    }
+    return result;
+}
+
+static int response_on_data(const char* data, size_t len, void* userdata) {
+    return feed_json((llm_call_t*)userdata, data, len);
+}
+
+static void sse_process_line(llm_call_t* call) {
+    char* line = call->line;
+    size_t len = call->line_len;
+    if (len > 0 && line[len - 1] == '\r') len--;
+    line[len] = '\0';
+    call->line_len = 0;
+
+    // A blank line terminates the event
+    if (len == 0) {
+        call->in_event = 0;
+        return;
+    }
+
+    if (strncmp(line, "data:", 5) != 0) return; // Ignore comments, event:, id:, retry:
+
+    const char* value = line + 5;
+    if (*value == ' ') value++;
+
+    if (!call->in_event) {
+        call->in_event = 1;
+        if (strcmp(value, "[DONE]") == 0) {
+            call->done = 1;
+            return;
         }
+        // Every event carries its own JSON document
+        json_stream_reset(&call->json);
+        call->json_error = 0;
+    } else {
+        feed_json(call, "\n", 1); // Multi-line data is joined with newlines
     }
 
-    return NULL;
+    if (feed_json(call, value, strlen(value)) == 1) {
+        call->done = 1;
+    }
 }
 
-static int http_request(const char* req, char* resp, size_t resp_size, const config_t* config) {
-    char temp[] = "/tmp/ai_req_XXXXXX";
-    int fd = mkstemp(temp);
-    if (fd == -1) return -1;
-    write(fd, req, strlen(req));
-    close(fd);
+static int sse_on_data(const char* data, size_t len, void* userdata) {
+    llm_call_t* call = (llm_call_t*)userdata;
 
-    // Build endpoint URL
-    char endpoint[512];
+    for (size_t i = 0; i < len && !call->done; i++) {
+        if (data[i] == '\n') {
+            sse_process_line(call);
+        } else if (call->line_len < sizeof(call->line) - 1) {
+            call->line[call->line_len++] = data[i];
+        }
+    }
+
+    return call->done ? 1 : 0;
+}
+
+void llm_build_endpoint(const config_t* config, char* endpoint, size_t size) {
     if (strcmp(config->llm.provider, "gemini") == 0) {
         const char* model = config->llm.model[0] ? config->llm.model : "gemini-2.0-flash";
         const char* base_url = config->llm.endpoint[0] ? config->llm.endpoint : "https://generativelanguage.googleapis.com/v1beta/models/";
-            snprintf(endpoint, sizeof(endpoint), "%s%s:generateContent", base_url, model);
+        if (config->enable_streaming) {
+            snprintf(endpoint, size, "%s%s:streamGenerateContent?alt=sse", base_url, model);
+        } else {
+            snprintf(endpoint, size, "%s%s:generateContent", base_url, model);
+        }
     } else {
         const char* base_url = config->llm.endpoint[0] ? config->llm.endpoint : "https://api.openai.com/v1/chat/completions";
-        strncpy(endpoint, base_url, sizeof(endpoint) - 1);
-        endpoint[sizeof(endpoint) - 1] = '\0';
+        strncpy(endpoint, base_url, size - 1);
+        endpoint[size - 1] = '\0';
     }
+}
 
-    char curl_template[MAX_BUFFER];
+static void build_auth_header(const config_t* config, char* header, size_t size) {
     if (strcmp(config->llm.provider, "gemini") == 0) {
-        snprintf(curl_template, sizeof(curl_template),
-                 "curl -s -X POST '%s' -H 'Content-Type: application/json' -H 'x-goog-api-key: %s' -d @'%s' --max-time 60",
-                 endpoint, config->llm.api_key, temp);
+        snprintf(header, size, "x-goog-api-key: %s", config->llm.api_key);
     } else {
-        snprintf(curl_template, sizeof(curl_template),
-                 "curl -s -X POST '%s' -H 'Content-Type: application/json' -H 'Authorization: Bearer %s' -d @'%s' --max-time 60",
-                 endpoint, config->llm.api_key, temp);
+        snprintf(header, size, "Authorization: Bearer %s", config->llm.api_key);
     }
-
-    FILE* pipe = popen(curl_template, "r");
-    if (!pipe) { unlink(temp); return -1; }
-
-    size_t bytes = fread(resp, 1, resp_size - 1, pipe);
-    resp[bytes] = '\0';
-    pclose(pipe);
-    unlink(temp);
-    return 0;
 }
 
-static int parse_llm_response(const char* response_json, suggestion_t* suggestion) {
-    if (!response_json || !suggestion) return -1;
-
-    char content[MAX_CONTENT];
-    if (!json_content(response_json, content, sizeof(content))) {
-        return -1;
-    }
+static int parse_suggestion_content(const char* content, suggestion_t* suggestion) {
+    while (*content == ' ' || *content == '\n' || *content == '\r' || *content == '\t') content++;
 
     if (strlen(content) > 0) {
         suggestion->type = content[0];
@@ -199,38 +322,350 @@ static int parse_llm_response(const char* response_json, suggestion_t* suggestio
     return -1;
 }
 
+static int llm_call_prepare(llm_call_t* call, const Agent* agent, const config_t* config) {
+    call->config = config;
+    call->candidate_count = agent->candidate_count;
+    if (json_writer_init(&call->body, LLM_REQUEST_INITIAL_SIZE) != 0) return -1;
+    const char* body = json_request(agent, config, &call->body);
+    if (!body) {
+        fprintf(stderr, "ERROR: llm_call_prepare: Failed to build request body\n");
+        return -1;
+    }
+
+    call->prompt_tokens = -1;
+    call->cached_tokens = 0;
+
+    // SSE chunks carry the OpenAI text under delta instead of message
+    char candidate_paths[2 * MAX_CANDIDATES][64];
+    const char* paths[TARGET_COUNT];
+    for (int i = 0; i < TARGET_OPENAI_CONTENT; i++) paths[i] = usage_paths[i];
+    for (int i = 0; i < MAX_CANDIDATES; i++) {
+        snprintf(candidate_paths[i], sizeof(candidate_paths[i]), "choices.%d.%s.content",
+                 i, config->enable_streaming ? "delta" : "message");
+        snprintf(candidate_paths[MAX_CANDIDATES + i], sizeof(candidate_paths[i]),
+                 "candidates.%d.content.parts.0.text", i);
+        paths[TARGET_OPENAI_CONTENT + i] = candidate_paths[i];
+        paths[TARGET_GEMINI_TEXT + i] = candidate_paths[MAX_CANDIDATES + i];
+    }
+    if (json_stream_init(&call->json, paths, TARGET_COUNT, on_response_string, call) != 0) return -1;
+
+    llm_build_endpoint(config, call->endpoint, sizeof(call->endpoint));
+    build_auth_header(config, call->auth_header, sizeof(call->auth_header));
+
+    // The response is parsed as it arrives; the body is never buffered
+    http_request_t* request = &call->request;
+    request->url = call->endpoint;
+    request->timeout_ms = provider_health_timeout_ms(config->llm.provider);
+    request->headers[request->header_count++] = call->auth_header;
+    request->body = body;
+    request->on_data = response_on_data;
+    request->userdata = call;
+
+    if (config->enable_streaming) {
+        request->headers[request->header_count++] = "Accept: text/event-stream";
+        request->on_data = sse_on_data;
+    }
+    return 0;
+}
+
+// A '+' completion that does not extend the input breaks the prompt rules
+static int follows_input(const suggestion_t* suggestion, const char* input) {
+    return suggestion->type == '=' || starts_with(suggestion->suggestion, input);
+}
+
+// Merge duplicate candidates and order them by how many samples agreed,
+// then by whether they follow the rules, then by the provider's order
+static int rank_candidates(suggestion_t* candidates, int count, const char* input) {
+    int votes[MAX_CANDIDATES] = {0};
+    int unique = 0;
+
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(candidates[i].suggestion);
+        while (len > 0 && isspace((unsigned char)candidates[i].suggestion[len - 1])) {
+            candidates[i].suggestion[--len] = '\0';
+        }
+        if (len == 0) continue;
+
+        int duplicate = -1;
+        for (int j = 0; j < unique; j++) {
+            if (candidates[j].type == candidates[i].type &&
+                strcmp(candidates[j].suggestion, candidates[i].suggestion) == 0) {
+                duplicate = j;
+                break;
+            }
+        }
+        if (duplicate >= 0) {
+            votes[duplicate]++;
+            continue;
+        }
+        if (unique != i) candidates[unique] = candidates[i];
+        votes[unique++] = 1;
+    }
+
+    // Insertion sort: a handful of entries, and it keeps equal ones in order
+    for (int i = 1; i < unique; i++) {
+        suggestion_t current = candidates[i];
+        int current_votes = votes[i];
+        int current_follows = follows_input(&current, input);
+
+        int j = i - 1;
+        while (j >= 0 && (votes[j] < current_votes ||
+                          (votes[j] == current_votes && current_follows &&
+                           !follows_input(&candidates[j], input)))) {
+            candidates[j + 1] = candidates[j];
+            votes[j + 1] = votes[j];
+            j--;
+        }
+        candidates[j + 1] = current;
+        votes[j + 1] = current_votes;
+    }
+    return unique;
+}
+
+// Returns the number of distinct suggestions, or -1 if there are none
+static int llm_call_finish(llm_call_t* call, const char* input, suggestion_t* suggestions, int max_suggestions) {
+    http_response_t* response = &call->response;
+
+    if (call->config->enable_streaming && call->line_len > 0 && !call->done) {
+        // Flush a trailing line if the server closed without a newline
+        sse_process_line(call);
+    }
+
+    if (call->error_len > 0) {
+        fprintf(stderr, "ERROR: send_to_llm: Provider error: %s\n", call->error);
+    }
+
+    if (response->status >= 400) {
+        fprintf(stderr, "ERROR: send_to_llm: HTTP status %ld\n", response->status);
+        return -1;
+    }
+
+    suggestion_t candidates[MAX_CANDIDATES];
+    int count = 0;
+    for (int i = 0; i < call->candidate_count; i++) {
+        if (parse_suggestion_content(call->content[i], &candidates[count]) == 0) count++;
+    }
+    count = rank_candidates(candidates, count, input);
+
+    if (count == 0) {
+        fprintf(stderr, "ERROR: send_to_llm: %s\n", call->json_error ? "Failed to parse response" : "Empty response");
+        return -1;
+    }
+
+    if (count > max_suggestions) count = max_suggestions;
+    memcpy(suggestions, candidates, (size_t)count * sizeof(suggestion_t));
+    return count;
+}
+
+static hedge_stats_t g_hedge_stats;
+static prompt_cache_stats_t g_prompt_cache_stats;
+static cancel_stats_t g_cancel_stats;
+static pthread_mutex_t g_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void llm_get_hedge_stats(hedge_stats_t *stats) {
+    if (!stats) return;
+
+    pthread_mutex_lock(&g_stats_lock);
+    *stats = g_hedge_stats;
+    pthread_mutex_unlock(&g_stats_lock);
+}
+
+void llm_get_prompt_cache_stats(prompt_cache_stats_t *stats) {
+    if (!stats) return;
+
+    pthread_mutex_lock(&g_stats_lock);
+    *stats = g_prompt_cache_stats;
+    pthread_mutex_unlock(&g_stats_lock);
+}
+
+void llm_get_cancel_stats(cancel_stats_t *stats) {
+    if (!stats) return;
+
+    pthread_mutex_lock(&g_stats_lock);
+    *stats = g_cancel_stats;
+    pthread_mutex_unlock(&g_stats_lock);
+}
+
+static void record_cancel(const Agent* agent, int legs, uint64_t elapsed_ms) {
+    int tokens = 0;
+    for (int i = 0; i < agent->msg_count; i++) {
+        tokens += prompt_estimate_tokens(agent->contents[i], strlen(agent->contents[i]));
+    }
+
+    pthread_mutex_lock(&g_stats_lock);
+    g_cancel_stats.cancelled++;
+    g_cancel_stats.wasted_ms += (unsigned long)elapsed_ms;
+    g_cancel_stats.wasted_prompt_tokens += (unsigned long)tokens * (unsigned long)legs;
+    pthread_mutex_unlock(&g_stats_lock);
+}
+
+static void record_prompt_usage(const llm_call_t* call) {
+    if (call->prompt_tokens < 0) return;
+
+    pthread_mutex_lock(&g_stats_lock);
+    g_prompt_cache_stats.responses++;
+    g_prompt_cache_stats.prompt_tokens += (unsigned long)call->prompt_tokens;
+    if (call->cached_tokens > 0) {
+        g_prompt_cache_stats.cache_hits++;
+        g_prompt_cache_stats.cached_tokens += (unsigned long)call->cached_tokens;
+    }
+    pthread_mutex_unlock(&g_stats_lock);
+}
+
+static int hedge_delay_ms(const config_t* config) {
+    double p95;
+    if (config->hedge.adaptive && provider_health_percentile(config->llm.provider, 95.0, &p95) == 0) {
+        return (int)p95;
+    }
+    return config->hedge.delay_ms;
+}
+
+int llm_get_last_timings(http_timings_t *timings) {
+    if (!timings) return -1;
+    *timings = g_last_timings;
+    return 0;
+}
+
+static int request_suggestions(const char *input, const session_context_t *ctx, const config_t *config,
+                               suggestion_t *suggestions, int max_suggestions, const volatile int *cancel);
+
 int send_to_llm(const char *input, const session_context_t *ctx, const config_t *config, suggestion_t *suggestion) {
-    if (!input || !ctx || !config || !suggestion) return -1;
+    return request_suggestions(input, ctx, config, suggestion, 1, NULL) > 0 ? 0 : -1;
+}
 
-    memset(suggestion, 0, sizeof(suggestion_t));
+int send_to_llm_cancellable(const char *input, const session_context_t *ctx, const config_t *config,
+                            suggestion_t *suggestion, const volatile int *cancel) {
+    return request_suggestions(input, ctx, config, suggestion, 1, cancel) > 0 ? 0 : -1;
+}
 
-    Agent agent = {0};
+int send_to_llm_candidates(const char *input, const session_context_t *ctx, const config_t *config,
+                           suggestion_t *suggestions, int max_suggestions) {
+    return request_suggestions(input, ctx, config, suggestions, max_suggestions, NULL);
+}
 
-    char system_prompt[MAX_CONTENT];
-    build_system_prompt(system_prompt, sizeof(system_prompt), ctx);
+// A set cancel flag aborts the transfer; the request then fails without
+// counting against the provider
+static int request_suggestions(const char *input, const session_context_t *ctx, const config_t *config,
+                               suggestion_t *suggestions, int max_suggestions, const volatile int *cancel) {
+    if (!input || !ctx || !config || !suggestions || max_suggestions <= 0) return -1;
 
-    strcpy(agent.roles[0], "system");
-    strncpy(agent.contents[0], system_prompt, MAX_CONTENT - 1);
-    agent.contents[0][MAX_CONTENT - 1] = '\0';
+    memset(suggestions, 0, (size_t)max_suggestions * sizeof(suggestion_t));
+
+    char* user_message = build_user_message(input, ctx, config);
+    if (!user_message) return -1;
+
+    Agent agent = {0};
+    agent.roles[0] = "system";
+    agent.contents[0] = prompt_system_instructions();
     agent.msg_count = 1;
 
-    strcpy(agent.roles[agent.msg_count], "user");
-    strncpy(agent.contents[agent.msg_count], input, MAX_CONTENT - 1);
-    agent.contents[agent.msg_count][MAX_CONTENT - 1] = '\0';
+    agent.roles[agent.msg_count] = "user";
+    agent.contents[agent.msg_count] = user_message;
     agent.msg_count++;
 
-    char req[MAX_BUFFER], resp[MAX_BUFFER];
-    json_request(&agent, config, req, sizeof(req));
+    // Streaming returns on the first line of a single completion, so extra
+    // candidates are only requested for complete responses
+    agent.candidate_count = max_suggestions < MAX_CANDIDATES ? max_suggestions : MAX_CANDIDATES;
+    if (config->enable_streaming) agent.candidate_count = 1;
+
+    // Providers whose circuit is open are skipped: the hedge provider doubles
+    // as the fallback, and with neither available the request fails fast
+    const llm_config_t* fallback = &config->hedge.llm;
+    int has_fallback = fallback->provider[0] && strcmp(fallback->provider, config->llm.provider) != 0;
+    int use_primary = provider_health_allow(config->llm.provider) == 0;
+    int use_secondary = has_fallback && (config->hedge.enabled || !use_primary) &&
+                        provider_health_allow(fallback->provider) == 0;
+
+    if (!use_primary && !use_secondary) {
+        fprintf(stderr, "ERROR: send_to_llm: Circuit open for provider %s\n", config->llm.provider);
+        free(user_message);
+        return -1;
+    }
 
-    if (http_request(req, resp, sizeof(resp), config)) {
-        fprintf(stderr, "ERROR: send_to_llm: HTTP request failed\n");
+    llm_call_t* calls = calloc(2, sizeof(llm_call_t));
+    config_t* secondary = use_secondary ? malloc(sizeof(config_t)) : NULL;
+    if (!calls || (use_secondary && !secondary)) {
+        free(calls);
+        free(secondary);
+        free(user_message);
+        if (use_primary) provider_health_release(config->llm.provider);
+        if (use_secondary) provider_health_release(fallback->provider);
         return -1;
     }
 
-    int result = parse_llm_response(resp, suggestion);
-    if (result != 0) {
-        fprintf(stderr, "ERROR: send_to_llm: Failed to parse response\n");
+    int prepared = !use_primary || llm_call_prepare(&calls[0], &agent, config) == 0;
+    if (use_secondary) {
+        // Same prompt, same options, the other provider
+        *secondary = *config;
+        secondary->llm = *fallback;
+        prepared = llm_call_prepare(&calls[1], &agent, secondary) == 0 && prepared;
     }
 
+    calls[0].request.cancel = cancel;
+    calls[1].request.cancel = cancel;
+
+    int sent[2] = { 0, 0 };
+    int winner = use_primary ? 0 : 1;
+    int http_result = -1;
+    uint64_t started_ms = monotonic_ms();
+    if (!prepared) {
+        // Nothing was sent; the error has been reported
+    } else if (use_primary && use_secondary) {
+        int secondary_sent = 0;
+        http_result = http_post_hedged(&calls[0].request, &calls[1].request, hedge_delay_ms(config),
+                                       &calls[0].response, &calls[1].response, &winner, &secondary_sent);
+        sent[0] = 1;
+        sent[1] = secondary_sent;
+
+        pthread_mutex_lock(&g_stats_lock);
+        g_hedge_stats.requests++;
+        if (secondary_sent) g_hedge_stats.hedged++;
+        if (http_result == 0 && winner == 1) g_hedge_stats.secondary_wins++;
+        pthread_mutex_unlock(&g_stats_lock);
+    } else {
+        if (!use_primary) {
+            fprintf(stderr, "ERROR: send_to_llm: Circuit open for provider %s, using %s\n",
+                    config->llm.provider, fallback->provider);
+        }
+        sent[winner] = 1;
+        http_result = http_post(&calls[winner].request, &calls[winner].response);
+    }
+
+    int result = -1;
+    if (http_result == 0) {
+        llm_call_t* call = &calls[winner];
+        g_last_timings = call->response.timings;
+        result = llm_call_finish(call, input, suggestions, max_suggestions);
+        record_prompt_usage(call);
+    } else if (calls[0].response.cancelled || calls[1].response.cancelled) {
+        record_cancel(&agent, sent[0] + sent[1], monotonic_ms() - started_ms);
+    } else if (prepared) {
+        g_last_timings = calls[winner].response.timings;
+        fprintf(stderr, "ERROR: send_to_llm: HTTP request failed\n");
+    }
+
+    // Feed the outcome of every request that went out back into provider health
+    for (int i = 0; i < 2; i++) {
+        const char* provider = calls[i].config ? calls[i].config->llm.provider : NULL;
+        if (!provider) continue;
+
+        const http_response_t* response = &calls[i].response;
+        if (sent[i] && !response->cancelled &&
+            (response->failed || response->status == 429 || response->status >= 500)) {
+            provider_health_record_failure(provider, response->timed_out);
+        } else if (sent[i] && i == winner && http_result == 0 && result > 0) {
+            provider_health_record_success(provider, response->timings.total_ms);
+        } else {
+            provider_health_release(provider);
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        http_response_free(&calls[i].response);
+        json_writer_free(&calls[i].body);
+    }
+    free(calls);
+    free(secondary);
+    free(user_message);
     return result;
 }
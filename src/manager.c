@@ -104,6 +104,39 @@ int cmd_status() {
             printf("Session: %s\n", info.paths.session_id);
             printf("Socket: %s\n", info.paths.socket_path);
             printf("Status: Running\n");
+
+            // Circuit breaker state and latency of each provider used so far
+            char health[4096];
+            if (send_daemon_request(info.paths.socket_path, "health", health, sizeof(health)) > 0 &&
+                strcmp(health, "none") != 0 && strncmp(health, "error:", 6) != 0) {
+                printf("Provider health:\n");
+                char *saveptr = NULL;
+                for (char *line = strtok_r(health, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+                    printf("  %s\n", line);
+                }
+            }
+
+            // Warm-up state of the connections to those providers
+            char connections[4096];
+            if (send_daemon_request(info.paths.socket_path, "connections", connections, sizeof(connections)) > 0 &&
+                strcmp(connections, "none") != 0 && strncmp(connections, "error:", 6) != 0) {
+                printf("Provider connections:\n");
+                char *saveptr = NULL;
+                for (char *line = strtok_r(connections, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+                    printf("  %s\n", line);
+                }
+            }
+
+            // Shells publishing to the daemon through shared memory
+            char shells[4096];
+            if (send_daemon_request(info.paths.socket_path, "shells", shells, sizeof(shells)) > 0 &&
+                strcmp(shells, "none") != 0 && strncmp(shells, "error:", 6) != 0) {
+                printf("Shell channels:\n");
+                char *saveptr = NULL;
+                for (char *line = strtok_r(shells, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+                    printf("  %s\n", line);
+                }
+            }
         } else {
             printf("Daemon is not running (will start on demand)\n");
         }
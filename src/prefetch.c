@@ -0,0 +1,330 @@
+#define _GNU_SOURCE
+#include "smart_cmd.h"
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+/*
+ * Speculative Prefetch
+ *
+ * The shell reports the current command line after a typing pause and the
+ * daemon starts a low-priority LLM request for it in the background. A later
+ * Ctrl+O on the same input, or on an input that extends it and still matches
+ * a '+' completion, is answered from that in-flight or finished request.
+ *
+ * Each shell has a prefetch slot of its own (PREFETCH_SLOTS in all), found
+ * by its owner: the shell the client names, or the connection of a client
+ * that names none. A newer prefetch from the same shell supersedes the older
+ * one, and a result that was never consumed is counted as wasted. A
+ * superseded request that is still in flight is aborted on the spot rather
+ * than left to finish, and so is one the shell cancels (Esc dismisses the
+ * line). A shell that needs a slot when all are taken gets the one used
+ * longest ago that is not busy with a request.
+ *
+ * Every slot has its own thread, started on first use, so one shell's
+ * prefetch never waits behind another's, and neither does a lookup.
+ *
+ * A prefetch belongs to the context it was made in (the fingerprint of the
+ * directory, git HEAD and recent commands): a lookup from another context
+ * misses, and so does one after PREFETCH_RESULT_TTL_MS. A result answers
+ * one lookup; the slot is idle again once it has been used.
+ */
+
+typedef enum {
+    PREFETCH_IDLE = 0,
+    PREFETCH_PENDING,
+    PREFETCH_RUNNING,
+    PREFETCH_DONE,
+    PREFETCH_FAILED
+} prefetch_state_t;
+
+typedef struct {
+    pthread_cond_t cond;  // Signalled when the state changes
+    pthread_t thread;
+    int thread_started;
+
+    uint64_t owner;       // 0 while the slot has never been used
+    uint64_t used_ms;     // Last start or lookup, to pick a slot to reuse
+    prefetch_state_t state;
+    volatile int cancel;  // Aborts the running request
+    uint64_t context_key;
+    uint64_t finished_ms; // When the result arrived
+    char input[MAX_INPUT_LEN];
+    session_context_t ctx;
+    config_t config;
+    suggestion_t result;
+} prefetch_slot_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    int shutdown;
+    prefetch_slot_t slots[PREFETCH_SLOTS];
+    prefetch_stats_t stats;
+} prefetch_t;
+
+static prefetch_t g_prefetch = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void *prefetch_thread_main(void *arg) {
+    prefetch_slot_t *slot = arg;
+
+    // Background work must not compete with interactive requests
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), PREFETCH_THREAD_NICE);
+
+    // Job buffers live on the heap; session_context_t and config_t are large
+    char *input = malloc(MAX_INPUT_LEN);
+    session_context_t *ctx = malloc(sizeof(session_context_t));
+    config_t *config = malloc(sizeof(config_t));
+    if (!input || !ctx || !config) {
+        free(input);
+        free(ctx);
+        free(config);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&g_prefetch.lock);
+    while (!g_prefetch.shutdown) {
+        if (slot->state != PREFETCH_PENDING) {
+            pthread_cond_wait(&slot->cond, &g_prefetch.lock);
+            continue;
+        }
+
+        slot->state = PREFETCH_RUNNING;
+        slot->cancel = 0;
+        uint64_t owner = slot->owner;
+        memcpy(input, slot->input, MAX_INPUT_LEN);
+        memcpy(ctx, &slot->ctx, sizeof(session_context_t));
+        memcpy(config, &slot->config, sizeof(config_t));
+        pthread_mutex_unlock(&g_prefetch.lock);
+
+        suggestion_t suggestion;
+        int result = send_to_llm_cancellable(input, ctx, config, &suggestion, &slot->cancel);
+
+        pthread_mutex_lock(&g_prefetch.lock);
+        if (slot->state == PREFETCH_RUNNING && slot->owner == owner && strcmp(slot->input, input) == 0) {
+            slot->result = suggestion;
+            slot->finished_ms = monotonic_ms();
+            slot->state = (result == 0) ? PREFETCH_DONE : PREFETCH_FAILED;
+        } else {
+            // Superseded or cancelled while the request was in flight
+            g_prefetch.stats.wasted++;
+        }
+        pthread_cond_broadcast(&slot->cond);
+    }
+    pthread_mutex_unlock(&g_prefetch.lock);
+
+    free(input);
+    free(ctx);
+    free(config);
+    return NULL;
+}
+
+static int prefetch_expired(const prefetch_slot_t *slot, uint64_t now) {
+    return slot->state == PREFETCH_DONE && now - slot->finished_ms >= PREFETCH_RESULT_TTL_MS;
+}
+
+static prefetch_slot_t *slot_find(uint64_t owner) {
+    for (int i = 0; i < PREFETCH_SLOTS; i++) {
+        if (g_prefetch.slots[i].owner == owner) return &g_prefetch.slots[i];
+    }
+    return NULL;
+}
+
+// The owner's slot, or one to give it: never used, else the one used longest
+// ago without a request in flight. NULL when every slot is busy.
+static prefetch_slot_t *slot_claim(uint64_t owner) {
+    prefetch_slot_t *slot = slot_find(owner);
+    if (slot) return slot;
+
+    for (int i = 0; i < PREFETCH_SLOTS; i++) {
+        prefetch_slot_t *candidate = &g_prefetch.slots[i];
+        if (candidate->owner == 0) {
+            slot = candidate;
+            break;
+        }
+        if (candidate->state == PREFETCH_PENDING || candidate->state == PREFETCH_RUNNING) continue;
+        if (!slot || candidate->used_ms < slot->used_ms) slot = candidate;
+    }
+    if (!slot) return NULL;
+
+    if (!slot->thread_started) {
+        pthread_cond_init(&slot->cond, NULL);
+        if (pthread_create(&slot->thread, NULL, prefetch_thread_main, slot) != 0) {
+            pthread_cond_destroy(&slot->cond);
+            fprintf(stderr, "ERROR: prefetch_start: Failed to create prefetch thread\n");
+            return NULL;
+        }
+        slot->thread_started = 1;
+    }
+
+    // A result the previous owner never asked for
+    if (slot->state == PREFETCH_DONE) g_prefetch.stats.wasted++;
+    slot->state = PREFETCH_IDLE;
+    slot->owner = owner;
+    return slot;
+}
+
+int prefetch_start(uint64_t owner, const char *input, uint64_t context_key,
+                   const session_context_t *ctx, const config_t *config) {
+    if (owner == 0 || !input || !ctx || !config || strlen(input) == 0) return -1;
+
+    pthread_mutex_lock(&g_prefetch.lock);
+
+    prefetch_slot_t *slot = slot_claim(owner);
+    if (!slot) {
+        pthread_mutex_unlock(&g_prefetch.lock);
+        return -1;
+    }
+    uint64_t now = monotonic_ms();
+    slot->used_ms = now;
+
+    // Same input already prefetched or in flight here: nothing to do
+    if (slot->state != PREFETCH_IDLE && slot->state != PREFETCH_FAILED &&
+        slot->context_key == context_key && strcmp(slot->input, input) == 0 &&
+        !prefetch_expired(slot, now)) {
+        pthread_mutex_unlock(&g_prefetch.lock);
+        return 0;
+    }
+
+    if (slot->state == PREFETCH_DONE || slot->state == PREFETCH_PENDING) {
+        g_prefetch.stats.wasted++;
+    }
+
+    if (slot->state == PREFETCH_RUNNING) {
+        slot->cancel = 1;
+        g_prefetch.stats.cancelled++;
+    }
+
+    safe_string_copy(slot->input, input, sizeof(slot->input));
+    slot->ctx = *ctx;
+    slot->config = *config;
+    slot->context_key = context_key;
+    // The aborted request sees the input change and drops its result;
+    // the new one starts as soon as it has returned
+    slot->state = PREFETCH_PENDING;
+    g_prefetch.stats.requests++;
+
+    pthread_cond_broadcast(&slot->cond);
+    pthread_mutex_unlock(&g_prefetch.lock);
+    return 0;
+}
+
+static int prefetch_matches(const prefetch_slot_t *slot, const char *input, uint64_t context_key) {
+    if (slot->context_key != context_key) return 0;
+    if (strcmp(slot->input, input) == 0) return 1;
+    return starts_with(input, slot->input);
+}
+
+int prefetch_lookup(uint64_t owner, const char *input, uint64_t context_key, suggestion_t *suggestion, int wait_ms) {
+    if (!input || !suggestion) return -1;
+
+    pthread_mutex_lock(&g_prefetch.lock);
+
+    prefetch_slot_t *slot = owner != 0 ? slot_find(owner) : NULL;
+    if (!slot) {
+        g_prefetch.stats.misses++;
+        pthread_mutex_unlock(&g_prefetch.lock);
+        return -1;
+    }
+    slot->used_ms = monotonic_ms();
+
+    // A result nobody asked for in time is dropped
+    if (prefetch_expired(slot, slot->used_ms)) {
+        slot->state = PREFETCH_IDLE;
+        g_prefetch.stats.wasted++;
+    }
+
+    if (slot->state == PREFETCH_IDLE || !prefetch_matches(slot, input, context_key)) {
+        g_prefetch.stats.misses++;
+        pthread_mutex_unlock(&g_prefetch.lock);
+        return -1;
+    }
+
+    // Wait for the in-flight request instead of starting a second one
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += wait_ms / 1000;
+    deadline.tv_nsec += (long)(wait_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    while ((slot->state == PREFETCH_PENDING || slot->state == PREFETCH_RUNNING) &&
+           slot->owner == owner && prefetch_matches(slot, input, context_key)) {
+        if (pthread_cond_timedwait(&slot->cond, &g_prefetch.lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    int exact = strcmp(slot->input, input) == 0;
+    int usable = slot->owner == owner && slot->state == PREFETCH_DONE &&
+                 prefetch_matches(slot, input, context_key);
+
+    // An extended prefix can only reuse a completion that still covers it
+    if (usable && !exact) {
+        usable = slot->result.type == '+' &&
+                 starts_with(slot->result.suggestion, input);
+    }
+
+    if (usable) {
+        *suggestion = slot->result;
+        slot->state = PREFETCH_IDLE;
+        g_prefetch.stats.hits++;
+    } else {
+        g_prefetch.stats.misses++;
+    }
+
+    pthread_mutex_unlock(&g_prefetch.lock);
+    return usable ? 0 : -1;
+}
+
+// Drop the owner's pending or running prefetch; -1 when there is none
+int prefetch_cancel(uint64_t owner) {
+    pthread_mutex_lock(&g_prefetch.lock);
+
+    int result = -1;
+    prefetch_slot_t *slot = owner != 0 ? slot_find(owner) : NULL;
+    if (slot && slot->state == PREFETCH_RUNNING) {
+        // The thread finds the slot idle when the request returns and counts it as wasted
+        slot->cancel = 1;
+        g_prefetch.stats.cancelled++;
+        slot->state = PREFETCH_IDLE;
+        result = 0;
+    } else if (slot && slot->state == PREFETCH_PENDING) {
+        slot->state = PREFETCH_IDLE;
+        g_prefetch.stats.wasted++;
+        result = 0;
+    }
+
+    if (slot) pthread_cond_broadcast(&slot->cond);
+    pthread_mutex_unlock(&g_prefetch.lock);
+    return result;
+}
+
+void prefetch_get_stats(prefetch_stats_t *stats) {
+    if (!stats) return;
+
+    pthread_mutex_lock(&g_prefetch.lock);
+    *stats = g_prefetch.stats;
+    pthread_mutex_unlock(&g_prefetch.lock);
+}
+
+void prefetch_shutdown(void) {
+    pthread_mutex_lock(&g_prefetch.lock);
+    g_prefetch.shutdown = 1;
+    for (int i = 0; i < PREFETCH_SLOTS; i++) {
+        if (g_prefetch.slots[i].thread_started) pthread_cond_broadcast(&g_prefetch.slots[i].cond);
+    }
+    pthread_mutex_unlock(&g_prefetch.lock);
+
+    for (int i = 0; i < PREFETCH_SLOTS; i++) {
+        prefetch_slot_t *slot = &g_prefetch.slots[i];
+        if (!slot->thread_started) continue;
+        pthread_join(slot->thread, NULL);
+        pthread_cond_destroy(&slot->cond);
+        slot->thread_started = 0;
+    }
+}
@@ -0,0 +1,211 @@
+#define _GNU_SOURCE
+#include "smart_cmd.h"
+#include <pthread.h>
+
+/*
+ * Prefix Index
+ *
+ * Trie over the inputs of recent '+' completions. When the model answered
+ * "git com" with "+git commit --amend", typing on to "git commi" is still
+ * covered by that completion, so the daemon can answer locally instead of
+ * sending a new request. A stored completion is only reused when it was made
+ * in the same context (cwd, git HEAD), its input is a prefix of the current
+ * input and the completion itself still extends the current input.
+ * '=' suggestions replace the command line and are never indexed.
+ *
+ * The index is bounded: entries live in a ring and the oldest one is
+ * replaced first; trie nodes come from a fixed pool that is rebuilt from the
+ * live entries when it runs out.
+ */
+
+#define PREFIX_INDEX_MAX_ENTRIES 64
+#define PREFIX_INDEX_MAX_NODES 4096
+
+typedef struct {
+    int first_child;
+    int next_sibling;
+    int entries;        // Most recent entry whose input ends at this node
+    unsigned char ch;
+} trie_node_t;
+
+typedef struct {
+    int used;
+    uint64_t context;
+    uint64_t expires_ms;
+    char input[MAX_INPUT_LEN];
+    suggestion_t suggestion;
+    int node;
+    int node_next;      // Next entry ending at the same node
+} prefix_entry_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    trie_node_t nodes[PREFIX_INDEX_MAX_NODES];
+    int node_count;
+    prefix_entry_t entries[PREFIX_INDEX_MAX_ENTRIES];
+    int next_entry;
+    prefix_index_stats_t stats;
+} prefix_index_t;
+
+static prefix_index_t g_index = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int node_alloc(unsigned char ch) {
+    if (g_index.node_count >= PREFIX_INDEX_MAX_NODES) return -1;
+
+    int index = g_index.node_count++;
+    trie_node_t *node = &g_index.nodes[index];
+    node->first_child = -1;
+    node->next_sibling = -1;
+    node->entries = -1;
+    node->ch = ch;
+    return index;
+}
+
+static void trie_reset(void) {
+    g_index.node_count = 0;
+    node_alloc(0); // Root
+}
+
+static int trie_child(int parent, unsigned char ch, int create) {
+    int child = g_index.nodes[parent].first_child;
+    while (child != -1 && g_index.nodes[child].ch != ch) {
+        child = g_index.nodes[child].next_sibling;
+    }
+
+    if (child == -1 && create) {
+        child = node_alloc(ch);
+        if (child != -1) {
+            g_index.nodes[child].next_sibling = g_index.nodes[parent].first_child;
+            g_index.nodes[parent].first_child = child;
+        }
+    }
+    return child;
+}
+
+// Returns the node for input, creating the path; -1 when the pool is full
+static int trie_insert_path(const char *input) {
+    int node = 0;
+    for (const unsigned char *p = (const unsigned char *)input; *p && node != -1; p++) {
+        node = trie_child(node, *p, 1);
+    }
+    return node;
+}
+
+static void entry_unlink(int index) {
+    prefix_entry_t *entry = &g_index.entries[index];
+    if (!entry->used || entry->node == -1) return;
+
+    int *link = &g_index.nodes[entry->node].entries;
+    while (*link != -1 && *link != index) link = &g_index.entries[*link].node_next;
+    if (*link == index) *link = entry->node_next;
+    entry->node = -1;
+}
+
+static int entry_link(int index) {
+    prefix_entry_t *entry = &g_index.entries[index];
+    int node = trie_insert_path(entry->input);
+    if (node == -1) return -1;
+
+    entry->node = node;
+    entry->node_next = g_index.nodes[node].entries;
+    g_index.nodes[node].entries = index;
+    return 0;
+}
+
+// Drop nodes left behind by replaced entries and relink the live ones
+static void trie_rebuild(void) {
+    trie_reset();
+    for (int i = 0; i < PREFIX_INDEX_MAX_ENTRIES; i++) {
+        prefix_entry_t *entry = &g_index.entries[i];
+        if (!entry->used) continue;
+        entry->node = -1;
+        if (entry_link(i) != 0) entry->used = 0;
+    }
+}
+
+void prefix_index_put(uint64_t context, const char *input, const suggestion_t *suggestion, int ttl_ms) {
+    if (!input || !suggestion || input[0] == '\0' || ttl_ms <= 0) return;
+    if (suggestion->type != '+' || !starts_with(suggestion->suggestion, input)) return;
+
+    pthread_mutex_lock(&g_index.lock);
+    if (g_index.node_count == 0) trie_reset();
+
+    // Replace the oldest entry
+    int index = g_index.next_entry;
+    g_index.next_entry = (g_index.next_entry + 1) % PREFIX_INDEX_MAX_ENTRIES;
+    entry_unlink(index);
+
+    prefix_entry_t *entry = &g_index.entries[index];
+    entry->used = 1;
+    entry->context = context;
+    entry->expires_ms = monotonic_ms() + (uint64_t)ttl_ms;
+    safe_string_copy(entry->input, input, sizeof(entry->input));
+    entry->suggestion = *suggestion;
+    entry->node = -1;
+
+    if (entry_link(index) != 0) {
+        trie_rebuild();
+        if (entry->used && entry->node == -1 && entry_link(index) != 0) {
+            entry->used = 0;
+        }
+    }
+
+    pthread_mutex_unlock(&g_index.lock);
+}
+
+int prefix_index_lookup(uint64_t context, const char *input, suggestion_t *suggestion) {
+    if (!input || !suggestion || input[0] == '\0') return -1;
+
+    pthread_mutex_lock(&g_index.lock);
+    if (g_index.node_count == 0) {
+        g_index.stats.misses++;
+        pthread_mutex_unlock(&g_index.lock);
+        return -1;
+    }
+
+    uint64_t now = monotonic_ms();
+    size_t input_len = strlen(input);
+    int best = -1;
+
+    // Every node on the path of input is a stored input that input extends;
+    // the deepest usable one is the most specific completion
+    int node = 0;
+    for (const unsigned char *p = (const unsigned char *)input; *p; p++) {
+        node = trie_child(node, *p, 0);
+        if (node == -1) break;
+
+        for (int e = g_index.nodes[node].entries; e != -1; e = g_index.entries[e].node_next) {
+            prefix_entry_t *entry = &g_index.entries[e];
+            if (entry->context != context || entry->expires_ms <= now) continue;
+            if (!starts_with(entry->suggestion.suggestion, input)) continue;
+            if (strlen(entry->suggestion.suggestion) <= input_len) continue; // Nothing left to add
+
+            best = e;
+            break; // Entries at a node are newest first
+        }
+    }
+
+    if (best != -1) {
+        *suggestion = g_index.entries[best].suggestion;
+        g_index.stats.hits++;
+    } else {
+        g_index.stats.misses++;
+    }
+
+    pthread_mutex_unlock(&g_index.lock);
+    return best != -1 ? 0 : -1;
+}
+
+void prefix_index_get_stats(prefix_index_stats_t *stats) {
+    if (!stats) return;
+
+    pthread_mutex_lock(&g_index.lock);
+    *stats = g_index.stats;
+    stats->entries = 0;
+    for (int i = 0; i < PREFIX_INDEX_MAX_ENTRIES; i++) {
+        if (g_index.entries[i].used) stats->entries++;
+    }
+    pthread_mutex_unlock(&g_index.lock);
+}
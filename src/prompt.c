@@ -0,0 +1,223 @@
+#define _GNU_SOURCE
+#include "smart_cmd.h"
+
+/*
+ * Prompt Assembly
+ *
+ * Every context source (command history, PTY output, environment, git) is
+ * fitted into its own token budget before it goes into the prompt, so the
+ * prompt size, and with it provider latency and cost, stays bounded by
+ * config.json no matter how much the terminal has printed.
+ *
+ * Tokens are estimated with a byte-class counter that approximates BPE
+ * tokenizers: short words are one token and long ones about four bytes per
+ * token, digits go in groups of three, punctuation is mostly one token per
+ * byte, and every non-ASCII code point is counted as a token. It errs on the
+ * high side for typical terminal output, which is what a budget needs.
+ *
+ * Providers cache prompts by their leading tokens, so the instructions are a
+ * constant that always comes first and is byte-identical across requests;
+ * everything that changes goes after it, in the user message.
+ */
+
+static const char system_instructions[] =
+    "You are an AI command-line assistant. Your goal is to complete the user's command or suggest the next one.\n\n"
+    "The user message holds the CONTEXT of the terminal session, followed by the INPUT typed so far.\n\n"
+    "RULES:\n"
+    "1. Your response must be a single command-line suggestion.\n"
+    "2. If you are completing the user's partial command, your response MUST start with '+' followed by the ENTIRE completed command. Example: If the user input is 'git commi', your response should be '+git commit'.\n"
+    "3. If you are suggesting a new command (not a completion of partial input), your response MUST start with '='. Example: '=git status'.\n"
+    "4. Do NOT add any explanation. Your entire output must be just the prefix ('+' or '=') and the command.\n";
+
+const char *prompt_system_instructions(void) {
+    return system_instructions;
+}
+
+static int is_word_byte(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static int is_digit_byte(unsigned char c) {
+    return c >= '0' && c <= '9';
+}
+
+static size_t run_length(const char *text, size_t len, size_t i, int (*in_class)(unsigned char)) {
+    size_t start = i;
+    while (i < len && in_class((unsigned char)text[i])) i++;
+    return i - start;
+}
+
+int prompt_estimate_tokens(const char *text, size_t len) {
+    if (!text) return 0;
+
+    int tokens = 0;
+    size_t i = 0;
+    while (i < len) {
+        unsigned char c = (unsigned char)text[i];
+        size_t run;
+
+        if (is_word_byte(c)) {
+            run = run_length(text, len, i, is_word_byte);
+            tokens += run <= 6 ? 1 : (int)((run + 3) / 4);
+        } else if (is_digit_byte(c)) {
+            run = run_length(text, len, i, is_digit_byte);
+            tokens += (int)((run + 2) / 3);
+        } else if (c == ' ' || c == '\t') {
+            // A single space is absorbed by the word that follows it
+            run = 1;
+            while (i + run < len && (text[i + run] == ' ' || text[i + run] == '\t')) run++;
+            tokens += (int)((run + 2) / 4);
+        } else if (c == '\n' || c == '\r') {
+            run = 1;
+            while (i + run < len && (text[i + run] == '\n' || text[i + run] == '\r')) run++;
+            tokens += (int)((run + 1) / 2);
+        } else if (c >= 0x80) {
+            // One token per code point: skip the continuation bytes
+            run = 1;
+            while (i + run < len && ((unsigned char)text[i + run] & 0xc0) == 0x80) run++;
+            tokens++;
+        } else {
+            // Repeated punctuation such as "-----" merges into fewer tokens
+            run = 1;
+            while (i + run < len && text[i + run] == (char)c) run++;
+            tokens += (int)((run + 3) / 4);
+        }
+        i += run;
+    }
+    return tokens;
+}
+
+// Longest prefix of text (ending at a line or word break) within max_tokens
+size_t prompt_fit_head(const char *text, int max_tokens) {
+    if (!text || max_tokens <= 0) return 0;
+
+    size_t len = strlen(text);
+    if (prompt_estimate_tokens(text, len) <= max_tokens) return len;
+
+    // Take whole lines while they fit
+    size_t end = 0;
+    int used = 0;
+    while (end < len) {
+        const char *nl = memchr(text + end, '\n', len - end);
+        size_t line_end = nl ? (size_t)(nl - text) + 1 : len;
+        int cost = prompt_estimate_tokens(text + end, line_end - end);
+        if (used + cost > max_tokens) break;
+        used += cost;
+        end = line_end;
+    }
+    if (end > 0) return end;
+
+    // Not even the first line fits: cut it at the last word break that does
+    size_t cut = 0;
+    used = 0;
+    for (size_t i = 0; i < len && text[i] != '\n'; i++) {
+        if (text[i] != ' ') continue;
+        used += prompt_estimate_tokens(text + cut, i - cut);
+        if (used > max_tokens) break;
+        cut = i;
+    }
+    return cut;
+}
+
+// Shortest suffix of text (starting at a line or word break) within max_tokens
+const char *prompt_fit_tail(const char *text, int max_tokens) {
+    if (!text) return NULL;
+
+    size_t len = strlen(text);
+    if (max_tokens <= 0) return text + len;
+    if (prompt_estimate_tokens(text, len) <= max_tokens) return text;
+
+    // Take whole lines from the end while they fit
+    size_t start = len;
+    int used = 0;
+    while (start > 0) {
+        size_t line_start = start - 1;
+        while (line_start > 0 && text[line_start - 1] != '\n') line_start--;
+        int cost = prompt_estimate_tokens(text + line_start, start - line_start);
+        if (used + cost > max_tokens) break;
+        used += cost;
+        start = line_start;
+    }
+    if (start < len) return text + start;
+
+    // Not even the last line fits: keep the words at its end that do
+    size_t end = len;
+    while (end > 0 && text[end - 1] == '\n') end--;
+    size_t cut = end;
+    used = 0;
+    for (size_t i = end; i > 0 && text[i - 1] != '\n'; i--) {
+        if (text[i - 1] != ' ') continue;
+        used += prompt_estimate_tokens(text + i, cut - i);
+        if (used > max_tokens) break;
+        cut = i;
+    }
+    return text + cut;
+}
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} prompt_buffer_t;
+
+static int buffer_append(prompt_buffer_t *buf, const char *text, size_t len) {
+    if (buf->len + len + 1 > buf->cap) {
+        size_t cap = buf->cap ? buf->cap * 2 : 1024;
+        while (cap < buf->len + len + 1) cap *= 2;
+        char *data = realloc(buf->data, cap);
+        if (!data) return -1;
+        buf->data = data;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, text, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+    return 0;
+}
+
+// Append "title:\n<body>\n" with the part of text that fits the budget
+static int append_section(prompt_buffer_t *buf, const char *title, const char *text,
+                          int max_tokens, int keep_tail) {
+    if (!text || !text[0] || max_tokens <= 0) return 0;
+
+    const char *start = text;
+    size_t len;
+    if (keep_tail) {
+        start = prompt_fit_tail(text, max_tokens);
+        len = strlen(start);
+    } else {
+        len = prompt_fit_head(text, max_tokens);
+    }
+    while (len > 0 && (*start == '\n' || *start == ' ')) {
+        start++;
+        len--;
+    }
+    while (len > 0 && (start[len - 1] == '\n' || start[len - 1] == ' ')) len--;
+    if (len == 0) return 0;
+
+    if (buffer_append(buf, title, strlen(title)) != 0 ||
+        buffer_append(buf, ":\n", 2) != 0 ||
+        buffer_append(buf, start, len) != 0 ||
+        buffer_append(buf, "\n", 1) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+char *prompt_build_context(const session_context_t *ctx, const prompt_config_t *budget) {
+    if (!ctx || !budget) return NULL;
+
+    prompt_buffer_t buf = {0};
+    if (buffer_append(&buf, "", 0) != 0) return NULL;
+
+    // Environment and git facts are short and read top-down; history and
+    // terminal output keep their most recent end
+    if (append_section(&buf, "Environment", ctx->environment, budget->environment_tokens, 0) != 0 ||
+        append_section(&buf, "Git", ctx->git_info, budget->git_tokens, 0) != 0 ||
+        append_section(&buf, "Command History", ctx->recent_history, budget->history_tokens, 1) != 0 ||
+        append_section(&buf, "Terminal Output", ctx->terminal_buffer, budget->terminal_tokens, 1) != 0) {
+        free(buf.data);
+        return NULL;
+    }
+    return buf.data;
+}
@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+#include "smart_cmd.h"
+#include <pthread.h>
+
+/*
+ * Provider Health
+ *
+ * Per-provider latency histograms and a circuit breaker. Request deadlines
+ * follow the provider's observed p99 instead of a fixed minute, so a stalled
+ * provider costs a bounded, short wait. After BREAKER_FAILURE_THRESHOLD
+ * consecutive timeouts, 5xx or 429 responses the breaker opens and requests
+ * fail fast (or go to a fallback provider) until the cooldown has passed;
+ * then a single probe request is let through and its outcome closes or
+ * re-opens the breaker. Each reopening doubles the cooldown, up to a limit.
+ */
+
+typedef struct {
+    char provider[32];
+    latency_histogram_t latency;
+    breaker_state_t state;
+    int consecutive_failures;
+    int probe_in_flight;
+    int cooldown_ms;
+    uint64_t open_until_ms;
+    unsigned long successes;
+    unsigned long failures;
+    unsigned long timeouts;
+    unsigned long rejected;
+} provider_entry_t;
+
+static provider_entry_t g_providers[MAX_PROVIDERS];
+static int g_provider_count = 0;
+static pthread_mutex_t g_health_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Caller holds g_health_lock
+static provider_entry_t *find_provider(const char *provider, int create) {
+    for (int i = 0; i < g_provider_count; i++) {
+        if (strcmp(g_providers[i].provider, provider) == 0) return &g_providers[i];
+    }
+    if (!create || g_provider_count >= MAX_PROVIDERS) return NULL;
+
+    provider_entry_t *entry = &g_providers[g_provider_count++];
+    memset(entry, 0, sizeof(provider_entry_t));
+    snprintf(entry->provider, sizeof(entry->provider), "%s", provider);
+    entry->state = BREAKER_CLOSED;
+    entry->cooldown_ms = BREAKER_OPEN_MS;
+    return entry;
+}
+
+static int timeout_for(const provider_entry_t *entry) {
+    if (!entry || entry->latency.total < LATENCY_MIN_SAMPLES) {
+        return PROVIDER_COLD_TIMEOUT_MS; // First requests also pay for DNS/TCP/TLS
+    }
+
+    int timeout_ms = (int)(latency_histogram_percentile(&entry->latency, 99.0) * PROVIDER_TIMEOUT_FACTOR);
+    if (timeout_ms < PROVIDER_MIN_TIMEOUT_MS) timeout_ms = PROVIDER_MIN_TIMEOUT_MS;
+    if (timeout_ms > PROVIDER_MAX_TIMEOUT_MS) timeout_ms = PROVIDER_MAX_TIMEOUT_MS;
+    return timeout_ms;
+}
+
+int provider_health_allow(const char *provider) {
+    if (!provider) return -1;
+
+    pthread_mutex_lock(&g_health_lock);
+    provider_entry_t *entry = find_provider(provider, 1);
+    int allowed = 1;
+
+    if (entry) {
+        if (entry->state == BREAKER_OPEN && monotonic_ms() >= entry->open_until_ms) {
+            entry->state = BREAKER_HALF_OPEN;
+            entry->probe_in_flight = 0;
+        }
+
+        if (entry->state == BREAKER_OPEN) {
+            allowed = 0;
+        } else if (entry->state == BREAKER_HALF_OPEN) {
+            // Only one probe at a time while the provider is suspect
+            allowed = !entry->probe_in_flight;
+            entry->probe_in_flight = 1;
+        }
+
+        if (!allowed) entry->rejected++;
+    }
+
+    pthread_mutex_unlock(&g_health_lock);
+    return allowed ? 0 : -1;
+}
+
+int provider_health_timeout_ms(const char *provider) {
+    if (!provider) return PROVIDER_COLD_TIMEOUT_MS;
+
+    pthread_mutex_lock(&g_health_lock);
+    int timeout_ms = timeout_for(find_provider(provider, 0));
+    pthread_mutex_unlock(&g_health_lock);
+    return timeout_ms;
+}
+
+void provider_health_record_success(const char *provider, double latency_ms) {
+    if (!provider) return;
+
+    pthread_mutex_lock(&g_health_lock);
+    provider_entry_t *entry = find_provider(provider, 1);
+    if (entry) {
+        latency_histogram_record(&entry->latency, latency_ms);
+        entry->successes++;
+        entry->consecutive_failures = 0;
+        entry->probe_in_flight = 0;
+        entry->state = BREAKER_CLOSED;
+        entry->cooldown_ms = BREAKER_OPEN_MS;
+    }
+    pthread_mutex_unlock(&g_health_lock);
+}
+
+void provider_health_record_failure(const char *provider, int timed_out) {
+    if (!provider) return;
+
+    pthread_mutex_lock(&g_health_lock);
+    provider_entry_t *entry = find_provider(provider, 1);
+    if (entry) {
+        entry->failures++;
+        if (timed_out) entry->timeouts++;
+        entry->consecutive_failures++;
+
+        int reopen = entry->state == BREAKER_HALF_OPEN;
+        if (reopen || entry->consecutive_failures >= BREAKER_FAILURE_THRESHOLD) {
+            if (reopen) {
+                entry->cooldown_ms *= 2;
+                if (entry->cooldown_ms > BREAKER_MAX_OPEN_MS) entry->cooldown_ms = BREAKER_MAX_OPEN_MS;
+            }
+            entry->state = BREAKER_OPEN;
+            entry->open_until_ms = monotonic_ms() + (uint64_t)entry->cooldown_ms;
+            entry->probe_in_flight = 0;
+        }
+    }
+    pthread_mutex_unlock(&g_health_lock);
+}
+
+// A request that was allowed but ended without a health verdict (e.g. the
+// losing side of a hedged race) must not keep a half-open probe slot busy
+void provider_health_release(const char *provider) {
+    if (!provider) return;
+
+    pthread_mutex_lock(&g_health_lock);
+    provider_entry_t *entry = find_provider(provider, 0);
+    if (entry) entry->probe_in_flight = 0;
+    pthread_mutex_unlock(&g_health_lock);
+}
+
+int provider_health_percentile(const char *provider, double percentile, double *ms) {
+    if (!provider || !ms) return -1;
+
+    pthread_mutex_lock(&g_health_lock);
+    provider_entry_t *entry = find_provider(provider, 0);
+    int result = -1;
+    if (entry && entry->latency.total >= LATENCY_MIN_SAMPLES) {
+        *ms = latency_histogram_percentile(&entry->latency, percentile);
+        result = 0;
+    }
+    pthread_mutex_unlock(&g_health_lock);
+    return result;
+}
+
+int provider_health_get_all(provider_health_t *health, int max) {
+    if (!health || max <= 0) return 0;
+
+    pthread_mutex_lock(&g_health_lock);
+    int count = g_provider_count < max ? g_provider_count : max;
+    uint64_t now = monotonic_ms();
+    for (int i = 0; i < count; i++) {
+        provider_entry_t *entry = &g_providers[i];
+        provider_health_t *out = &health[i];
+        memset(out, 0, sizeof(provider_health_t));
+
+        snprintf(out->provider, sizeof(out->provider), "%s", entry->provider);
+        out->state = entry->state;
+        if (out->state == BREAKER_OPEN && now >= entry->open_until_ms) out->state = BREAKER_HALF_OPEN;
+        out->consecutive_failures = entry->consecutive_failures;
+        out->open_remaining_ms = (entry->state == BREAKER_OPEN && entry->open_until_ms > now)
+                                 ? (int)(entry->open_until_ms - now) : 0;
+        out->successes = entry->successes;
+        out->failures = entry->failures;
+        out->timeouts = entry->timeouts;
+        out->rejected = entry->rejected;
+        out->samples = entry->latency.total;
+        out->p50_ms = latency_histogram_percentile(&entry->latency, 50.0);
+        out->p95_ms = latency_histogram_percentile(&entry->latency, 95.0);
+        out->p99_ms = latency_histogram_percentile(&entry->latency, 99.0);
+        out->timeout_ms = timeout_for(entry);
+    }
+    pthread_mutex_unlock(&g_health_lock);
+    return count;
+}
+
+const char *breaker_state_name(breaker_state_t state) {
+    switch (state) {
+    case BREAKER_CLOSED: return "closed";
+    case BREAKER_OPEN: return "open";
+    case BREAKER_HALF_OPEN: return "half-open";
+    }
+    return "unknown";
+}
@@ -1,6 +1,5 @@
 #define _GNU_SOURCE
 #include "smart_cmd.h"
-#include <sys/select.h>
 #include <sys/time.h>
 
 int setup_daemon_pty(daemon_pty_t *pty, const char *session_id) {
@@ -34,6 +33,11 @@ int setup_daemon_pty(daemon_pty_t *pty, const char *session_id) {
         close(pty->master_fd);
         setsid();
 
+        // The daemon blocks its signals to read them from a signalfd; the shell must not inherit that
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigprocmask(SIG_SETMASK, &signals, NULL);
+
         ioctl(pty->slave_fd, TIOCSCTTY, 0);
 
         setenv("SMART_CMD_DAEMON_SESSION", pty->session_id, 1);
@@ -60,6 +64,7 @@ int setup_daemon_pty(daemon_pty_t *pty, const char *session_id) {
         exit(1);
     } else {
         close(pty->slave_fd);
+        pty->slave_fd = -1; // Or cleanup would close whatever reuses the number
 
         // Set master_fd to non-blocking
         int flags = fcntl(pty->master_fd, F_GETFL, 0);
@@ -96,50 +101,43 @@ void cleanup_daemon_pty(daemon_pty_t *pty) {
     }
 }
 
+// Non-blocking read of the output waiting on the PTY: > 0 bytes read, 0 when
+// the shell has exited, -1 when there is nothing to read (errno EAGAIN)
 int read_from_daemon_pty(daemon_pty_t *pty, char *buffer, size_t buffer_size) {
     if (!pty || !pty->active || !buffer || pty->master_fd == -1) return -1;
 
-    fd_set read_fds;
-    struct timeval timeout;
-
-    FD_ZERO(&read_fds);
-    FD_SET(pty->master_fd, &read_fds);
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 10000; // 10ms timeout
-
-    int result = select(pty->master_fd + 1, &read_fds, NULL, NULL, &timeout);
-
-    if (result > 0 && FD_ISSET(pty->master_fd, &read_fds)) {
-        ssize_t bytes_read = read(pty->master_fd, buffer, buffer_size - 1);
-        if (bytes_read > 0) {
-            buffer[bytes_read] = '\0';
-
-            // Store in internal buffer for context
-            size_t space_left = sizeof(pty->buffer) - pty->buffer_pos - 1;
-            if (space_left > 0) {
-                size_t copy_len = ((size_t)bytes_read < space_left) ? (size_t)bytes_read : space_left;
-                memcpy(pty->buffer + pty->buffer_pos, buffer, copy_len);
-                pty->buffer_pos += copy_len;
-                pty->buffer[pty->buffer_pos] = '\0';
-            }
-
-            // If buffer is getting full, make room
-            if ((size_t)pty->buffer_pos > sizeof(pty->buffer) / 2) {
-                size_t move_size = sizeof(pty->buffer) / 2;
-                memmove(pty->buffer, pty->buffer + move_size,
-                        (size_t)pty->buffer_pos - move_size);
-                pty->buffer_pos -= (int)move_size;
-            }
-
-            return bytes_read;
-        } else if (bytes_read == 0) {
-            // Shell closed the connection
-            pty->active = 0;
-            return 0;
+    ssize_t bytes_read = read(pty->master_fd, buffer, buffer_size - 1);
+    if (bytes_read > 0) {
+        buffer[bytes_read] = '\0';
+
+        // Store in internal buffer for context
+        size_t space_left = sizeof(pty->buffer) - pty->buffer_pos - 1;
+        if (space_left > 0) {
+            size_t copy_len = ((size_t)bytes_read < space_left) ? (size_t)bytes_read : space_left;
+            memcpy(pty->buffer + pty->buffer_pos, buffer, copy_len);
+            pty->buffer_pos += copy_len;
+            pty->buffer[pty->buffer_pos] = '\0';
+        }
+
+        // If buffer is getting full, make room
+        if ((size_t)pty->buffer_pos > sizeof(pty->buffer) / 2) {
+            size_t move_size = sizeof(pty->buffer) / 2;
+            memmove(pty->buffer, pty->buffer + move_size,
+                    (size_t)pty->buffer_pos - move_size);
+            pty->buffer_pos -= (int)move_size;
         }
+
+        return bytes_read;
     }
 
-    return 0;
+    // Linux reports a closed slave side as EIO rather than end of file
+    if (bytes_read == 0 || errno == EIO) {
+        // Shell closed the connection
+        pty->active = 0;
+        return 0;
+    }
+
+    return -1;
 }
 
 int write_to_daemon_pty(daemon_pty_t *pty, const char *data, size_t len) {
@@ -168,3 +166,16 @@ int get_daemon_pty_context(daemon_pty_t *pty, char *context, size_t context_size
 
     return copy_len;
 }
+
+int get_daemon_pty_cwd(daemon_pty_t *pty, char *cwd, size_t cwd_size) {
+    if (!pty || !pty->active || !cwd || cwd_size == 0 || pty->child_pid <= 0) return -1;
+
+    char proc_path[64];
+    snprintf(proc_path, sizeof(proc_path), "/proc/%d/cwd", pty->child_pid);
+
+    ssize_t len = readlink(proc_path, cwd, cwd_size - 1);
+    if (len == -1) return -1;
+
+    cwd[len] = '\0';
+    return 0;
+}
@@ -0,0 +1,388 @@
+#define _GNU_SOURCE
+#include "smart_cmd.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+/*
+ * Shell Channel
+ *
+ * Events a shell reports at keystroke and prompt rate (the line being typed,
+ * the working directory, the last exit status) go to the daemon through
+ * shared memory instead of a socket exchange each.
+ *
+ * The shell's completion client creates a ring of fixed-size event slots in
+ * a memfd, sealed so it can no longer shrink, and an eventfd, and hands
+ * both to the daemon once over its IPC connection (MSG_TYPE_CHANNEL, with
+ * the descriptors as SCM_RIGHTS). The client is the only producer and the
+ * daemon the only consumer, so head and tail are plain counters with
+ * acquire/release ordering and no lock.
+ *
+ * Publishing an event is a copy into the next slot. The eventfd is written
+ * only when the daemon said it is about to sleep: after draining the ring
+ * it sets the waiting flag and looks at the head once more, and the
+ * producer checks the flag after moving the head, so one of the two always
+ * sees the other (both sides use sequentially consistent accesses for
+ * this). While the daemon keeps up, most events cost no system call at
+ * all. A full ring drops new events and counts them; a ring whose producer
+ * has exited is detached by the housekeeping sweep.
+ *
+ * The daemon drains a ring from its epoll loop and keeps the latest state of
+ * every attached shell. A ring belongs to the connection it came over, so a
+ * request's context comes from the shell that sent the request, however
+ * many others are typing at the same time.
+ */
+
+#define SHELL_RING_MAGIC 0x534D5348  // "SMSH"
+#define SHELL_RING_VERSION 1
+
+typedef struct {
+    uint32_t type;        // shell_event_type_t
+    int32_t value;        // Exit status for SHELL_EVENT_EXIT
+    uint32_t length;      // Of data, which is NUL-terminated too
+    uint32_t reserved;
+    char data[SHELL_EVENT_DATA];
+} shell_event_slot_t;
+
+// Producer and consumer fields are on cache lines of their own
+struct shell_ring {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    int32_t pid;          // Producer
+    char reserved0[44];
+    uint64_t head;        // Written by the producer: next slot to fill
+    uint64_t dropped;     // Written by the producer: events lost to a full ring
+    char reserved1[48];
+    uint64_t tail;        // Written by the consumer: next slot to read
+    uint32_t waiting;     // Set by the consumer before it sleeps
+    char reserved2[52];
+    shell_event_slot_t slots[SHELL_CHANNEL_SLOTS];
+};
+
+// A shell attached to the daemon
+typedef struct {
+    int active;
+    uint64_t owner;       // IPC client id of the connection it came over
+    int event_fd;
+    struct shell_ring *ring;
+    shell_state_t state;
+    uint64_t updated_ms;
+} attached_shell_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    int epoll_fd;
+    attached_shell_t shells[SHELL_CHANNEL_MAX];
+    shell_channel_stats_t stats;
+} shell_channels_t;
+
+static shell_channels_t g_shells = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .epoll_fd = -1,
+};
+
+// Producer side (the shell's completion client)
+
+int shell_channel_create(shell_channel_t *channel) {
+    if (!channel) return -1;
+    channel->memfd = -1;
+    channel->event_fd = -1;
+    channel->ring = NULL;
+
+    int memfd = memfd_create("smart-cmd-shell", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd == -1) return -1;
+
+    // A consumer must not be able to lose the mapping under it (SIGBUS)
+    if (ftruncate(memfd, (off_t)sizeof(struct shell_ring)) == -1 ||
+        fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1) {
+        close(memfd);
+        return -1;
+    }
+
+    struct shell_ring *ring = mmap(NULL, sizeof(struct shell_ring), PROT_READ | PROT_WRITE,
+                                   MAP_SHARED, memfd, 0);
+    if (ring == MAP_FAILED) {
+        close(memfd);
+        return -1;
+    }
+
+    int event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (event_fd == -1) {
+        munmap(ring, sizeof(struct shell_ring));
+        close(memfd);
+        return -1;
+    }
+
+    // A new memfd is zero-filled: head, tail and the waiting flag start at 0
+    ring->magic = SHELL_RING_MAGIC;
+    ring->version = SHELL_RING_VERSION;
+    ring->slot_count = SHELL_CHANNEL_SLOTS;
+    ring->slot_size = sizeof(shell_event_slot_t);
+    ring->pid = (int32_t)getpid();
+
+    channel->memfd = memfd;
+    channel->event_fd = event_fd;
+    channel->ring = ring;
+    return 0;
+}
+
+// Append an event; -1 when the ring is full (the event is counted as dropped)
+int shell_channel_publish(shell_channel_t *channel, shell_event_type_t type, int value, const char *data) {
+    if (!channel || !channel->ring) return -1;
+    struct shell_ring *ring = channel->ring;
+
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= SHELL_CHANNEL_SLOTS) {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    shell_event_slot_t *slot = &ring->slots[head % SHELL_CHANNEL_SLOTS];
+    size_t length = data ? strnlen(data, SHELL_EVENT_DATA - 1) : 0;
+    slot->type = (uint32_t)type;
+    slot->value = value;
+    slot->length = (uint32_t)length;
+    if (length > 0) memcpy(slot->data, data, length);
+    slot->data[length] = '\0';
+
+    // Publish, then see whether the consumer went to sleep before it could see it
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&ring->waiting, 0, __ATOMIC_SEQ_CST)) {
+        eventfd_write(channel->event_fd, 1);
+    }
+    return 0;
+}
+
+void shell_channel_destroy(shell_channel_t *channel) {
+    if (!channel) return;
+    if (channel->ring) munmap(channel->ring, sizeof(struct shell_ring));
+    if (channel->memfd != -1) close(channel->memfd);
+    if (channel->event_fd != -1) close(channel->event_fd);
+    channel->ring = NULL;
+    channel->memfd = -1;
+    channel->event_fd = -1;
+}
+
+// Consumer side (the daemon)
+
+static void shell_detach(attached_shell_t *shell) {
+    epoll_ctl(g_shells.epoll_fd, EPOLL_CTL_DEL, shell->event_fd, NULL);
+    close(shell->event_fd);
+    munmap(shell->ring, sizeof(struct shell_ring));
+    shell->active = 0;
+    g_shells.stats.channels--;
+}
+
+static void apply_event(attached_shell_t *shell, const shell_event_slot_t *shared) {
+    // Copied first: the producer is another process
+    shell_event_slot_t event;
+    memcpy(&event, shared, offsetof(shell_event_slot_t, data));
+    size_t length = event.length < SHELL_EVENT_DATA ? event.length : SHELL_EVENT_DATA - 1;
+    memcpy(event.data, shared->data, length);
+    event.data[length] = '\0';
+
+    switch (event.type) {
+    case SHELL_EVENT_LINE:
+        safe_string_copy(shell->state.line, event.data, sizeof(shell->state.line));
+        break;
+    case SHELL_EVENT_CWD:
+        if (event.data[0] == '/') safe_string_copy(shell->state.cwd, event.data, sizeof(shell->state.cwd));
+        break;
+    case SHELL_EVENT_EXIT:
+        shell->state.last_status = event.value;
+        break;
+    default:
+        return;
+    }
+
+    shell->state.events++;
+    g_shells.stats.events++;
+}
+
+// Read what the shell published, at most one ring's worth at a time
+static void shell_drain(attached_shell_t *shell) {
+    struct shell_ring *ring = shell->ring;
+    int budget = SHELL_CHANNEL_SLOTS;
+
+    for (;;) {
+        uint64_t tail = ring->tail;
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (head - tail > SHELL_CHANNEL_SLOTS) {
+            // Only a misbehaving producer gets this far ahead
+            tail = head - SHELL_CHANNEL_SLOTS;
+        }
+
+        uint64_t before = shell->state.events;
+        while (tail != head && budget > 0) {
+            apply_event(shell, &ring->slots[tail % SHELL_CHANNEL_SLOTS]);
+            tail++;
+            budget--;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        if (shell->state.events != before) shell->updated_ms = monotonic_ms();
+
+        if (tail != head) {
+            // More to read: come back after the other descriptors had their turn
+            eventfd_write(shell->event_fd, 1);
+            break;
+        }
+
+        // About to sleep: ask for a wakeup, then make sure nothing slipped in
+        __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) == tail) break;
+        __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+    }
+
+    shell->state.dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+}
+
+int shell_channel_init(int epoll_fd) {
+    if (epoll_fd == -1) return -1;
+    g_shells.epoll_fd = epoll_fd;
+    return 0;
+}
+
+// Take over a shell's ring and eventfd, which came over the connection
+// owner (both descriptors are owned by this function from here on, and
+// closed when the ring is rejected)
+int shell_channel_attach(int memfd, int event_fd, uint64_t owner) {
+    struct shell_ring *ring = MAP_FAILED;
+    struct stat st;
+    int seals = memfd != -1 ? fcntl(memfd, F_GET_SEALS) : -1;
+    if (seals != -1 && (seals & F_SEAL_SHRINK) && fstat(memfd, &st) == 0 &&
+        (size_t)st.st_size >= sizeof(struct shell_ring)) {
+        ring = mmap(NULL, sizeof(struct shell_ring), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    }
+    if (memfd != -1) close(memfd);
+
+    pthread_mutex_lock(&g_shells.lock);
+
+    if (ring == MAP_FAILED || g_shells.epoll_fd == -1 || event_fd == -1 ||
+        ring->magic != SHELL_RING_MAGIC || ring->version != SHELL_RING_VERSION || ring->pid <= 0 ||
+        ring->slot_count != SHELL_CHANNEL_SLOTS || ring->slot_size != sizeof(shell_event_slot_t)) {
+        g_shells.stats.rejected++;
+        pthread_mutex_unlock(&g_shells.lock);
+        if (ring != MAP_FAILED) munmap(ring, sizeof(struct shell_ring));
+        if (event_fd != -1) close(event_fd);
+        return -1;
+    }
+
+    // A shell that reconnected replaces its old channel
+    int32_t pid = ring->pid;
+    attached_shell_t *free_slot = NULL;
+    for (int i = 0; i < SHELL_CHANNEL_MAX; i++) {
+        attached_shell_t *shell = &g_shells.shells[i];
+        if (shell->active && shell->state.pid == pid) shell_detach(shell);
+        if (!shell->active && !free_slot) free_slot = shell;
+    }
+
+    struct epoll_event event = { .events = EPOLLIN, .data.u64 = (uint64_t)event_fd };
+    if (!free_slot || epoll_ctl(g_shells.epoll_fd, EPOLL_CTL_ADD, event_fd, &event) == -1) {
+        g_shells.stats.rejected++;
+        pthread_mutex_unlock(&g_shells.lock);
+        munmap(ring, sizeof(struct shell_ring));
+        close(event_fd);
+        return -1;
+    }
+
+    memset(free_slot, 0, sizeof(attached_shell_t));
+    free_slot->active = 1;
+    free_slot->owner = owner;
+    free_slot->event_fd = event_fd;
+    free_slot->ring = ring;
+    free_slot->state.pid = pid;
+    free_slot->state.last_status = -1;
+    g_shells.stats.attached++;
+    g_shells.stats.channels++;
+
+    // Whatever was published before the daemon came along
+    shell_drain(free_slot);
+
+    pthread_mutex_unlock(&g_shells.lock);
+    return 0;
+}
+
+// 1 when fd is the eventfd of an attached shell and was handled
+int shell_channel_handle_event(int fd) {
+    pthread_mutex_lock(&g_shells.lock);
+    for (int i = 0; i < SHELL_CHANNEL_MAX; i++) {
+        attached_shell_t *shell = &g_shells.shells[i];
+        if (!shell->active || shell->event_fd != fd) continue;
+
+        eventfd_t wakeups;
+        if (eventfd_read(fd, &wakeups) == 0) g_shells.stats.wakeups++;
+        shell_drain(shell);
+        pthread_mutex_unlock(&g_shells.lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&g_shells.lock);
+    return 0;
+}
+
+static void copy_state(const attached_shell_t *shell, uint64_t now, shell_state_t *state) {
+    *state = shell->state;
+    state->idle_ms = shell->updated_ms ? (int)(now - shell->updated_ms) : -1;
+}
+
+// State of the shell whose channel came over the connection owner; -1 if
+// that connection has none or it has not reported yet
+int shell_channel_find(uint64_t owner, shell_state_t *state) {
+    if (!state) return -1;
+
+    uint64_t now = monotonic_ms();
+    int found = -1;
+    pthread_mutex_lock(&g_shells.lock);
+    for (int i = 0; i < SHELL_CHANNEL_MAX; i++) {
+        const attached_shell_t *shell = &g_shells.shells[i];
+        if (!shell->active || shell->owner != owner || shell->updated_ms == 0) continue;
+        copy_state(shell, now, state);
+        found = 0;
+        break;
+    }
+    pthread_mutex_unlock(&g_shells.lock);
+    return found;
+}
+
+int shell_channel_get_all(shell_state_t *states, int max) {
+    if (!states || max <= 0) return 0;
+
+    uint64_t now = monotonic_ms();
+    int count = 0;
+    pthread_mutex_lock(&g_shells.lock);
+    for (int i = 0; i < SHELL_CHANNEL_MAX && count < max; i++) {
+        if (g_shells.shells[i].active) copy_state(&g_shells.shells[i], now, &states[count++]);
+    }
+    pthread_mutex_unlock(&g_shells.lock);
+    return count;
+}
+
+// Detach the rings of shells that have exited
+void shell_channel_sweep(void) {
+    pthread_mutex_lock(&g_shells.lock);
+    for (int i = 0; i < SHELL_CHANNEL_MAX; i++) {
+        attached_shell_t *shell = &g_shells.shells[i];
+        if (shell->active && kill(shell->state.pid, 0) == -1 && errno == ESRCH) shell_detach(shell);
+    }
+    pthread_mutex_unlock(&g_shells.lock);
+}
+
+void shell_channel_get_stats(shell_channel_stats_t *stats) {
+    if (!stats) return;
+    pthread_mutex_lock(&g_shells.lock);
+    *stats = g_shells.stats;
+    pthread_mutex_unlock(&g_shells.lock);
+}
+
+void shell_channel_shutdown(void) {
+    pthread_mutex_lock(&g_shells.lock);
+    for (int i = 0; i < SHELL_CHANNEL_MAX; i++) {
+        if (g_shells.shells[i].active) shell_detach(&g_shells.shells[i]);
+    }
+    pthread_mutex_unlock(&g_shells.lock);
+}
@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+#include "smart_cmd.h"
+#include <signal.h>
+#include <sys/mman.h>
+
+/*
+ * Shared Suggestion Cache
+ *
+ * Persistent suggestion cache shared by every smart-cmd-completion process
+ * and the daemon. It is a fixed-size open-addressing hash table in a file
+ * under the user's runtime directory, mapped with MAP_SHARED.
+ *
+ * Each slot is guarded by a sequence counter (seqlock): a writer makes the
+ * counter odd while it writes and publishes by making it even again; readers
+ * never take a lock and simply retry or give up when the counter changed
+ * underneath them. Writers first claim the slot's owner word with a CAS; it
+ * holds their pid and the time of the claim and is cleared after publishing.
+ * A writer that was killed halfway leaves the slot claimed and odd, so a
+ * later writer takes such a slot over once its owner is gone or the claim
+ * is older than SHM_CACHE_CLAIM_STALE_SECONDS. A lost write is harmless for
+ * a cache.
+ * Entries carry a wall-clock expiry and are overwritten oldest-first within
+ * the probe window, so old suggestions age out on their own. Keys come from
+ * shm_cache_key() in every process that uses the file.
+ */
+
+#define SHM_CACHE_MAGIC 0x534D4343  // "SMCC"
+#define SHM_CACHE_VERSION 2
+#define SHM_CACHE_SLOTS 1024
+#define SHM_CACHE_PROBE 8
+#define SHM_CACHE_READ_RETRIES 4
+#define SHM_CACHE_CLAIM_STALE_SECONDS 10
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    char reserved[48];
+} shm_cache_header_t;
+
+typedef struct {
+    uint32_t seq;
+    char type;
+    char reserved[3];
+    uint64_t key;
+    uint64_t owner;       // Writer pid << 32 | claim time in seconds; 0 when free
+    int64_t expires;
+    char suggestion[MAX_SUGGESTION_LEN];
+} shm_cache_slot_t;
+
+typedef struct {
+    shm_cache_header_t header;
+    shm_cache_slot_t slots[SHM_CACHE_SLOTS];
+} shm_cache_file_t;
+
+static shm_cache_file_t *g_shm = NULL;
+
+// Versioned, so binaries with another slot layout keep to their own file
+static int shm_cache_path(char *path, size_t size) {
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir && runtime_dir[0]) {
+        snprintf(path, size, "%s/%s.cache.v%d", runtime_dir, SMART_CMD_PREFIX, SHM_CACHE_VERSION);
+    } else {
+        snprintf(path, size, "%s/%s.cache.v%d.%d", get_smart_cmd_tmpdir(), SMART_CMD_PREFIX,
+                 SHM_CACHE_VERSION, (int)getuid());
+    }
+    return 0;
+}
+
+int shm_cache_open(void) {
+    if (__atomic_load_n(&g_shm, __ATOMIC_ACQUIRE)) return 0;
+
+    char path[MAX_PATH];
+    shm_cache_path(path, sizeof(path));
+
+    int fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd == -1) return -1;
+
+    // Never share a cache file with another user (matters for the /tmp fallback)
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_uid != getuid() || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+
+    // Growing a new file is idempotent, so concurrent creators do not conflict;
+    // a zero-filled table is a valid empty table
+    if ((size_t)st.st_size < sizeof(shm_cache_file_t) &&
+        ftruncate(fd, (off_t)sizeof(shm_cache_file_t)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, sizeof(shm_cache_file_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    shm_cache_file_t *file = (shm_cache_file_t *)map;
+    uint32_t expected = 0;
+    if (__atomic_compare_exchange_n(&file->header.magic, &expected, SHM_CACHE_MAGIC, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        file->header.version = SHM_CACHE_VERSION;
+        file->header.slot_count = SHM_CACHE_SLOTS;
+        file->header.slot_size = sizeof(shm_cache_slot_t);
+    } else if (expected != SHM_CACHE_MAGIC ||
+               (file->header.version != 0 && file->header.version != SHM_CACHE_VERSION)) {
+        // Foreign or incompatible layout: run without the shared cache
+        munmap(map, sizeof(shm_cache_file_t));
+        return -1;
+    }
+
+    // Daemon workers may open it at the same time: the first mapping wins
+    shm_cache_file_t *none = NULL;
+    if (!__atomic_compare_exchange_n(&g_shm, &none, file, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        munmap(map, sizeof(shm_cache_file_t));
+    }
+    return 0;
+}
+
+void shm_cache_close(void) {
+    if (g_shm) {
+        munmap(g_shm, sizeof(shm_cache_file_t));
+        g_shm = NULL;
+    }
+}
+
+// Key of input typed in cwd. The daemon and direct completions both derive
+// it here, from what both of them know (the input, the directory and its
+// git HEAD), so each finds the other's entries; 0 without a directory.
+uint64_t shm_cache_key(const char *input, const char *cwd) {
+    if (!input || !cwd || !cwd[0]) return 0;
+
+    char git_head[128];
+    read_git_head(cwd, git_head, sizeof(git_head));
+    return context_fingerprint(input, cwd, git_head, NULL);
+}
+
+static uint32_t slot_index(uint64_t key, int probe) {
+    return (uint32_t)((key + (uint64_t)probe) % SHM_CACHE_SLOTS);
+}
+
+int shm_cache_get(uint64_t key, suggestion_t *suggestion) {
+    if (!g_shm || !suggestion || key == 0) return -1;
+
+    int64_t now = (int64_t)time(NULL);
+
+    for (int probe = 0; probe < SHM_CACHE_PROBE; probe++) {
+        shm_cache_slot_t *slot = &g_shm->slots[slot_index(key, probe)];
+
+        for (int attempt = 0; attempt < SHM_CACHE_READ_RETRIES; attempt++) {
+            uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+            if (seq & 1) continue; // Writer in progress
+
+            uint64_t slot_key = __atomic_load_n(&slot->key, __ATOMIC_RELAXED);
+            if (slot_key != key) break;
+
+            int64_t expires = slot->expires;
+            char type = slot->type;
+            memcpy(suggestion->suggestion, slot->suggestion, sizeof(suggestion->suggestion));
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) continue; // Torn read
+
+            if (expires <= now) return -1;
+
+            suggestion->suggestion[sizeof(suggestion->suggestion) - 1] = '\0';
+            suggestion->type = type;
+            suggestion->visible = 1;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+// A claim whose writer is gone (or whose pid may have been reused since)
+static int claim_abandoned(uint64_t owner, int64_t now) {
+    pid_t pid = (pid_t)(owner >> 32);
+    uint32_t claimed = (uint32_t)owner;
+    if ((uint32_t)now - claimed >= SHM_CACHE_CLAIM_STALE_SECONDS) return 1;
+    return kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+void shm_cache_put(uint64_t key, const suggestion_t *suggestion, int ttl_seconds) {
+    if (!g_shm || !suggestion || key == 0 || ttl_seconds <= 0) return;
+
+    int64_t now = (int64_t)time(NULL);
+
+    // Prefer the slot already holding this key, then a free or expired one,
+    // otherwise replace the entry closest to expiry
+    shm_cache_slot_t *target = NULL;
+    int64_t oldest = INT64_MAX;
+    for (int probe = 0; probe < SHM_CACHE_PROBE; probe++) {
+        shm_cache_slot_t *slot = &g_shm->slots[slot_index(key, probe)];
+        uint64_t slot_key = __atomic_load_n(&slot->key, __ATOMIC_RELAXED);
+        int64_t expires = slot->expires;
+
+        if (slot_key == key) {
+            target = slot;
+            break;
+        }
+        if (slot_key == 0 || expires <= now) {
+            if (oldest > INT64_MIN) {
+                target = slot;
+                oldest = INT64_MIN;
+            }
+        } else if (expires < oldest) {
+            target = slot;
+            oldest = expires;
+        }
+    }
+    if (!target) return;
+
+    // Another writer owns the slot: dropping this write is fine
+    uint64_t owner = __atomic_load_n(&target->owner, __ATOMIC_ACQUIRE);
+    if (owner != 0 && !claim_abandoned(owner, now)) return;
+    uint64_t mine = ((uint64_t)(uint32_t)getpid() << 32) | (uint32_t)now;
+    if (!__atomic_compare_exchange_n(&target->owner, &owner, mine, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    // Odd already when taken over from a writer that died halfway
+    uint32_t seq = __atomic_load_n(&target->seq, __ATOMIC_RELAXED);
+    if (!(seq & 1)) {
+        seq++;
+        __atomic_store_n(&target->seq, seq, __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&target->key, key, __ATOMIC_RELAXED);
+    target->expires = now + ttl_seconds;
+    target->type = suggestion->type;
+    safe_string_copy(target->suggestion, suggestion->suggestion, sizeof(target->suggestion));
+
+    __atomic_store_n(&target->seq, seq + 1, __ATOMIC_RELEASE);
+    // Unless it was taken over meanwhile, which only a stale claim allows
+    __atomic_compare_exchange_n(&target->owner, &mine, 0, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,127 @@
+#define _GNU_SOURCE
+#include "smart_cmd.h"
+#include <pthread.h>
+
+/*
+ * Request Coalescing
+ *
+ * Requests with the same context fingerprint (input, directory, git HEAD,
+ * recent commands) share one LLM call: the first one makes the call and the
+ * ones that arrive while it is in flight wait for it and all get its result.
+ * Repeated Ctrl+O presses and several terminals asking about the same input
+ * then cost one request's tokens and one slot of the provider's rate limit.
+ *
+ * Requests that were queued behind the call reach the daemon just after it
+ * finishes, so a successful result stays joinable for SINGLEFLIGHT_LINGER_MS
+ * more; this is independent of the suggestion cache and works with the
+ * cache turned off. A full table means the request goes out on its own.
+ */
+
+typedef struct {
+    uint64_t key;
+    int active;         // Slot in use
+    int done;
+    int waiters;        // Followers still to read the result
+    int result;         // Number of candidates, -1 on failure
+    suggestion_t suggestions[MAX_CANDIDATES];
+    uint64_t finished_ms;
+} flight_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    flight_t flights[SINGLEFLIGHT_SLOTS];
+    singleflight_stats_t stats;
+} flight_table_t;
+
+static flight_table_t g_flights = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+// A slot is reusable once its call is over, read by every follower, and
+// past the linger window (or failed, which is never reused)
+static int flight_expired(const flight_t *flight, uint64_t now) {
+    if (!flight->active) return 1;
+    if (!flight->done || flight->waiters > 0) return 0;
+    return flight->result <= 0 || now >= flight->finished_ms + SINGLEFLIGHT_LINGER_MS;
+}
+
+static flight_t *flight_find(uint64_t key, uint64_t now) {
+    for (int i = 0; i < SINGLEFLIGHT_SLOTS; i++) {
+        flight_t *flight = &g_flights.flights[i];
+        if (flight->active && flight->key == key && !flight_expired(flight, now)) return flight;
+    }
+    return NULL;
+}
+
+static flight_t *flight_alloc(uint64_t now) {
+    for (int i = 0; i < SINGLEFLIGHT_SLOTS; i++) {
+        flight_t *flight = &g_flights.flights[i];
+        if (flight_expired(flight, now)) return flight;
+    }
+    return NULL;
+}
+
+// The ranked candidates of one shared call, at most max_suggestions of
+// them; their number, or -1 when the call failed
+int singleflight_send_to_llm_candidates(uint64_t key, const char *input, const session_context_t *ctx,
+                                        const config_t *config, suggestion_t *suggestions, int max_suggestions) {
+    if (max_suggestions > MAX_CANDIDATES) max_suggestions = MAX_CANDIDATES;
+    if (key == 0) return send_to_llm_candidates(input, ctx, config, suggestions, max_suggestions);
+
+    pthread_mutex_lock(&g_flights.lock);
+    uint64_t now = monotonic_ms();
+
+    flight_t *flight = flight_find(key, now);
+    if (flight) {
+        if (flight->done) {
+            g_flights.stats.late_joined++;
+        } else {
+            g_flights.stats.joined++;
+            flight->waiters++;
+            while (!flight->done) {
+                pthread_cond_wait(&g_flights.cond, &g_flights.lock);
+            }
+            flight->waiters--;
+        }
+        int result = flight->result < max_suggestions ? flight->result : max_suggestions;
+        if (result > 0) memcpy(suggestions, flight->suggestions, (size_t)result * sizeof(suggestion_t));
+        pthread_mutex_unlock(&g_flights.lock);
+        return result > 0 ? result : -1;
+    }
+
+    flight = flight_alloc(now);
+    if (!flight) {
+        g_flights.stats.uncoalesced++;
+        pthread_mutex_unlock(&g_flights.lock);
+        return send_to_llm_candidates(input, ctx, config, suggestions, max_suggestions);
+    }
+
+    memset(flight, 0, sizeof(flight_t));
+    flight->key = key;
+    flight->active = 1;
+    g_flights.stats.calls++;
+    pthread_mutex_unlock(&g_flights.lock);
+
+    int result = send_to_llm_candidates(input, ctx, config, suggestions, max_suggestions);
+    if (result <= 0) result = -1;
+
+    pthread_mutex_lock(&g_flights.lock);
+    flight->result = result;
+    if (result > 0) memcpy(flight->suggestions, suggestions, (size_t)result * sizeof(suggestion_t));
+    flight->finished_ms = monotonic_ms();
+    flight->done = 1;
+    pthread_cond_broadcast(&g_flights.cond);
+    pthread_mutex_unlock(&g_flights.lock);
+
+    return result;
+}
+
+void singleflight_get_stats(singleflight_stats_t *stats) {
+    if (!stats) return;
+
+    pthread_mutex_lock(&g_flights.lock);
+    *stats = g_flights.stats;
+    pthread_mutex_unlock(&g_flights.lock);
+}
@@ -35,6 +35,76 @@
 #define MAX_SYSTEM_PROMPT_LENGTH 4096
 #define MAX_PROMPT_LENGTH 4110
 #define MAX_HISTORY_MESSAGES 3
+#define MAX_CANDIDATES 5
+
+// Prompt Constants
+#define MAX_CONTEXT_SECTION_LEN 512
+
+// IPC Constants
+#define IPC_VERSION 3                  // Newest protocol version spoken
+#define IPC_VERSION_CONTEXT 3          // First with the client's context after a request's input
+#define IPC_VERSION_MIN 1              // Oldest one still accepted
+#define MAX_IPC_MESSAGE_SIZE 4096      // Version 1 frame, header included
+#define IPC_MAX_PAYLOAD (1024 * 1024)  // Version 2 body
+#define IPC_MAX_PIPELINED 8            // Version 2 requests in flight per connection
+#define IPC_MAX_FDS 2                  // Descriptors a connection may pass with a frame
+#define IPC_CLIENT_BUFFER (8 * MAX_IPC_MESSAGE_SIZE) // Requests a connection may queue
+#define IPC_MAX_CLIENTS 256            // Connections open at once, whatever their descriptors
+#define IPC_EVENT_CLIENT (1ULL << 32)  // epoll_data.u64 of a connection: this | its slot; others hold an fd
+#define IPC_STALL_TIMEOUT_MS 5000      // For a request that arrives only in part
+#define IPC_CONNECT_TIMEOUT_MS 100     // Clients falling back to direct mode
+#define IPC_SUGGESTION_TIMEOUT_MS (PREFETCH_WAIT_MS + PROVIDER_MAX_TIMEOUT_MS + 1000)
+
+// HTTP Client Constants
+#define HTTP_DEFAULT_TIMEOUT_MS 60000
+#define HTTP_CONNECT_TIMEOUT_MS 10000
+#define HTTP_DNS_CACHE_TIMEOUT 300
+#define HTTP_CANCEL_POLL_MS 20
+#define HTTP_PREWARM_TIMEOUT_MS 5000
+#define MAX_HTTP_HEADERS 8
+
+// JSON writer and reader Constants
+#define JSON_WRITER_MAX_DEPTH 32
+#define JSON_STREAM_MAX_DEPTH 32
+#define JSON_STREAM_MAX_TARGETS 16
+#define JSON_STREAM_MAX_SEGMENTS 8
+#define JSON_STREAM_KEY_LEN 64
+
+// Latency and provider health Constants
+#define LATENCY_BUCKETS 64
+#define LATENCY_WINDOW 1024
+#define LATENCY_MIN_SAMPLES 20
+#define MAX_PROVIDERS 8
+#define PROVIDER_COLD_TIMEOUT_MS 15000
+#define PROVIDER_MIN_TIMEOUT_MS 2000
+#define PROVIDER_MAX_TIMEOUT_MS 30000
+#define PROVIDER_TIMEOUT_FACTOR 2
+#define BREAKER_FAILURE_THRESHOLD 3
+#define BREAKER_OPEN_MS 30000
+#define BREAKER_MAX_OPEN_MS 300000
+
+// Prefetch Constants
+#define PREFETCH_THREAD_NICE 10
+#define PREFETCH_WAIT_MS 4000
+#define PREFETCH_RESULT_TTL_MS 60000  // A prefetched suggestion unused this long is stale
+#define PREFETCH_SLOTS 16             // Shells with a prefetch of their own
+#define PREFETCH_OWNER_SHELL (1ULL << 63) // Owner ids from a shell's pid, not a connection
+
+// Request Coalescing Constants
+#define SINGLEFLIGHT_SLOTS 16
+#define SINGLEFLIGHT_LINGER_MS 250
+
+// Worker Pool Constants
+#define WORKER_POOL_THREADS 8            // Jobs mostly wait on the provider
+#define WORKER_POOL_QUEUE 32
+
+// Connection Warm-up Constants
+#define WARMUP_MAX_ENDPOINTS 4
+
+// Shell Channel Constants
+#define SHELL_CHANNEL_SLOTS 64           // Events a shell can publish ahead of the daemon
+#define SHELL_EVENT_DATA 1024            // Longer lines are cut
+#define SHELL_CHANNEL_MAX 32             // Shells attached to one daemon
 
 // User context - basic environment information
 typedef struct {
@@ -48,9 +118,14 @@ typedef struct {
 typedef struct {
     user_context_t user;
     char last_command[MAX_INPUT_LEN];
-    char terminal_buffer[MAX_CONTEXT_LEN];
+    char terminal_buffer[MAX_CONTEXT_LEN];              // Recent PTY output
+    char recent_history[MAX_CONTEXT_LEN];               // One command per line, oldest first
+    char environment[MAX_CONTEXT_SECTION_LEN];
+    char git_info[MAX_CONTEXT_SECTION_LEN];
     int command_count;
     char session_id[MAX_SESSION_ID];
+    int shell_pid;                                      // Of the shell a request came from, 0 if unknown
+    int shell_prompts;                                  // Prompts that shell has shown, -1 if unknown
 } session_context_t;
 
 // Session paths - all file paths for a session
@@ -78,13 +153,66 @@ typedef struct {
     char endpoint[256];
 } llm_config_t;
 
+// Speculative prefetch configuration
+typedef struct {
+    int enabled;
+    int debounce_ms;
+} prefetch_config_t;
+
+// Suggestion cache configuration
+typedef struct {
+    int enabled;
+    int max_entries;
+    int ttl_seconds;
+    int negative_ttl_seconds;
+    int persistent;
+} cache_config_t;
+
+// Request hedging configuration (second provider raced after a delay)
+typedef struct {
+    int enabled;
+    int delay_ms;
+    int adaptive; // Use the primary's observed p95 latency as the delay
+    llm_config_t llm;
+} hedge_config_t;
+
+// Connection warm-up configuration
+typedef struct {
+    int enabled;
+    int interval_seconds; // Keep-alive ping period per provider endpoint
+} warmup_config_t;
+
+// Local command model configuration
+typedef struct {
+    int enabled;
+    double min_confidence; // Answer without the LLM at or above this share
+    int min_count;         // ... and when the command was run this many times
+} local_model_config_t;
+
+// Prompt token budgets per context source (0 leaves the source out)
+typedef struct {
+    int history_tokens;
+    int terminal_tokens;
+    int environment_tokens;
+    int git_tokens;
+} prompt_config_t;
+
 // Main configuration
 typedef struct {
     llm_config_t llm;
+    hedge_config_t hedge;
+    prefetch_config_t prefetch;
+    warmup_config_t warmup;
+    cache_config_t cache;
+    prompt_config_t prompt;
+    local_model_config_t local_model;
     char trigger_key[8];
     int trigger_key_value;
     int enable_proxy_mode;
     int show_startup_messages;
+    int enable_streaming;
+    int enable_shell_channel;
+    int candidates; // Suggestions requested per Ctrl+O for cycling
 } config_t;
 
 // Command suggestion
@@ -119,6 +247,304 @@ typedef struct {
     char history_file[MAX_PATH];
 } command_history_manager_t;
 
+// Per-phase HTTP timings (milliseconds)
+typedef struct {
+    double dns_ms;
+    double connect_ms;
+    double tls_ms;
+    double ttfb_ms;
+    double total_ms;
+    int reused_connection;
+} http_timings_t;
+
+// HTTP request description
+typedef struct {
+    const char *url;
+    const char *headers[MAX_HTTP_HEADERS];
+    int header_count;
+    const char *body;
+    long timeout_ms;
+    // Optional streaming consumer: return 0 to continue, 1 to stop early, -1 on error
+    int (*on_data)(const char *data, size_t len, void *userdata);
+    void *userdata;
+    // Optional: the transfer is aborted once *cancel becomes non-zero
+    const volatile int *cancel;
+} http_request_t;
+
+// HTTP response with growable body buffer
+typedef struct {
+    char *body;
+    size_t len;
+    size_t cap;
+    long status;
+    int stopped_early;
+    int failed;      // Transport error (connect, timeout, reset, ...)
+    int timed_out;
+    int cancelled;   // Aborted through the request's cancel flag
+    http_timings_t timings;
+} http_response_t;
+
+// Growable JSON output buffer
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    int failed;       // Allocation failed or unbalanced nesting
+    int depth;
+    int after_key;
+    unsigned char needs_comma[JSON_WRITER_MAX_DEPTH];
+} json_writer_t;
+
+// Streaming JSON reader: string values (and the text of literals) at target
+// paths are passed to the callback in chunks; return non-zero to stop parsing
+typedef int (*json_stream_string_cb)(int target, const char *data, size_t len, int done, void *userdata);
+
+typedef struct {
+    int segment_count;
+    char segments[JSON_STREAM_MAX_SEGMENTS][JSON_STREAM_KEY_LEN]; // Key, index or "*"
+} json_path_t;
+
+typedef struct {
+    char type;        // '{' or '['
+    int index;        // Current array element
+    char key[JSON_STREAM_KEY_LEN];
+    int key_truncated;
+    unsigned match;   // Targets whose path matches down to the current member
+} json_stream_level_t;
+
+typedef struct {
+    json_path_t paths[JSON_STREAM_MAX_TARGETS];
+    int path_count;
+    json_stream_string_cb on_string;
+    void *userdata;
+
+    int state;
+    int depth;
+    json_stream_level_t levels[JSON_STREAM_MAX_DEPTH];
+    int string_is_key;
+    int string_target;
+    size_t key_len;
+    int unicode_digits;
+    unsigned unicode_value;
+    unsigned high_surrogate;
+    char chunk[256];
+    size_t chunk_len;
+    int stopped;
+} json_stream_t;
+
+// Log-scale latency histogram
+typedef struct {
+    unsigned long counts[LATENCY_BUCKETS];
+    unsigned long total;
+} latency_histogram_t;
+
+// Circuit breaker state of a provider
+typedef enum {
+    BREAKER_CLOSED = 0,
+    BREAKER_OPEN,
+    BREAKER_HALF_OPEN
+} breaker_state_t;
+
+// Provider health snapshot
+typedef struct {
+    char provider[32];
+    breaker_state_t state;
+    int consecutive_failures;
+    int open_remaining_ms;
+    unsigned long successes;
+    unsigned long failures;
+    unsigned long timeouts;
+    unsigned long rejected;
+    unsigned long samples;
+    double p50_ms;
+    double p95_ms;
+    double p99_ms;
+    int timeout_ms;
+} provider_health_t;
+
+// Hedging counters
+typedef struct {
+    unsigned long requests;
+    unsigned long hedged;
+    unsigned long secondary_wins;
+} hedge_stats_t;
+
+// Prompt cache counters, from the usage the providers report
+typedef struct {
+    unsigned long responses;      // Responses that reported usage
+    unsigned long cache_hits;     // Responses with at least one cached token
+    unsigned long prompt_tokens;
+    unsigned long cached_tokens;
+} prompt_cache_stats_t;
+
+// Cancelled request counters: the work done before an answer was dropped
+typedef struct {
+    unsigned long cancelled;
+    unsigned long wasted_ms;             // Time the cancelled requests were in flight
+    unsigned long wasted_prompt_tokens;  // Estimated prompt tokens already sent
+} cancel_stats_t;
+
+// Local command model counters
+typedef struct {
+    unsigned long observed;
+    unsigned long queries;
+    unsigned long misses;
+    unsigned long answers;    // Confident answers given without the LLM
+    unsigned long fallbacks;  // Answers given because the LLM failed
+    unsigned long evictions;
+    int commands;
+} command_model_stats_t;
+
+// Prefetch counters
+typedef struct {
+    unsigned long requests;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long wasted;
+    unsigned long cancelled;  // Requests aborted while in flight
+} prefetch_stats_t;
+
+// Worker pool counters
+typedef struct {
+    int threads;
+    int queued;                 // Jobs waiting for a worker
+    int running;
+    unsigned long submitted;
+    unsigned long completed;
+    unsigned long rejected;     // Submissions refused because the pool was full
+    unsigned long max_queued;
+    unsigned long max_wait_ms;  // Longest time a job waited for a worker
+} worker_pool_stats_t;
+
+// IPC message types. Version 1 frames carry a text command whatever their
+// type; version 2 requests may be typed instead, and responses are typed.
+typedef enum {
+    MSG_TYPE_PING = 1,
+    MSG_TYPE_SUGGESTION = 2,   // Body: the input, from version 3 the client's context (JSON) on a second line
+    MSG_TYPE_CONTEXT = 3,
+    MSG_TYPE_COMMAND = 4,      // Body: a text command ("stats", "suggestion:git st", ...)
+    MSG_TYPE_RESPONSE = 5,
+    MSG_TYPE_ERROR = 6,        // Body: the error, without the "error:" prefix
+    MSG_TYPE_HELLO = 7,        // Body: the highest version the sender speaks
+    MSG_TYPE_PREFETCH = 8,     // Body: as for MSG_TYPE_SUGGESTION
+    MSG_TYPE_CANCEL = 9,       // Body: empty, from version 3 the client's context
+    MSG_TYPE_CHANNEL = 10      // Shell channel handoff: empty body, memfd and eventfd attached
+} ipc_message_type_t;
+
+// A frame of the IPC protocol
+typedef struct {
+    uint32_t version;
+    uint32_t type;             // ipc_message_type_t
+    uint32_t request_id;       // Version 2: echoed in the response
+    uint32_t length;           // Of the body
+    char *body;
+} ipc_frame_t;
+
+// IPC server counters
+typedef struct {
+    int clients;                // Connections open now
+    int max_clients;
+    unsigned long accepted;
+    unsigned long rejected;     // Connections refused (table full, no memory)
+    unsigned long requests;
+    unsigned long responses;
+    unsigned long busy_waits;   // Requests that had to wait for a free worker
+    unsigned long malformed;    // Connections closed for an invalid frame
+    unsigned long stalled;      // Connections closed for a half-sent request
+    unsigned long v2_clients;   // Connections that agreed on version 2
+    int max_in_flight;          // Most requests in flight on one connection
+} ipc_server_stats_t;
+
+// Shell channel event types
+typedef enum {
+    SHELL_EVENT_LINE = 1,      // Data: the line being typed
+    SHELL_EVENT_CWD = 2,       // Data: the new working directory
+    SHELL_EVENT_EXIT = 3       // Value: exit status of the last command
+} shell_event_type_t;
+
+// Producer end of a shell channel (the shell's completion client)
+struct shell_ring;
+typedef struct {
+    int memfd;
+    int event_fd;
+    struct shell_ring *ring;
+} shell_channel_t;
+
+// What an attached shell reported last
+typedef struct {
+    int pid;                    // Of its completion client
+    char cwd[MAX_PATH];
+    char line[SHELL_EVENT_DATA];
+    int last_status;            // -1 before the first command
+    unsigned long events;
+    unsigned long dropped;      // Published while its ring was full
+    int idle_ms;                // Since its last event, -1 if none
+} shell_state_t;
+
+// Shell channel counters
+typedef struct {
+    int channels;               // Attached now
+    unsigned long attached;
+    unsigned long rejected;     // Rings that failed validation, or no room
+    unsigned long events;
+    unsigned long wakeups;      // Times a producer had to write the eventfd
+} shell_channel_stats_t;
+
+// Where a response goes: the connection, and the request it answers
+typedef struct {
+    uint64_t client_id;
+    uint32_t request_id;        // Version 2 only
+    uint32_t version;           // Of the request's frame, used for the response
+} ipc_reply_to_t;
+
+// Warm-up state of a provider connection
+typedef enum {
+    CONNECTION_COLD = 0,  // Not pinged yet
+    CONNECTION_WARM,
+    CONNECTION_FAILED
+} connection_state_t;
+
+// Provider connection snapshot
+typedef struct {
+    char provider[32];
+    char host[128];
+    connection_state_t state;
+    long status;               // HTTP status of the last ping
+    int last_ping_age_ms;      // -1 before the first ping
+    int last_connect_age_ms;   // Since the last new connection; -1 before one
+    double setup_ms;           // DNS + TCP + TLS time of the last new connection
+    double ping_ms;
+    unsigned long pings;
+    unsigned long failures;
+    unsigned long connects;    // Pings that had to open a new connection
+} connection_status_t;
+
+// Request coalescing counters
+typedef struct {
+    unsigned long calls;        // LLM calls made on behalf of a group
+    unsigned long joined;       // Requests that waited for a call in flight
+    unsigned long late_joined;  // Requests that took a just-finished result
+    unsigned long uncoalesced;  // Requests sent alone because the table was full
+} singleflight_stats_t;
+
+// Suggestion cache counters
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long negative_hits;
+    unsigned long evictions;
+    unsigned long expirations;
+    int entries;
+    int capacity;
+} suggestion_cache_stats_t;
+
+// Prefix index counters
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    int entries;
+} prefix_index_stats_t;
+
 // Command line arguments
 typedef struct {
     const char *command;
@@ -132,8 +558,67 @@ typedef struct {
 
 // Function prototypes
 int collect_context(session_context_t *ctx);
+int bash_history_path(char *path, size_t path_size);
+int is_sensitive_command(const char *command);
+int read_git_head(const char *cwd, char *head, size_t head_size);
 int send_to_llm(const char *input, const session_context_t *ctx, const config_t *config, suggestion_t *suggestion);
+int send_to_llm_candidates(const char *input, const session_context_t *ctx, const config_t *config,
+                           suggestion_t *suggestions, int max_suggestions);
+int send_to_llm_cancellable(const char *input, const session_context_t *ctx, const config_t *config,
+                            suggestion_t *suggestion, const volatile int *cancel);
 int load_config(config_t *config);
+int llm_get_last_timings(http_timings_t *timings);
+void llm_build_endpoint(const config_t *config, char *endpoint, size_t size);
+void llm_get_hedge_stats(hedge_stats_t *stats);
+void llm_get_prompt_cache_stats(prompt_cache_stats_t *stats);
+void llm_get_cancel_stats(cancel_stats_t *stats);
+
+// JSON writer functions (finish returns NULL if the output is incomplete)
+int json_writer_init(json_writer_t *w, size_t initial_cap);
+void json_writer_reset(json_writer_t *w);
+void json_writer_free(json_writer_t *w);
+const char *json_writer_finish(json_writer_t *w);
+void json_writer_begin_object(json_writer_t *w);
+void json_writer_end_object(json_writer_t *w);
+void json_writer_begin_array(json_writer_t *w);
+void json_writer_end_array(json_writer_t *w);
+void json_writer_key(json_writer_t *w, const char *key);
+void json_writer_string(json_writer_t *w, const char *str);
+void json_writer_string_begin(json_writer_t *w);
+void json_writer_string_append(json_writer_t *w, const char *str);
+void json_writer_string_end(json_writer_t *w);
+void json_writer_int(json_writer_t *w, long value);
+void json_writer_double(json_writer_t *w, double value);
+void json_writer_bool(json_writer_t *w, int value);
+
+// Streaming JSON reader functions (feed: 0 = ok, 1 = stopped by callback, -1 = syntax error)
+int json_stream_init(json_stream_t *js, const char *const *patterns, int pattern_count,
+                     json_stream_string_cb on_string, void *userdata);
+void json_stream_reset(json_stream_t *js);
+int json_stream_feed(json_stream_t *js, const char *data, size_t len);
+int json_stream_finish(json_stream_t *js);
+int json_stream_done(const json_stream_t *js);
+
+// Prompt assembly functions
+const char *prompt_system_instructions(void);
+int prompt_estimate_tokens(const char *text, size_t len);
+size_t prompt_fit_head(const char *text, int max_tokens);
+const char *prompt_fit_tail(const char *text, int max_tokens);
+char *prompt_build_context(const session_context_t *ctx, const prompt_config_t *budget);
+
+// Latency histogram functions
+void latency_histogram_record(latency_histogram_t *hist, double ms);
+double latency_histogram_percentile(const latency_histogram_t *hist, double percentile);
+
+// Provider health functions (allow: 0 = send, -1 = circuit open)
+int provider_health_allow(const char *provider);
+int provider_health_timeout_ms(const char *provider);
+void provider_health_record_success(const char *provider, double latency_ms);
+void provider_health_record_failure(const char *provider, int timed_out);
+void provider_health_release(const char *provider);
+int provider_health_percentile(const char *provider, double percentile, double *ms);
+int provider_health_get_all(provider_health_t *health, int max);
+const char *breaker_state_name(breaker_state_t state);
 
 // Management and UI functions
 int find_running_daemon(daemon_session_t *info);
@@ -175,13 +660,124 @@ void cleanup_daemon_pty(daemon_pty_t *pty);
 int read_from_daemon_pty(daemon_pty_t *pty, char *buffer, size_t buffer_size);
 int write_to_daemon_pty(daemon_pty_t *pty, const char *data, size_t len);
 int get_daemon_pty_context(daemon_pty_t *pty, char *context, size_t context_size);
+int get_daemon_pty_cwd(daemon_pty_t *pty, char *cwd, size_t cwd_size);
 
 // IPC-related functions
 int create_ipc_socket(const char *socket_path);
 int accept_ipc_connection(int server_fd);
 int send_ipc_message(int fd, const char *message);
+size_t ipc_header_size(uint32_t version);
+size_t ipc_max_payload(uint32_t version);
+int ipc_encode_header(const ipc_frame_t *frame, char *dst);
+int ipc_parse_header(const char *data, size_t len, ipc_frame_t *frame);
+int ipc_validate_body(const ipc_frame_t *frame);
+char *ipc_request_text(uint32_t type, const char *body);
+int ipc_send_frame(int fd, const ipc_frame_t *frame);
+int ipc_send_frame_fds(int fd, const ipc_frame_t *frame, const int *fds, int fd_count);
+int ipc_receive_frame(int fd, ipc_frame_t *frame);
+void ipc_frame_free(ipc_frame_t *frame);
+int ipc_negotiate(int fd, int timeout_ms);
 int receive_ipc_message(int fd, char *buffer, size_t buffer_size);
 void cleanup_ipc_socket(const char *socket_path);
+int connect_to_daemon(const char *socket_path);
+int connect_to_daemon_timeout(const char *socket_path, int connect_timeout_ms, int io_timeout_ms);
+int send_daemon_request(const char *socket_path, const char *request, char *response, size_t response_size);
+int ping_daemon(const char *socket_path);
+
+// IPC server functions (daemon side; driven by its epoll loop)
+#define IPC_REQUEST_DONE 0       // Answered through ipc_server_respond()
+#define IPC_REQUEST_ASYNC 1      // Answer follows later
+#define IPC_REQUEST_BUSY 2       // Retry after ipc_server_resume()
+typedef int (*ipc_request_fn)(const ipc_reply_to_t *reply_to, const char *request, void *userdata);
+int ipc_server_init(int epoll_fd, int listen_fd, ipc_request_fn on_request, void *userdata);
+int ipc_server_handle_event(uint64_t key, uint32_t events);
+int ipc_server_respond(const ipc_reply_to_t *reply_to, const char *response);
+// Owns the fds, which came over the connection client_id; 0 if taken
+typedef int (*ipc_channel_fn)(uint64_t client_id, const int *fds, int fd_count, void *userdata);
+void ipc_server_set_channel_handler(ipc_channel_fn on_channel);
+void ipc_server_resume(void);
+void ipc_server_sweep(void);
+void ipc_server_get_stats(ipc_server_stats_t *stats);
+void ipc_server_shutdown(void);
+
+// HTTP client functions
+int http_client_init(void);
+void http_client_cleanup(void);
+int http_post(const http_request_t *req, http_response_t *resp);
+int http_prewarm(const char *url, http_response_t *resp);
+int http_post_hedged(const http_request_t *primary, const http_request_t *secondary, int delay_ms,
+                     http_response_t *primary_resp, http_response_t *secondary_resp,
+                     int *winner, int *secondary_sent);
+void http_response_free(http_response_t *resp);
+
+// Prefetch functions
+int prefetch_start(uint64_t owner, const char *input, uint64_t context_key,
+                   const session_context_t *ctx, const config_t *config);
+int prefetch_lookup(uint64_t owner, const char *input, uint64_t context_key, suggestion_t *suggestion, int wait_ms);
+int prefetch_cancel(uint64_t owner);
+void prefetch_get_stats(prefetch_stats_t *stats);
+void prefetch_shutdown(void);
+
+// Request coalescing functions
+int singleflight_send_to_llm_candidates(uint64_t key, const char *input, const session_context_t *ctx,
+                                        const config_t *config, suggestion_t *suggestions, int max_suggestions);
+void singleflight_get_stats(singleflight_stats_t *stats);
+
+// Worker pool functions (jobs run on a worker; the main loop collects them)
+typedef void (*worker_fn)(void *arg);
+int worker_pool_start(void);
+int worker_pool_submit(worker_fn run, void *arg);
+int worker_pool_event_fd(void);
+void *worker_pool_take_completed(void);
+void worker_pool_get_stats(worker_pool_stats_t *stats);
+void worker_pool_shutdown(worker_fn drop);
+
+// Connection warm-up functions
+int warmup_start(const config_t *config);
+int warmup_get_all(connection_status_t *connections, int max);
+const char *connection_state_name(connection_state_t state);
+void warmup_shutdown(void);
+
+// Suggestion cache functions (get: 0 = hit, 1 = cached failure, -1 = miss)
+uint64_t context_fingerprint(const char *input, const char *cwd, const char *git_head, const char *recent_commands);
+int suggestion_cache_configure(int max_entries);
+int suggestion_cache_get(uint64_t key, suggestion_t *suggestion);
+void suggestion_cache_put(uint64_t key, const suggestion_t *suggestion, int ttl_ms);
+void suggestion_cache_put_negative(uint64_t key, int ttl_ms);
+void suggestion_cache_get_stats(suggestion_cache_stats_t *stats);
+void suggestion_cache_shutdown(void);
+
+// Shell channel functions (create, publish and destroy are the shell's side)
+int shell_channel_create(shell_channel_t *channel);
+int shell_channel_publish(shell_channel_t *channel, shell_event_type_t type, int value, const char *data);
+void shell_channel_destroy(shell_channel_t *channel);
+int shell_channel_init(int epoll_fd);
+int shell_channel_attach(int memfd, int event_fd, uint64_t owner);
+int shell_channel_handle_event(int fd);
+int shell_channel_find(uint64_t owner, shell_state_t *state);
+int shell_channel_get_all(shell_state_t *states, int max);
+void shell_channel_sweep(void);
+void shell_channel_get_stats(shell_channel_stats_t *stats);
+void shell_channel_shutdown(void);
+
+// Shared (memory-mapped) suggestion cache functions
+int shm_cache_open(void);
+void shm_cache_close(void);
+uint64_t shm_cache_key(const char *input, const char *cwd);
+int shm_cache_get(uint64_t key, suggestion_t *suggestion);
+void shm_cache_put(uint64_t key, const suggestion_t *suggestion, int ttl_seconds);
+
+// Prefix index functions ('+' completions reused while the input extends them)
+void prefix_index_put(uint64_t context, const char *input, const suggestion_t *suggestion, int ttl_ms);
+int prefix_index_lookup(uint64_t context, const char *input, suggestion_t *suggestion);
+void prefix_index_get_stats(prefix_index_stats_t *stats);
+
+// Local command model functions (predict returns the times the command was
+// seen, or -1 without a prediction)
+int command_model_sync_history(const char *path);
+int command_model_predict(const char *input, suggestion_t *suggestion, double *confidence);
+void command_model_record_answer(int fallback);
+void command_model_get_stats(command_model_stats_t *stats);
 
 // Security functions
 int check_safe_environment();
@@ -194,6 +790,7 @@ int init_command_history(command_history_manager_t *manager, const char *session
 void cleanup_command_history(command_history_manager_t *manager);
 int add_command_to_history(command_history_manager_t *manager, const char *command);
 int get_recent_commands(command_history_manager_t *manager, char *recent_commands, int count, time_t max_age);
+int get_recent_history(command_history_manager_t *manager, char *history, size_t history_size, time_t max_age);
 int save_command_history(command_history_manager_t *manager);
 int load_command_history(command_history_manager_t *manager);
 
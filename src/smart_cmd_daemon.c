@@ -6,30 +6,40 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 
-#define MAX_IPC_MESSAGE_SIZE 4096
+#define DAEMON_MAX_EVENTS 16
+#define DAEMON_HOUSEKEEPING_SECONDS 60
 
 static daemon_session_t g_daemon_info = {0};
 static daemon_pty_t g_daemon_pty = {0};
 static command_history_manager_t g_command_history = {0};
 static volatile sig_atomic_t g_running = 1;
 
-void daemon_signal_handler(int signum) {
-    switch (signum) {
-    case SIGTERM:
-    case SIGINT:
-        g_running = 0;
-        break;
-    case SIGCHLD:
-        // Handle child process termination
-        wait(NULL);
-        break;
-    }
-}
-
-int setup_daemon_main_signal_handlers() {
-    setup_signal_handlers(daemon_signal_handler);
-    return 0;
+// Guards the PTY output buffer and the command history, which the main loop
+// and the workers share
+static pthread_mutex_t g_state_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_use_workers = 0;
+
+// A request run on the worker pool; the main loop sends its response
+typedef struct {
+    ipc_reply_to_t reply_to; // IPC server connection and request the response goes to
+    char response[MAX_CONTEXT_LEN];
+    char request[];          // As long as the request that came in
+} daemon_job_t;
+
+// SIGTERM, SIGINT and SIGCHLD are read from a signalfd in the main loop.
+// They are blocked before any thread starts, so every thread inherits the
+// mask and none of them takes the signal instead.
+static int block_daemon_signals(sigset_t *signals) {
+    sigemptyset(signals);
+    sigaddset(signals, SIGTERM);
+    sigaddset(signals, SIGINT);
+    sigaddset(signals, SIGCHLD);
+    return sigprocmask(SIG_BLOCK, signals, NULL);
 }
 
 static void print_usage(const char *program_name) {
@@ -168,131 +178,747 @@ int daemon_stop() {
     return 1;
 }
 
-int daemon_main_loop(int server_fd, int debug) {
-    if (debug) {
-        printf("Daemon main loop started (server_fd: %d)\n", server_fd);
+// Context for a request that came over the connection client_id.
+// client_context is what the client sent about the shell the request comes
+// from (JSON: directory, git branch, last exit status), NULL from clients
+// that send nothing; the shell channel of that connection and the daemon's
+// own PTY only fill in what it leaves out.
+static void build_request_context(session_context_t *ctx, char *recent_commands,
+                                  uint64_t client_id, const char *client_context) {
+    memset(ctx, 0, sizeof(session_context_t));
+    ctx->shell_prompts = -1;
+    recent_commands[0] = '\0';
+
+    if (client_context) {
+        parse_completion_context(client_context, ctx);
     }
 
-    while (g_running) {
-        // Handle incoming IPC connections
-        int client_fd = accept_ipc_connection(server_fd);
-        if (client_fd > 0) {
-            if (debug) {
-                printf("Accepted client connection\n");
-            }
+    pthread_mutex_lock(&g_state_lock);
 
-            char request[MAX_IPC_MESSAGE_SIZE];
-            int result = receive_ipc_message(client_fd, request, sizeof(request));
-            if (result > 0) {
-                if (debug) {
-                    printf("Received request: %s\n", request);
-                }
+    // Use PTY buffer for context if available
+    if (g_daemon_pty.active) {
+        get_daemon_pty_context(&g_daemon_pty, ctx->terminal_buffer, sizeof(ctx->terminal_buffer));
+        if (!ctx->user.cwd[0]) {
+            get_daemon_pty_cwd(&g_daemon_pty, ctx->user.cwd, sizeof(ctx->user.cwd));
+        }
+    }
 
-                char response[MAX_IPC_MESSAGE_SIZE];
-                memset(response, 0, sizeof(response));
-
-                // Process request
-                if (strcmp(request, "ping") == 0) {
-                    snprintf(response, sizeof(response), "%s", "pong");
-                } else if (strncmp(request, "suggestion:", 11) == 0) {
-                    printf("Received suggestion request: %s\n", request);
-                    // Extract input from request: suggestion:<command>
-                    const char *input = request + 11;
-                    printf("Parsed Input: %s\n", input);
-
-                    // Add command to history
-                    add_command_to_history(&g_command_history, input);
-
-                    // Use PTY buffer for context if available
-                    session_context_t ctx;
-                    memset(&ctx, 0, sizeof(ctx));
-                    if (g_daemon_pty.active) {
-                        get_daemon_pty_context(&g_daemon_pty, ctx.terminal_buffer, sizeof(ctx.terminal_buffer));
-                    }
+    // The last few commands key the cache; the prompt gets as many as its budget allows
+    get_recent_commands(&g_command_history, recent_commands, MAX_HISTORY_MESSAGES, 3600);
+    get_recent_history(&g_command_history, ctx->recent_history, sizeof(ctx->recent_history), 3600);
 
-                    printf("Context before LLM call:\n");
-                    printf("  Terminal Buffer: <start>%s<end>\n", ctx.terminal_buffer);
-                    fflush(stdout);
+    pthread_mutex_unlock(&g_state_lock);
 
-                    // Add recent command history to the end of the context if there's space
-                    char recent_commands[1024] = {0};
-                    if (get_recent_commands(&g_command_history, recent_commands, MAX_HISTORY_MESSAGES, 3600) > 0) {
-                        size_t current_len = strlen(ctx.terminal_buffer);
-                        snprintf(ctx.terminal_buffer + current_len, sizeof(ctx.terminal_buffer) - current_len,
-                                 "\n\nRecent user commands:\n%s", recent_commands);
-                    }
+    // The shell the request comes from reports its directory and how the last command went
+    shell_state_t shell;
+    if (shell_channel_find(client_id, &shell) == 0) {
+        if (!ctx->user.cwd[0] && shell.cwd[0]) {
+            safe_string_copy(ctx->user.cwd, shell.cwd, sizeof(ctx->user.cwd));
+        }
+        if (!ctx->environment[0] && shell.last_status >= 0) {
+            snprintf(ctx->environment, sizeof(ctx->environment), "Last exit status: %d", shell.last_status);
+        }
+    }
+}
 
-                    // Load config and get suggestion
-                    config_t config;
-                    if (load_config(&config) == 0) {
-                        suggestion_t suggestion;
-                        if (send_to_llm(input, &ctx, &config, &suggestion) == 0) {
-                            snprintf(response, sizeof(response), "%c%s",
-                                   suggestion.type, suggestion.suggestion);
-                        } else {
-                            snprintf(response, sizeof(response), "%s", "error:Failed to get AI suggestion");
-                        }
-                    } else {
-                        snprintf(response, sizeof(response), "%s", "error:Failed to load configuration");
-                    }
-                } else if (strncmp(request, "context", 7) == 0) {
-                    // Return current context
-                    if (g_daemon_pty.active) {
-                        char pty_context[MAX_CONTEXT_LEN];
-                        if (get_daemon_pty_context(&g_daemon_pty, pty_context, sizeof(pty_context)) > 0) {
-                            // Truncate context to fit in response buffer
-                            snprintf(response, sizeof(response), "%.4000s", pty_context);
-                        }
-                    } else {
-                        snprintf(response, sizeof(response), "%s", "error:No active PTY session");
-                    }
-                } else {
-                    snprintf(response, sizeof(response), "%s", "error:Unknown request");
-                }
+// Fingerprint of where a prefetch is made and used: directory, git HEAD
+// and recent commands, without the input. A shell that counts its prompts
+// says when it has run a command itself, so what other shells ask for
+// does not make its prefetch stale.
+static uint64_t prefetch_context_key(const session_context_t *ctx, const char *recent_commands) {
+    char git_head[128];
+    read_git_head(ctx->user.cwd[0] ? ctx->user.cwd : "/", git_head, sizeof(git_head));
+
+    char prompts[32];
+    if (ctx->shell_prompts >= 0) {
+        snprintf(prompts, sizeof(prompts), "prompt %d", ctx->shell_prompts);
+        recent_commands = prompts;
+    }
+    return context_fingerprint(NULL, ctx->user.cwd, git_head, recent_commands);
+}
 
-                if (debug) {
-                    printf("Sending response: %s\n", response);
-                }
+// Whose prefetch a request uses: the shell the client names, or the
+// connection of a client that names none
+static uint64_t prefetch_owner(uint64_t client_id, const session_context_t *ctx) {
+    return ctx->shell_pid > 0 ? PREFETCH_OWNER_SHELL | (uint64_t)ctx->shell_pid : client_id;
+}
 
-                // Send response
-                if (send_ipc_message(client_fd, response) == -1) {
-                    if (debug) {
-                        printf("Failed to send response\n");
-                    }
-                }
+// The same for a request that carries nothing but the client's context
+static uint64_t request_prefetch_owner(uint64_t client_id, const char *client_context) {
+    session_context_t *ctx = client_context ? calloc(1, sizeof(session_context_t)) : NULL;
+    uint64_t owner = client_id;
+    if (ctx && parse_completion_context(client_context, ctx) == 0) {
+        owner = prefetch_owner(client_id, ctx);
+    }
+    free(ctx);
+    return owner;
+}
+
+// Fingerprint and owner of the prefetch for the context right now, before
+// a request adds its input to the history
+static uint64_t current_prefetch_context_key(uint64_t client_id, const char *client_context, uint64_t *owner) {
+    session_context_t *ctx = malloc(sizeof(session_context_t));
+    char *recent_commands = malloc(MAX_CONTEXT_LEN);
+    uint64_t key = 0;
+    *owner = client_id;
+    if (ctx && recent_commands) {
+        build_request_context(ctx, recent_commands, client_id, client_context);
+        key = prefetch_context_key(ctx, recent_commands);
+        *owner = prefetch_owner(client_id, ctx);
+    }
+    free(ctx);
+    free(recent_commands);
+    return key;
+}
+
+static void record_command(const char *input) {
+    pthread_mutex_lock(&g_state_lock);
+    add_command_to_history(&g_command_history, input);
+    pthread_mutex_unlock(&g_state_lock);
+}
+
+static void format_suggestion_response(const suggestion_t *suggestion, char *response, size_t response_size) {
+    snprintf(response, response_size, "%c%s", suggestion->type, suggestion->suggestion);
+}
+
+// One suggestion per line, best first; a line that does not fit is left out
+static void format_suggestions_response(const suggestion_t *suggestions, int count,
+                                        char *response, size_t response_size) {
+    size_t pos = 0;
+    response[0] = '\0';
+    for (int i = 0; i < count; i++) {
+        int written = snprintf(response + pos, response_size - pos, "%s%c%s",
+                               i > 0 ? "\n" : "", suggestions[i].type, suggestions[i].suggestion);
+        if (written < 0 || (size_t)written >= response_size - pos) {
+            response[pos] = '\0';
+            break;
+        }
+        pos += (size_t)written;
+    }
+}
+
+// Ask the local command model; fallback lowers the bar to any prediction
+static int local_model_answer(const config_t *config, const char *input, int fallback, suggestion_t *suggestion) {
+    if (!config->local_model.enabled) return -1;
+
+    char history_path[MAX_PATH];
+    if (bash_history_path(history_path, sizeof(history_path)) == 0) {
+        command_model_sync_history(history_path);
+    }
+
+    double confidence;
+    int count = command_model_predict(input, suggestion, &confidence);
+    if (count < 0) return -1;
+    if (!fallback && (count < config->local_model.min_count ||
+                      confidence < config->local_model.min_confidence)) {
+        return -1;
+    }
+
+    printf("Local model %s for: %s (confidence %.2f, seen %d times)\n",
+           fallback ? "fallback" : "answer", input, confidence, count);
+    command_model_record_answer(fallback);
+    return 0;
+}
+
+static void handle_suggestion_request(const char *input, uint64_t client_id, const char *client_context,
+                                      char *response, size_t response_size) {
+    printf("Parsed Input: %s\n", input);
+
+    config_t config;
+    int config_loaded = load_config(&config) == 0;
+    uint64_t prefetch_owner_id = 0;
+    uint64_t prefetch_key = config_loaded && config.prefetch.enabled ?
+                            current_prefetch_context_key(client_id, client_context, &prefetch_owner_id) : 0;
+
+    // Add command to history
+    record_command(input);
+
+    if (!config_loaded) {
+        snprintf(response, response_size, "%s", "error:Failed to load configuration");
+        return;
+    }
+
+    suggestion_t suggestion;
+
+    session_context_t ctx;
+    char recent_commands[MAX_CONTEXT_LEN];
+    build_request_context(&ctx, recent_commands, client_id, client_context);
+
+    // The same input in the same context asks the same question
+    char git_head[128];
+    read_git_head(ctx.user.cwd[0] ? ctx.user.cwd : "/", git_head, sizeof(git_head));
+    uint64_t request_key = context_fingerprint(input, ctx.user.cwd, git_head, recent_commands);
+
+    // Same question recently: answer without a network round trip
+    uint64_t cache_key = 0;
+    uint64_t prefix_context = 0;
+    if (config.cache.enabled && suggestion_cache_configure(config.cache.max_entries) == 0) {
+        cache_key = request_key;
+        prefix_context = context_fingerprint(NULL, ctx.user.cwd, git_head, NULL);
+
+        int cached = suggestion_cache_get(cache_key, &suggestion);
+        if (cached == -1 && config.cache.persistent && shm_cache_open() == 0 &&
+            shm_cache_get(shm_cache_key(input, ctx.user.cwd), &suggestion) == 0) {
+            // Promote entries from the shared on-disk cache
+            suggestion_cache_put(cache_key, &suggestion, config.cache.ttl_seconds * 1000);
+            cached = 0;
+        }
+
+        if (cached == 0) {
+            printf("Cache hit for: %s\n", input);
+            format_suggestion_response(&suggestion, response, response_size);
+            return;
+        } else if (cached == 1) {
+            printf("Negative cache hit for: %s\n", input);
+            if (local_model_answer(&config, input, 1, &suggestion) == 0) {
+                format_suggestion_response(&suggestion, response, response_size);
+            } else {
+                snprintf(response, response_size, "%s", "error:Failed to get AI suggestion");
             }
+            return;
+        }
+
+        // Still typing into a recent completion: it covers this input too
+        if (prefix_index_lookup(prefix_context, input, &suggestion) == 0) {
+            printf("Prefix hit for: %s\n", input);
+            format_suggestion_response(&suggestion, response, response_size);
+            return;
+        }
+    }
+
+    // A speculative request this shell made for this input, in this
+    // directory, may already be done or in flight. It is only looked at
+    // after the caches, which answer without waiting.
+    if (config.prefetch.enabled &&
+        prefetch_lookup(prefetch_owner_id, input, prefetch_key, &suggestion, PREFETCH_WAIT_MS) == 0) {
+        printf("Prefetch hit for: %s\n", input);
+        format_suggestion_response(&suggestion, response, response_size);
+        if (cache_key != 0) {
+            suggestion_cache_put(cache_key, &suggestion, config.cache.ttl_seconds * 1000);
+            prefix_index_put(prefix_context, input, &suggestion, config.cache.ttl_seconds * 1000);
+        }
+        return;
+    }
 
-            close(client_fd);
-        } else if (client_fd == -1) {
-            if (debug) {
-                printf("Failed to accept connection (real error)\n");
+    // Commands the user runs all the time are answered from memory
+    if (local_model_answer(&config, input, 0, &suggestion) == 0) {
+        format_suggestion_response(&suggestion, response, response_size);
+        return;
+    }
+
+    printf("Context before LLM call:\n");
+    printf("  Terminal Buffer: <start>%s<end>\n", ctx.terminal_buffer);
+    fflush(stdout);
+
+    // Identical requests already in flight share its call, which asks for
+    // every candidate the shell cycles through
+    suggestion_t candidates[MAX_CANDIDATES];
+    int candidate_count = singleflight_send_to_llm_candidates(request_key, input, &ctx, &config,
+                                                              candidates, config.candidates);
+
+    http_timings_t timings;
+    if (llm_get_last_timings(&timings) == 0) {
+        printf("HTTP timings: dns=%.1fms connect=%.1fms tls=%.1fms ttfb=%.1fms total=%.1fms%s\n",
+               timings.dns_ms, timings.connect_ms, timings.tls_ms,
+               timings.ttfb_ms, timings.total_ms,
+               timings.reused_connection ? " (reused connection)" : "");
+        fflush(stdout);
+    }
+
+    if (candidate_count > 0) {
+        format_suggestions_response(candidates, candidate_count, response, response_size);
+    } else {
+        // Provider unreachable or broken: the local model is better than nothing
+        suggestion_t local;
+        if (local_model_answer(&config, input, 1, &local) == 0) {
+            format_suggestion_response(&local, response, response_size);
+        } else {
+            snprintf(response, response_size, "%s", "error:Failed to get AI suggestion");
+        }
+    }
+
+    if (config.cache.enabled && cache_key != 0) {
+        // The caches keep the best candidate
+        if (candidate_count > 0) {
+            suggestion_cache_put(cache_key, &candidates[0], config.cache.ttl_seconds * 1000);
+            prefix_index_put(prefix_context, input, &candidates[0], config.cache.ttl_seconds * 1000);
+            if (config.cache.persistent && shm_cache_open() == 0) {
+                shm_cache_put(shm_cache_key(input, ctx.user.cwd), &candidates[0], config.cache.ttl_seconds);
             }
-            // Don't spam the log - sleep briefly to prevent rapid error loops
-            usleep(100000); // 100ms
+        } else {
+            suggestion_cache_put_negative(cache_key, config.cache.negative_ttl_seconds * 1000);
         }
+    }
+}
+
+static void handle_prefetch_request(const char *input, uint64_t client_id, const char *client_context,
+                                    char *response, size_t response_size) {
+    config_t config;
+    if (load_config(&config) != 0) {
+        snprintf(response, response_size, "%s", "error:Failed to load configuration");
+        return;
+    }
+
+    if (!config.prefetch.enabled) {
+        snprintf(response, response_size, "%s", "error:Prefetch disabled");
+        return;
+    }
+
+    session_context_t ctx;
+    char recent_commands[MAX_CONTEXT_LEN];
+    build_request_context(&ctx, recent_commands, client_id, client_context);
+
+    if (prefetch_start(prefetch_owner(client_id, &ctx), input, prefetch_context_key(&ctx, recent_commands),
+                       &ctx, &config) == 0) {
+        snprintf(response, response_size, "%s", "ok");
+    } else {
+        snprintf(response, response_size, "%s", "error:Failed to start prefetch");
+    }
+}
+
+static void handle_prefetched_request(const char *input, uint64_t client_id, const char *client_context,
+                                      char *response, size_t response_size) {
+    uint64_t owner;
+    uint64_t context_key = current_prefetch_context_key(client_id, client_context, &owner);
+    suggestion_t suggestion;
+    if (prefetch_lookup(owner, input, context_key, &suggestion, PREFETCH_WAIT_MS) == 0) {
+        record_command(input);
+        format_suggestion_response(&suggestion, response, response_size);
+    } else {
+        snprintf(response, response_size, "%s", "miss");
+    }
+}
+
+static void handle_stats_request(char *response, size_t response_size) {
+    prefetch_stats_t prefetch;
+    prefetch_get_stats(&prefetch);
+
+    suggestion_cache_stats_t cache;
+    suggestion_cache_get_stats(&cache);
+
+    prefix_index_stats_t prefix;
+    prefix_index_get_stats(&prefix);
+
+    hedge_stats_t hedge;
+    llm_get_hedge_stats(&hedge);
+
+    prompt_cache_stats_t prompt_cache;
+    llm_get_prompt_cache_stats(&prompt_cache);
+
+    command_model_stats_t model;
+    command_model_get_stats(&model);
+
+    singleflight_stats_t flights;
+    singleflight_get_stats(&flights);
+
+    cancel_stats_t cancelled;
+    llm_get_cancel_stats(&cancelled);
+
+    worker_pool_stats_t workers;
+    worker_pool_get_stats(&workers);
+
+    ipc_server_stats_t ipc;
+    ipc_server_get_stats(&ipc);
+
+    shell_channel_stats_t shells;
+    shell_channel_get_stats(&shells);
+
+    snprintf(response, response_size,
+             "prefetch_requests=%lu prefetch_hits=%lu prefetch_misses=%lu prefetch_wasted=%lu prefetch_cancelled=%lu "
+             "cache_hits=%lu cache_misses=%lu cache_negative_hits=%lu cache_evictions=%lu "
+             "cache_expirations=%lu cache_entries=%d/%d "
+             "prefix_hits=%lu prefix_misses=%lu prefix_entries=%d "
+             "hedge_requests=%lu hedge_sent=%lu hedge_secondary_wins=%lu "
+             "prompt_cache_responses=%lu prompt_cache_hits=%lu prompt_tokens=%lu prompt_cached_tokens=%lu "
+             "model_commands=%d model_queries=%lu model_misses=%lu model_answers=%lu model_fallbacks=%lu "
+             "coalesce_calls=%lu coalesce_joined=%lu coalesce_late_joined=%lu coalesce_uncoalesced=%lu "
+             "cancelled_requests=%lu cancelled_wasted_ms=%lu cancelled_prompt_tokens=%lu "
+             "workers=%d workers_queued=%d workers_running=%d workers_submitted=%lu workers_completed=%lu "
+             "workers_rejected=%lu workers_max_queued=%lu workers_max_wait_ms=%lu "
+             "ipc_clients=%d ipc_max_clients=%d ipc_accepted=%lu ipc_rejected=%lu ipc_requests=%lu "
+             "ipc_busy_waits=%lu ipc_malformed=%lu ipc_stalled=%lu ipc_v2_clients=%lu ipc_max_in_flight=%d "
+             "shell_channels=%d shell_attached=%lu shell_rejected=%lu shell_events=%lu shell_wakeups=%lu",
+             prefetch.requests, prefetch.hits, prefetch.misses, prefetch.wasted, prefetch.cancelled,
+             cache.hits, cache.misses, cache.negative_hits, cache.evictions,
+             cache.expirations, cache.entries, cache.capacity,
+             prefix.hits, prefix.misses, prefix.entries,
+             hedge.requests, hedge.hedged, hedge.secondary_wins,
+             prompt_cache.responses, prompt_cache.cache_hits,
+             prompt_cache.prompt_tokens, prompt_cache.cached_tokens,
+             model.commands, model.queries, model.misses, model.answers, model.fallbacks,
+             flights.calls, flights.joined, flights.late_joined, flights.uncoalesced,
+             cancelled.cancelled, cancelled.wasted_ms, cancelled.wasted_prompt_tokens,
+             workers.threads, workers.queued, workers.running, workers.submitted, workers.completed,
+             workers.rejected, workers.max_queued, workers.max_wait_ms,
+             ipc.clients, ipc.max_clients, ipc.accepted, ipc.rejected, ipc.requests,
+             ipc.busy_waits, ipc.malformed, ipc.stalled, ipc.v2_clients, ipc.max_in_flight,
+             shells.channels, shells.attached, shells.rejected, shells.events, shells.wakeups);
+}
+
+static void handle_health_request(char *response, size_t response_size) {
+    provider_health_t health[MAX_PROVIDERS];
+    int count = provider_health_get_all(health, MAX_PROVIDERS);
+
+    size_t pos = 0;
+    response[0] = '\0';
+    for (int i = 0; i < count && pos < response_size; i++) {
+        pos += snprintf(response + pos, response_size - pos,
+                        "%sprovider=%s state=%s consecutive_failures=%d open_remaining_ms=%d "
+                        "successes=%lu failures=%lu timeouts=%lu rejected=%lu samples=%lu "
+                        "p50_ms=%.0f p95_ms=%.0f p99_ms=%.0f timeout_ms=%d",
+                        i > 0 ? "\n" : "", health[i].provider, breaker_state_name(health[i].state),
+                        health[i].consecutive_failures, health[i].open_remaining_ms,
+                        health[i].successes, health[i].failures, health[i].timeouts,
+                        health[i].rejected, health[i].samples,
+                        health[i].p50_ms, health[i].p95_ms, health[i].p99_ms, health[i].timeout_ms);
+    }
+
+    if (count == 0) {
+        snprintf(response, response_size, "%s", "none");
+    }
+}
+
+static void handle_shells_request(char *response, size_t response_size) {
+    shell_state_t shells[SHELL_CHANNEL_MAX];
+    int count = shell_channel_get_all(shells, SHELL_CHANNEL_MAX);
+
+    size_t pos = 0;
+    response[0] = '\0';
+    for (int i = 0; i < count && pos < response_size; i++) {
+        pos += snprintf(response + pos, response_size - pos,
+                        "%spid=%d cwd=%s last_status=%d line_length=%zu events=%lu dropped=%lu idle_ms=%d",
+                        i > 0 ? "\n" : "", shells[i].pid, shells[i].cwd[0] ? shells[i].cwd : "-",
+                        shells[i].last_status, strlen(shells[i].line),
+                        shells[i].events, shells[i].dropped, shells[i].idle_ms);
+    }
+
+    if (count == 0) {
+        snprintf(response, response_size, "%s", "none");
+    }
+}
 
-        // Read from PTY if active
+static void handle_connections_request(char *response, size_t response_size) {
+    connection_status_t connections[WARMUP_MAX_ENDPOINTS];
+    int count = warmup_get_all(connections, WARMUP_MAX_ENDPOINTS);
+
+    size_t pos = 0;
+    response[0] = '\0';
+    for (int i = 0; i < count && pos < response_size; i++) {
+        pos += snprintf(response + pos, response_size - pos,
+                        "%sprovider=%s host=%s state=%s status=%ld last_ping_age_ms=%d "
+                        "last_connect_age_ms=%d setup_ms=%.1f ping_ms=%.1f pings=%lu failures=%lu connects=%lu",
+                        i > 0 ? "\n" : "", connections[i].provider, connections[i].host,
+                        connection_state_name(connections[i].state), connections[i].status,
+                        connections[i].last_ping_age_ms, connections[i].last_connect_age_ms,
+                        connections[i].setup_ms, connections[i].ping_ms,
+                        connections[i].pings, connections[i].failures, connections[i].connects);
+    }
+
+    if (count == 0) {
+        snprintf(response, response_size, "%s", "none");
+    }
+}
+
+// Requests that load the config, build context or may wait on the network
+static int is_worker_request(const char *request) {
+    return strncmp(request, "suggestion:", 11) == 0 ||
+           strncmp(request, "prefetch:", 9) == 0 ||
+           strncmp(request, "prefetched:", 11) == 0;
+}
+
+// Length of a worker request's input: its body up to the end of the first
+// line. Version 3 clients send the shell's context as JSON on the next one.
+static size_t request_input_length(const char *request) {
+    const char *body = strchr(request, ':') + 1;
+    return strcspn(body, "\n");
+}
+
+static void run_worker_request(const ipc_reply_to_t *reply_to, const char *request,
+                               char *response, size_t response_size) {
+    const char *body = strchr(request, ':') + 1;
+    size_t input_len = request_input_length(request);
+    const char *client_context = body[input_len] == '\n' ? body + input_len + 1 : NULL;
+
+    // handle_request() has turned away inputs that do not fit
+    char input[MAX_INPUT_LEN];
+    snprintf(input, sizeof(input), "%.*s", (int)input_len, body);
+
+    if (strncmp(request, "suggestion:", 11) == 0) {
+        printf("Received suggestion request: suggestion:%s\n", input);
+        handle_suggestion_request(input, reply_to->client_id, client_context, response, response_size);
+    } else if (strncmp(request, "prefetch:", 9) == 0) {
+        handle_prefetch_request(input, reply_to->client_id, client_context, response, response_size);
+    } else if (strncmp(request, "prefetched:", 11) == 0) {
+        handle_prefetched_request(input, reply_to->client_id, client_context, response, response_size);
+    }
+}
+
+static void run_daemon_job(void *arg) {
+    daemon_job_t *job = arg;
+    run_worker_request(&job->reply_to, job->request, job->response, sizeof(job->response));
+}
+
+// A queued job the pool will not run because the daemon is stopping
+static void drop_daemon_job(void *arg) {
+    daemon_job_t *job = arg;
+    snprintf(job->response, sizeof(job->response), "%s", "error:Daemon shutting down");
+}
+
+static void send_response(const ipc_reply_to_t *reply_to, const char *response, int debug) {
+    if (debug) {
+        printf("Sending response: %s\n", response);
+    }
+
+    if (ipc_server_respond(reply_to, response) == -1) {
+        if (debug) {
+            printf("Failed to send response (client gone)\n");
+        }
+    }
+}
+
+// Answer the clients whose requests the workers have finished, then let
+// connections that found the pool full try again
+static void send_completed_jobs(int debug) {
+    daemon_job_t *job;
+    while ((job = worker_pool_take_completed()) != NULL) {
+        send_response(&job->reply_to, job->response, debug);
+        free(job);
+    }
+    ipc_server_resume();
+}
+
+// Hand a slow request to the worker pool; the client gets its answer from
+// send_completed_jobs(). -1 when the pool cannot take it.
+static int submit_worker_request(const ipc_reply_to_t *reply_to, const char *request) {
+    size_t request_len = strlen(request);
+    daemon_job_t *job = malloc(sizeof(daemon_job_t) + request_len + 1);
+    if (!job) return -1;
+
+    job->reply_to = *reply_to;
+    memcpy(job->request, request, request_len + 1);
+    job->response[0] = '\0';
+    if (worker_pool_submit(run_daemon_job, job) != 0) {
+        free(job);
+        return -1;
+    }
+    return 0;
+}
+
+// Called by the IPC server for each request a connection has received
+static int handle_request(const ipc_reply_to_t *reply_to, const char *request, void *userdata) {
+    int debug = (int)(intptr_t)userdata;
+    if (debug) {
+        printf("Received request: %s\n", request);
+    }
+
+    // Room for the whole context; the IPC server cuts it for version 1 clients
+    char response[MAX_CONTEXT_LEN];
+    memset(response, 0, sizeof(response));
+
+    // Process request: anything that can block goes to a worker,
+    // the rest is answered right here
+    if (is_worker_request(request) && request_input_length(request) >= MAX_INPUT_LEN) {
+        // Version 2 bodies may be far longer than any command line
+        snprintf(response, sizeof(response), "%s", "error:Input too long");
+    } else if (is_worker_request(request)) {
+        if (!g_use_workers) {
+            run_worker_request(reply_to, request, response, sizeof(response));
+        } else if (submit_worker_request(reply_to, request) == 0) {
+            return IPC_REQUEST_ASYNC; // The worker's completion answers the client
+        } else {
+            // The request waits in the connection until a worker is free
+            return IPC_REQUEST_BUSY;
+        }
+    } else if (strcmp(request, "ping") == 0) {
+        snprintf(response, sizeof(response), "%s", "pong");
+    } else if (strcmp(request, "cancel") == 0 || strncmp(request, "cancel\n", 7) == 0) {
+        // The shell dismissed the line: its speculative request is obsolete
+        uint64_t owner = request_prefetch_owner(reply_to->client_id, request[6] ? request + 7 : NULL);
+        snprintf(response, sizeof(response), "%s", prefetch_cancel(owner) == 0 ? "ok" : "idle");
+    } else if (strcmp(request, "stats") == 0) {
+        handle_stats_request(response, sizeof(response));
+    } else if (strcmp(request, "health") == 0) {
+        handle_health_request(response, sizeof(response));
+    } else if (strcmp(request, "connections") == 0) {
+        handle_connections_request(response, sizeof(response));
+    } else if (strcmp(request, "shells") == 0) {
+        handle_shells_request(response, sizeof(response));
+    } else if (strncmp(request, "context", 7) == 0) {
+        // Return current context
+        pthread_mutex_lock(&g_state_lock);
         if (g_daemon_pty.active) {
-            char buffer[1024];
-            int bytes_read = read_from_daemon_pty(&g_daemon_pty, buffer, sizeof(buffer));
-            if (bytes_read > 0) {
-                if (debug) {
-                    printf("PTY output: %.100s%s\n",
-                           buffer, bytes_read > 100 ? "..." : "");
-                }
-                // PTY output is automatically stored in the internal buffer
-            } else if (bytes_read == 0) {
-                if (debug) {
-                    printf("PTY session ended\n");
-                }
-                cleanup_daemon_pty(&g_daemon_pty);
+            char pty_context[MAX_CONTEXT_LEN];
+            if (get_daemon_pty_context(&g_daemon_pty, pty_context, sizeof(pty_context)) > 0) {
+                snprintf(response, sizeof(response), "%s", pty_context);
+            }
+        } else {
+            snprintf(response, sizeof(response), "%s", "error:No active PTY session");
+        }
+        pthread_mutex_unlock(&g_state_lock);
+    } else {
+        snprintf(response, sizeof(response), "%s", "error:Unknown request");
+    }
+
+    send_response(reply_to, response, debug);
+    return IPC_REQUEST_DONE;
+}
+
+// Drain the PTY; 0 once the shell behind it has exited
+static int drain_pty(int debug) {
+    pthread_mutex_lock(&g_state_lock);
+    char buffer[1024];
+    int bytes_read;
+    while ((bytes_read = read_from_daemon_pty(&g_daemon_pty, buffer, sizeof(buffer))) > 0) {
+        if (debug) {
+            printf("PTY output: %.100s%s\n",
+                   buffer, bytes_read > 100 ? "..." : "");
+        }
+        // PTY output is automatically stored in the internal buffer
+    }
+
+    int active = g_daemon_pty.active;
+    if (!active) {
+        if (debug) {
+            printf("PTY session ended\n");
+        }
+        cleanup_daemon_pty(&g_daemon_pty);
+    }
+    pthread_mutex_unlock(&g_state_lock);
+    return active;
+}
+
+static void handle_signals(int signal_fd) {
+    struct signalfd_siginfo info;
+    while (read(signal_fd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+        if (info.ssi_signo == SIGTERM || info.ssi_signo == SIGINT) {
+            g_running = 0;
+        } else if (info.ssi_signo == SIGCHLD) {
+            // Handle child process termination (signals for several children may merge)
+            while (waitpid(-1, NULL, WNOHANG) > 0) {
             }
         }
+    }
+}
+
+// Periodic work that does not need to happen on any particular event
+static void run_housekeeping(int timer_fd) {
+    uint64_t expirations;
+    if (read(timer_fd, &expirations, sizeof(expirations)) == -1) return;
+
+    // Keep the history on disk in case the daemon does not shut down cleanly
+    pthread_mutex_lock(&g_state_lock);
+    save_command_history(&g_command_history);
+    pthread_mutex_unlock(&g_state_lock);
+
+    // Drop connections that sent part of a request and then went quiet
+    ipc_server_sweep();
+
+    // And the shared-memory channels of shells that have exited
+    shell_channel_sweep();
+}
+
+// Called by the IPC server with the memfd and eventfd of a shell's channel,
+// which belongs to the connection it came over from now on
+static int handle_channel(uint64_t client_id, const int *fds, int fd_count, void *userdata) {
+    int debug = (int)(intptr_t)userdata;
+    if (fd_count != 2) {
+        for (int i = 0; i < fd_count; i++) close(fds[i]);
+        return -1;
+    }
+
+    int result = shell_channel_attach(fds[0], fds[1], client_id);
+    if (debug) {
+        printf("Shell channel %s\n", result == 0 ? "attached" : "rejected");
+    }
+    return result;
+}
+
+static int epoll_watch(int epoll_fd, int fd) {
+    // The whole of epoll_data, so it cannot be mistaken for an IPC connection
+    struct epoll_event event = { .events = EPOLLIN, .data.u64 = (uint64_t)fd };
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+static int create_housekeeping_timer(void) {
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd == -1) return -1;
+
+    struct itimerspec interval = {
+        .it_interval = { .tv_sec = DAEMON_HOUSEKEEPING_SECONDS },
+        .it_value = { .tv_sec = DAEMON_HOUSEKEEPING_SECONDS },
+    };
+    if (timerfd_settime(timer_fd, 0, &interval, NULL) == -1) {
+        close(timer_fd);
+        return -1;
+    }
+    return timer_fd;
+}
+
+// Sleeps in epoll_wait until a client connects or sends, the PTY has output,
+// a signal arrives, a worker finishes, a shell publishes to its channel or
+// the housekeeping timer fires; there is no polling tick
+int daemon_main_loop(int server_fd, const sigset_t *signals, int debug) {
+    if (debug) {
+        printf("Daemon main loop started (server_fd: %d)\n", server_fd);
+    }
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int signal_fd = signalfd(-1, signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    int timer_fd = create_housekeeping_timer();
+    int worker_fd = g_use_workers ? worker_pool_event_fd() : -1;
+    int pty_fd = g_daemon_pty.active ? g_daemon_pty.master_fd : -1;
+
+    if (epoll_fd == -1 || signal_fd == -1 ||
+        ipc_server_init(epoll_fd, server_fd, handle_request, (void *)(intptr_t)debug) == -1 ||
+        shell_channel_init(epoll_fd) == -1 ||
+        epoll_watch(epoll_fd, signal_fd) == -1) {
+        printf("Failed to set up the event loop: %s\n", strerror(errno));
+        fflush(stdout);
+        if (epoll_fd != -1) close(epoll_fd);
+        if (signal_fd != -1) close(signal_fd);
+        if (timer_fd != -1) close(timer_fd);
+        return -1;
+    }
+    ipc_server_set_channel_handler(handle_channel);
+    if (timer_fd != -1) epoll_watch(epoll_fd, timer_fd);
+    if (worker_fd != -1) epoll_watch(epoll_fd, worker_fd);
+    if (pty_fd != -1) epoll_watch(epoll_fd, pty_fd);
+
+    while (g_running) {
+        struct epoll_event events[DAEMON_MAX_EVENTS];
+        int count = epoll_wait(epoll_fd, events, DAEMON_MAX_EVENTS, -1);
+        if (count == -1) {
+            if (errno == EINTR) continue;
+            printf("epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
 
-        // Small sleep to prevent busy waiting
-        usleep(10000); // 10ms
+        for (int i = 0; i < count; i++) {
+            uint64_t key = events[i].data.u64;
+            int fd = key < IPC_EVENT_CLIENT ? (int)key : -1;
+            if (ipc_server_handle_event(key, events[i].events)) {
+                // The listening socket or a client connection
+            } else if (fd == worker_fd) {
+                send_completed_jobs(debug);
+            } else if (fd == pty_fd) {
+                if (!drain_pty(debug)) {
+                    // The descriptor was closed with the PTY, which removed it from the set
+                    pty_fd = -1;
+                }
+            } else if (fd == signal_fd) {
+                handle_signals(signal_fd);
+            } else if (fd == timer_fd) {
+                run_housekeeping(timer_fd);
+            } else if (shell_channel_handle_event(fd)) {
+                // A shell published events to its channel
+            }
+        }
+        fflush(stdout);
     }
 
+    close(epoll_fd);
+    close(signal_fd);
+    if (timer_fd != -1) close(timer_fd);
     return 0;
 }
 
@@ -411,8 +1037,9 @@ int main(int argc, char *argv[]) {
     g_daemon_info.daemon_pid = getpid();
     strncpy(g_daemon_info.paths.session_id, session_id, sizeof(g_daemon_info.paths.session_id));
 
-    // Setup signal handlers
-    setup_daemon_main_signal_handlers();
+    // Signals are handled in the main loop; block them before any thread starts
+    sigset_t signals;
+    block_daemon_signals(&signals);
 
     // Finish setting up paths
     snprintf(g_daemon_info.paths.socket_path, sizeof(g_daemon_info.paths.socket_path),
@@ -440,6 +1067,19 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    // Keep one HTTP client (connection pool, DNS and TLS caches) for the daemon lifetime
+    if (http_client_init() != 0) {
+        printf("Warning: Failed to initialize HTTP client\n");
+        fflush(stdout);
+    }
+
+    // Slow requests run on the worker pool so the main loop stays responsive
+    g_use_workers = worker_pool_start() == 0;
+    if (!g_use_workers) {
+        printf("Warning: Failed to start worker pool, handling requests inline\n");
+        fflush(stdout);
+    }
+
     // Create IPC socket
     int server_fd = create_ipc_socket(g_daemon_info.paths.socket_path);
     if (server_fd == -1) {
@@ -449,9 +1089,28 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    // Setup PTY
     config_t config;
-    if (load_config(&config) == 0 && config.enable_proxy_mode) {
+    int config_loaded = load_config(&config) == 0;
+
+    // Train the local command model on the existing history up front
+    char history_path[MAX_PATH];
+    if (config_loaded && config.local_model.enabled &&
+        bash_history_path(history_path, sizeof(history_path)) == 0) {
+        int learned = command_model_sync_history(history_path);
+        if (learned > 0) {
+            printf("Local command model trained on %d history lines\n", learned);
+            fflush(stdout);
+        }
+    }
+
+    // Connect to the providers before the first suggestion needs them
+    if (config_loaded && warmup_start(&config) == 0) {
+        printf("Connection warm-up started (every %ds)\n", config.warmup.interval_seconds);
+        fflush(stdout);
+    }
+
+    // Setup PTY
+    if (config_loaded && config.enable_proxy_mode) {
         if (setup_daemon_pty(&g_daemon_pty, g_daemon_info.paths.session_id) != 0) {
             printf("Warning: Failed to setup PTY proxy, continuing without it\n");
             fflush(stdout);
@@ -463,12 +1122,23 @@ int main(int argc, char *argv[]) {
     fflush(stdout);
 
     // Main daemon loop
-    int result = daemon_main_loop(server_fd, debug);
+    int result = daemon_main_loop(server_fd, &signals, debug);
 
     // Cleanup
     printf("Daemon shutting down...\n");
+    // Let the running jobs finish and answer their clients before the state
+    // they use goes away; the queued ones are answered with an error
+    prefetch_shutdown();
+    worker_pool_shutdown(drop_daemon_job);
+    send_completed_jobs(debug);
+    ipc_server_shutdown();
+    shell_channel_shutdown();
     cleanup_command_history(&g_command_history);
     cleanup_daemon_pty(&g_daemon_pty);
+    warmup_shutdown();
+    suggestion_cache_shutdown();
+    shm_cache_close();
+    http_client_cleanup();
     close(server_fd);
     cleanup_daemon_lock(g_daemon_info.paths.lock_file);
     unlink(g_daemon_info.paths.socket_path);
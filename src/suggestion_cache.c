@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+#include "smart_cmd.h"
+#include <pthread.h>
+
+/*
+ * Suggestion Cache
+ *
+ * Bounded in-memory cache of LLM suggestions for the daemon. Entries are
+ * keyed by a fingerprint of the input and its context (cwd, git HEAD, recent
+ * commands), evicted in LRU order and expire after a configurable TTL.
+ * Failed LLM calls are cached too (negative entries, shorter TTL) so a broken
+ * provider is not hammered with the same request.
+ */
+
+typedef struct {
+    uint64_t key;
+    suggestion_t suggestion;
+    int negative;
+    uint64_t expires_ms;
+    int prev;       // LRU list, most recently used at head
+    int next;
+    int hash_next;  // Bucket chain
+} cache_entry_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    cache_entry_t *entries;
+    int *buckets;
+    int capacity;
+    int bucket_mask;
+    int count;
+    int lru_head;
+    int lru_tail;
+    int free_head;
+    suggestion_cache_stats_t stats;
+} suggestion_cache_t;
+
+static suggestion_cache_t g_cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .lru_head = -1,
+    .lru_tail = -1,
+    .free_head = -1,
+};
+
+// FNV-1a over each field, with a separator so ("ab","c") != ("a","bc")
+static uint64_t fnv1a_update(uint64_t hash, const char *data) {
+    if (data) {
+        for (const unsigned char *p = (const unsigned char *)data; *p; p++) {
+            hash ^= *p;
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    hash ^= 0xff;
+    hash *= 0x100000001b3ULL;
+    return hash;
+}
+
+uint64_t context_fingerprint(const char *input, const char *cwd, const char *git_head, const char *recent_commands) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = fnv1a_update(hash, input);
+    hash = fnv1a_update(hash, cwd);
+    hash = fnv1a_update(hash, git_head);
+    hash = fnv1a_update(hash, recent_commands);
+    return hash;
+}
+
+static void cache_release(void) {
+    free(g_cache.entries);
+    free(g_cache.buckets);
+    g_cache.entries = NULL;
+    g_cache.buckets = NULL;
+    g_cache.capacity = 0;
+    g_cache.count = 0;
+    g_cache.lru_head = g_cache.lru_tail = g_cache.free_head = -1;
+}
+
+static int cache_allocate(int capacity) {
+    int buckets = 1;
+    while (buckets < capacity * 2) buckets <<= 1;
+
+    g_cache.entries = calloc((size_t)capacity, sizeof(cache_entry_t));
+    g_cache.buckets = malloc((size_t)buckets * sizeof(int));
+    if (!g_cache.entries || !g_cache.buckets) {
+        cache_release();
+        return -1;
+    }
+
+    for (int i = 0; i < buckets; i++) g_cache.buckets[i] = -1;
+    for (int i = 0; i < capacity; i++) g_cache.entries[i].next = (i + 1 < capacity) ? i + 1 : -1;
+
+    g_cache.capacity = capacity;
+    g_cache.bucket_mask = buckets - 1;
+    g_cache.free_head = 0;
+    return 0;
+}
+
+int suggestion_cache_configure(int max_entries) {
+    if (max_entries <= 0) return -1;
+
+    pthread_mutex_lock(&g_cache.lock);
+    int result = 0;
+    if (g_cache.capacity != max_entries) {
+        // Resizing flushes the cache; it only happens when the config changes
+        cache_release();
+        result = cache_allocate(max_entries);
+    }
+    pthread_mutex_unlock(&g_cache.lock);
+    return result;
+}
+
+static void lru_unlink(int index) {
+    cache_entry_t *entry = &g_cache.entries[index];
+    if (entry->prev != -1) g_cache.entries[entry->prev].next = entry->next;
+    else g_cache.lru_head = entry->next;
+    if (entry->next != -1) g_cache.entries[entry->next].prev = entry->prev;
+    else g_cache.lru_tail = entry->prev;
+}
+
+static void lru_push_front(int index) {
+    cache_entry_t *entry = &g_cache.entries[index];
+    entry->prev = -1;
+    entry->next = g_cache.lru_head;
+    if (g_cache.lru_head != -1) g_cache.entries[g_cache.lru_head].prev = index;
+    g_cache.lru_head = index;
+    if (g_cache.lru_tail == -1) g_cache.lru_tail = index;
+}
+
+static int bucket_find(uint64_t key) {
+    int index = g_cache.buckets[key & (uint64_t)g_cache.bucket_mask];
+    while (index != -1 && g_cache.entries[index].key != key) {
+        index = g_cache.entries[index].hash_next;
+    }
+    return index;
+}
+
+static void remove_entry(int index) {
+    cache_entry_t *entry = &g_cache.entries[index];
+
+    int *link = &g_cache.buckets[entry->key & (uint64_t)g_cache.bucket_mask];
+    while (*link != index) link = &g_cache.entries[*link].hash_next;
+    *link = entry->hash_next;
+
+    lru_unlink(index);
+    entry->next = g_cache.free_head;
+    g_cache.free_head = index;
+    g_cache.count--;
+}
+
+int suggestion_cache_get(uint64_t key, suggestion_t *suggestion) {
+    if (!suggestion) return -1;
+
+    pthread_mutex_lock(&g_cache.lock);
+    if (g_cache.capacity == 0) {
+        pthread_mutex_unlock(&g_cache.lock);
+        return -1;
+    }
+
+    int index = bucket_find(key);
+    if (index != -1 && g_cache.entries[index].expires_ms <= monotonic_ms()) {
+        remove_entry(index);
+        g_cache.stats.expirations++;
+        index = -1;
+    }
+
+    if (index == -1) {
+        g_cache.stats.misses++;
+        pthread_mutex_unlock(&g_cache.lock);
+        return -1;
+    }
+
+    cache_entry_t *entry = &g_cache.entries[index];
+    lru_unlink(index);
+    lru_push_front(index);
+
+    int result;
+    if (entry->negative) {
+        g_cache.stats.negative_hits++;
+        result = 1;
+    } else {
+        *suggestion = entry->suggestion;
+        g_cache.stats.hits++;
+        result = 0;
+    }
+
+    pthread_mutex_unlock(&g_cache.lock);
+    return result;
+}
+
+static void cache_insert(uint64_t key, const suggestion_t *suggestion, int negative, int ttl_ms) {
+    pthread_mutex_lock(&g_cache.lock);
+    if (g_cache.capacity == 0 || ttl_ms <= 0) {
+        pthread_mutex_unlock(&g_cache.lock);
+        return;
+    }
+
+    int index = bucket_find(key);
+    if (index != -1) {
+        lru_unlink(index);
+    } else {
+        if (g_cache.free_head == -1) {
+            remove_entry(g_cache.lru_tail);
+            g_cache.stats.evictions++;
+        }
+
+        index = g_cache.free_head;
+        g_cache.free_head = g_cache.entries[index].next;
+
+        int bucket = (int)(key & (uint64_t)g_cache.bucket_mask);
+        g_cache.entries[index].key = key;
+        g_cache.entries[index].hash_next = g_cache.buckets[bucket];
+        g_cache.buckets[bucket] = index;
+        g_cache.count++;
+    }
+
+    cache_entry_t *entry = &g_cache.entries[index];
+    if (suggestion) {
+        entry->suggestion = *suggestion;
+    } else {
+        memset(&entry->suggestion, 0, sizeof(entry->suggestion));
+    }
+    entry->negative = negative;
+    entry->expires_ms = monotonic_ms() + (uint64_t)ttl_ms;
+    lru_push_front(index);
+
+    pthread_mutex_unlock(&g_cache.lock);
+}
+
+void suggestion_cache_put(uint64_t key, const suggestion_t *suggestion, int ttl_ms) {
+    if (!suggestion) return;
+    cache_insert(key, suggestion, 0, ttl_ms);
+}
+
+void suggestion_cache_put_negative(uint64_t key, int ttl_ms) {
+    cache_insert(key, NULL, 1, ttl_ms);
+}
+
+void suggestion_cache_get_stats(suggestion_cache_stats_t *stats) {
+    if (!stats) return;
+
+    pthread_mutex_lock(&g_cache.lock);
+    *stats = g_cache.stats;
+    stats->entries = g_cache.count;
+    stats->capacity = g_cache.capacity;
+    pthread_mutex_unlock(&g_cache.lock);
+}
+
+void suggestion_cache_shutdown(void) {
+    pthread_mutex_lock(&g_cache.lock);
+    cache_release();
+    pthread_mutex_unlock(&g_cache.lock);
+}
@@ -230,6 +230,12 @@ static int is_process_running_from_lock(const char *lock_file) {
     return result;
 }
 
+uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
 char *concat_remaining_args(int argc, char *argv[], int start_index) {
     if (start_index >= argc) return NULL;
 
@@ -8,6 +8,7 @@
 #include <signal.h>
 #include <time.h>
 #include <sys/stat.h>
+#include <stdint.h>
 
 // Constants for temporary files
 #define SMART_CMD_PREFIX "smart-cmd"
@@ -46,6 +47,9 @@ int safe_string_copy(char *dest, const char *src, size_t dest_size);
 int safe_string_append(char *dest, const char *src, size_t dest_size);
 int starts_with(const char *str, const char *prefix);
 
+// Time utilities
+uint64_t monotonic_ms(void);
+
 // Argument processing utilities
 char *concat_remaining_args(int argc, char *argv[], int start_index);
 
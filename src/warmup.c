@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+#include "smart_cmd.h"
+#include "defaults.h"
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * Connection Warm-up
+ *
+ * A background thread in the daemon opens a connection to every provider a
+ * suggestion may be sent to (the configured one and the hedge/fallback
+ * provider) as soon as the daemon starts, and pings each one again every
+ * warmup.interval_seconds. The pings are HEAD requests without credentials
+ * through the shared HTTP client, so the resolved address, the TLS session
+ * and the open connection are all there when the first Ctrl+O comes in,
+ * and idle connections are not dropped by the provider or by curl.
+ *
+ * Pooled connections are retired once they are older than the DNS cache
+ * timeout (HTTP_DNS_CACHE_TIMEOUT); the next ping then re-resolves the host
+ * and opens a new one, so a provider that moves is followed within that
+ * time and the cost of the new handshake is paid here rather than by a
+ * suggestion. The configuration is re-read every round, so a provider
+ * change in config.json is picked up without restarting the daemon.
+ */
+
+typedef struct {
+    int active;
+    char url[MAX_ENDPOINT_LENGTH];
+    connection_status_t status;
+    uint64_t last_ping_ms;     // monotonic_ms() of the last ping, 0 before one
+    uint64_t last_connect_ms;
+} endpoint_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int thread_started;
+    int shutdown;
+    endpoint_t endpoints[WARMUP_MAX_ENDPOINTS];
+} warmup_t;
+
+static warmup_t g_warmup = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+const char *connection_state_name(connection_state_t state) {
+    switch (state) {
+    case CONNECTION_WARM: return "warm";
+    case CONNECTION_FAILED: return "failed";
+    default: return "cold";
+    }
+}
+
+// "https://host:port/path" -> "host:port"
+static void url_host(const char *url, char *host, size_t size) {
+    const char *start = strstr(url, "://");
+    start = start ? start + 3 : url;
+    size_t len = strcspn(start, "/?");
+    if (len >= size) len = size - 1;
+    memcpy(host, start, len);
+    host[len] = '\0';
+}
+
+// Endpoints of the providers a request may go to, primary first
+static int collect_endpoints(const config_t *config, char urls[][MAX_ENDPOINT_LENGTH],
+                             char providers[][32], int max) {
+    int count = 0;
+    if (config->llm.provider[0] && count < max) {
+        llm_build_endpoint(config, urls[count], MAX_ENDPOINT_LENGTH);
+        safe_string_copy(providers[count], config->llm.provider, sizeof(providers[count]));
+        count++;
+    }
+
+    const llm_config_t *fallback = &config->hedge.llm;
+    if (fallback->provider[0] && strcmp(fallback->provider, config->llm.provider) != 0 && count < max) {
+        config_t *secondary = malloc(sizeof(config_t));
+        if (secondary) {
+            *secondary = *config;
+            secondary->llm = *fallback;
+            llm_build_endpoint(secondary, urls[count], MAX_ENDPOINT_LENGTH);
+            safe_string_copy(providers[count], fallback->provider, sizeof(providers[count]));
+            count++;
+            free(secondary);
+        }
+    }
+    return count;
+}
+
+// Keep the state of endpoints still in use, drop the others
+static void sync_endpoints(char urls[][MAX_ENDPOINT_LENGTH], char providers[][32], int count) {
+    endpoint_t kept[WARMUP_MAX_ENDPOINTS];
+    memset(kept, 0, sizeof(kept));
+
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < WARMUP_MAX_ENDPOINTS; j++) {
+            endpoint_t *old = &g_warmup.endpoints[j];
+            if (old->active && strcmp(old->url, urls[i]) == 0) {
+                kept[i] = *old;
+                break;
+            }
+        }
+        if (!kept[i].active) {
+            kept[i].active = 1;
+            safe_string_copy(kept[i].url, urls[i], sizeof(kept[i].url));
+            url_host(urls[i], kept[i].status.host, sizeof(kept[i].status.host));
+        }
+        safe_string_copy(kept[i].status.provider, providers[i], sizeof(kept[i].status.provider));
+    }
+    memcpy(g_warmup.endpoints, kept, sizeof(kept));
+}
+
+static void record_ping(const char *url, int result, const http_response_t *resp) {
+    pthread_mutex_lock(&g_warmup.lock);
+    for (int i = 0; i < WARMUP_MAX_ENDPOINTS; i++) {
+        endpoint_t *endpoint = &g_warmup.endpoints[i];
+        if (!endpoint->active || strcmp(endpoint->url, url) != 0) continue;
+
+        connection_status_t *status = &endpoint->status;
+        connection_state_t previous = status->state;
+        endpoint->last_ping_ms = monotonic_ms();
+        status->pings++;
+        status->status = resp->status;
+        status->ping_ms = resp->timings.total_ms;
+
+        if (result == 0) {
+            status->state = CONNECTION_WARM;
+            if (!resp->timings.reused_connection) {
+                endpoint->last_connect_ms = endpoint->last_ping_ms;
+                status->setup_ms = resp->timings.dns_ms + resp->timings.connect_ms + resp->timings.tls_ms;
+                status->connects++;
+            }
+        } else {
+            status->state = CONNECTION_FAILED;
+            status->failures++;
+        }
+
+        if (status->state != previous) {
+            printf("Connection to %s (%s) is %s (status %ld, %.1fms)\n", status->host, status->provider,
+                   connection_state_name(status->state), status->status, status->ping_ms);
+            fflush(stdout);
+        }
+        break;
+    }
+    pthread_mutex_unlock(&g_warmup.lock);
+}
+
+static void *warmup_thread_main(void *arg) {
+    (void)arg;
+
+    config_t *config = malloc(sizeof(config_t));
+    char (*urls)[MAX_ENDPOINT_LENGTH] = malloc(WARMUP_MAX_ENDPOINTS * MAX_ENDPOINT_LENGTH);
+    char providers[WARMUP_MAX_ENDPOINTS][32];
+    if (!config || !urls) {
+        free(config);
+        free(urls);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&g_warmup.lock);
+    while (!g_warmup.shutdown) {
+        pthread_mutex_unlock(&g_warmup.lock);
+
+        int interval = DEFAULT_WARMUP_INTERVAL_SECONDS;
+        int count = 0;
+        if (load_config(config) == 0 && config->warmup.enabled) {
+            interval = config->warmup.interval_seconds;
+            count = collect_endpoints(config, urls, providers, WARMUP_MAX_ENDPOINTS);
+        }
+
+        pthread_mutex_lock(&g_warmup.lock);
+        sync_endpoints(urls, providers, count);
+        pthread_mutex_unlock(&g_warmup.lock);
+
+        for (int i = 0; i < count && !g_warmup.shutdown; i++) {
+            http_response_t resp;
+            int result = http_prewarm(urls[i], &resp);
+            record_ping(urls[i], result, &resp);
+            http_response_free(&resp);
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += interval;
+
+        pthread_mutex_lock(&g_warmup.lock);
+        while (!g_warmup.shutdown) {
+            if (pthread_cond_timedwait(&g_warmup.cond, &g_warmup.lock, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&g_warmup.lock);
+
+    free(config);
+    free(urls);
+    return NULL;
+}
+
+int warmup_start(const config_t *config) {
+    if (!config || !config->warmup.enabled) return -1;
+
+    pthread_mutex_lock(&g_warmup.lock);
+    if (g_warmup.thread_started) {
+        pthread_mutex_unlock(&g_warmup.lock);
+        return 0;
+    }
+
+    if (pthread_create(&g_warmup.thread, NULL, warmup_thread_main, NULL) != 0) {
+        pthread_mutex_unlock(&g_warmup.lock);
+        fprintf(stderr, "ERROR: warmup_start: Failed to create warm-up thread\n");
+        return -1;
+    }
+    g_warmup.thread_started = 1;
+    pthread_mutex_unlock(&g_warmup.lock);
+    return 0;
+}
+
+int warmup_get_all(connection_status_t *connections, int max) {
+    if (!connections || max <= 0) return 0;
+
+    pthread_mutex_lock(&g_warmup.lock);
+    uint64_t now = monotonic_ms();
+    int count = 0;
+    for (int i = 0; i < WARMUP_MAX_ENDPOINTS && count < max; i++) {
+        const endpoint_t *endpoint = &g_warmup.endpoints[i];
+        if (!endpoint->active) continue;
+
+        connection_status_t *status = &connections[count++];
+        *status = endpoint->status;
+        status->last_ping_age_ms = endpoint->last_ping_ms ? (int)(now - endpoint->last_ping_ms) : -1;
+        status->last_connect_age_ms = endpoint->last_connect_ms ? (int)(now - endpoint->last_connect_ms) : -1;
+    }
+    pthread_mutex_unlock(&g_warmup.lock);
+    return count;
+}
+
+void warmup_shutdown(void) {
+    pthread_mutex_lock(&g_warmup.lock);
+    if (!g_warmup.thread_started) {
+        pthread_mutex_unlock(&g_warmup.lock);
+        return;
+    }
+    g_warmup.shutdown = 1;
+    pthread_cond_broadcast(&g_warmup.cond);
+    pthread_mutex_unlock(&g_warmup.lock);
+
+    pthread_join(g_warmup.thread, NULL);
+    g_warmup.thread_started = 0;
+}
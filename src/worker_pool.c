@@ -0,0 +1,255 @@
+#define _GNU_SOURCE
+#include "smart_cmd.h"
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+/*
+ * Worker Pool
+ *
+ * A fixed set of threads that run the daemon's slow work (config loading,
+ * context building, LLM calls) so its main loop only accepts clients, reads
+ * the PTY and writes responses. At most WORKER_POOL_QUEUE jobs exist at a
+ * time, queued, running or finished but not yet collected; a submission
+ * beyond that fails at once and the client is told the daemon is busy
+ * instead of waiting behind a backlog it cannot see.
+ *
+ * Workers take jobs from a FIFO under a mutex and hand finished ones back
+ * through a lock-free completion stack: a worker pushes with a CAS and the
+ * main loop takes the whole stack with one atomic exchange, then reverses it
+ * so jobs come out in the order they finished. The main loop never blocks
+ * on a lock a worker holds while an LLM call is in flight. Only the main
+ * loop takes completed jobs. Each push also bumps an eventfd, so the main
+ * loop can sleep in epoll until a job is done.
+ *
+ * At shutdown the jobs still queued are not run: each goes through the
+ * caller's drop function and then completes like any other, so whoever
+ * waits on it gets an answer and the main loop frees it as usual.
+ */
+
+typedef struct worker_task {
+    worker_fn run;
+    void *arg;
+    uint64_t submitted_ms;
+    struct worker_task *next;
+} worker_task_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t threads[WORKER_POOL_THREADS];
+    int thread_count;
+    int shutdown;
+
+    worker_task_t tasks[WORKER_POOL_QUEUE];
+    worker_task_t *free_list;
+    worker_task_t *queue_head;     // Submitted, not started
+    worker_task_t *queue_tail;
+    int queued;
+
+    worker_task_t *completed;      // Lock-free stack, pushed by the workers
+    worker_task_t *ready;          // Taken from the stack, oldest first (main loop only)
+    int event_fd;                  // Readable once a job has completed
+
+    worker_pool_stats_t stats;
+} worker_pool_t;
+
+static worker_pool_t g_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .event_fd = -1,
+};
+
+static void completed_push(worker_task_t *task) {
+    worker_task_t *head = __atomic_load_n(&g_pool.completed, __ATOMIC_RELAXED);
+    do {
+        task->next = head;
+    } while (!__atomic_compare_exchange_n(&g_pool.completed, &head, task, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    // After the push, so a reader woken by it always finds the job
+    uint64_t one = 1;
+    if (g_pool.event_fd != -1 && write(g_pool.event_fd, &one, sizeof(one)) == -1) {
+        // The counter only overflows after 2^64 - 1 unread completions
+    }
+}
+
+static void *worker_thread_main(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&g_pool.lock);
+    while (!g_pool.shutdown) {
+        worker_task_t *task = g_pool.queue_head;
+        if (!task) {
+            pthread_cond_wait(&g_pool.cond, &g_pool.lock);
+            continue;
+        }
+
+        g_pool.queue_head = task->next;
+        if (!g_pool.queue_head) g_pool.queue_tail = NULL;
+        g_pool.queued--;
+        g_pool.stats.running++;
+
+        unsigned long waited = (unsigned long)(monotonic_ms() - task->submitted_ms);
+        if (waited > g_pool.stats.max_wait_ms) g_pool.stats.max_wait_ms = waited;
+        pthread_mutex_unlock(&g_pool.lock);
+
+        task->run(task->arg);
+        completed_push(task);
+
+        pthread_mutex_lock(&g_pool.lock);
+        g_pool.stats.running--;
+        g_pool.stats.completed++;
+    }
+    pthread_mutex_unlock(&g_pool.lock);
+    return NULL;
+}
+
+int worker_pool_start(void) {
+    pthread_mutex_lock(&g_pool.lock);
+    if (g_pool.thread_count > 0) {
+        pthread_mutex_unlock(&g_pool.lock);
+        return 0;
+    }
+
+    g_pool.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_pool.event_fd == -1) {
+        pthread_mutex_unlock(&g_pool.lock);
+        fprintf(stderr, "ERROR: worker_pool_start: eventfd: %s\n", strerror(errno));
+        return -1;
+    }
+
+    g_pool.free_list = NULL;
+    for (int i = WORKER_POOL_QUEUE - 1; i >= 0; i--) {
+        g_pool.tasks[i].next = g_pool.free_list;
+        g_pool.free_list = &g_pool.tasks[i];
+    }
+
+    for (int i = 0; i < WORKER_POOL_THREADS; i++) {
+        if (pthread_create(&g_pool.threads[i], NULL, worker_thread_main, NULL) != 0) break;
+        g_pool.thread_count++;
+    }
+    int started = g_pool.thread_count;
+    g_pool.stats.threads = started;
+    pthread_mutex_unlock(&g_pool.lock);
+
+    if (started == 0) {
+        fprintf(stderr, "ERROR: worker_pool_start: Failed to create worker threads\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Queue run(arg) on a worker; -1 when the pool is full or not running
+int worker_pool_submit(worker_fn run, void *arg) {
+    if (!run) return -1;
+
+    pthread_mutex_lock(&g_pool.lock);
+    worker_task_t *task = g_pool.free_list;
+    if (g_pool.thread_count == 0 || g_pool.shutdown || !task) {
+        g_pool.stats.rejected++;
+        pthread_mutex_unlock(&g_pool.lock);
+        return -1;
+    }
+    g_pool.free_list = task->next;
+
+    task->run = run;
+    task->arg = arg;
+    task->submitted_ms = monotonic_ms();
+    task->next = NULL;
+    if (g_pool.queue_tail) {
+        g_pool.queue_tail->next = task;
+    } else {
+        g_pool.queue_head = task;
+    }
+    g_pool.queue_tail = task;
+    g_pool.queued++;
+    g_pool.stats.submitted++;
+    if ((unsigned long)g_pool.queued > g_pool.stats.max_queued) g_pool.stats.max_queued = (unsigned long)g_pool.queued;
+
+    pthread_cond_signal(&g_pool.cond);
+    pthread_mutex_unlock(&g_pool.lock);
+    return 0;
+}
+
+static void task_release(worker_task_t *task) {
+    pthread_mutex_lock(&g_pool.lock);
+    task->next = g_pool.free_list;
+    g_pool.free_list = task;
+    pthread_mutex_unlock(&g_pool.lock);
+}
+
+// Descriptor to poll for completed jobs; -1 when the pool is not running
+int worker_pool_event_fd(void) {
+    return g_pool.event_fd;
+}
+
+// Argument of the oldest finished job, or NULL; main loop only
+void *worker_pool_take_completed(void) {
+    if (!g_pool.ready) {
+        // Reset the counter before taking the stack: completions pushed
+        // after this make the eventfd readable again
+        uint64_t count;
+        if (g_pool.event_fd != -1 && read(g_pool.event_fd, &count, sizeof(count)) == -1) {
+            // EAGAIN: nothing new since the last call
+        }
+
+        worker_task_t *stack = __atomic_exchange_n(&g_pool.completed, NULL, __ATOMIC_ACQUIRE);
+        while (stack) {
+            worker_task_t *next = stack->next;
+            stack->next = g_pool.ready;
+            g_pool.ready = stack;
+            stack = next;
+        }
+        if (!g_pool.ready) return NULL;
+    }
+
+    worker_task_t *task = g_pool.ready;
+    g_pool.ready = task->next;
+    void *arg = task->arg;
+    task_release(task);
+    return arg;
+}
+
+void worker_pool_get_stats(worker_pool_stats_t *stats) {
+    if (!stats) return;
+
+    pthread_mutex_lock(&g_pool.lock);
+    *stats = g_pool.stats;
+    stats->queued = g_pool.queued;
+    pthread_mutex_unlock(&g_pool.lock);
+}
+
+// Finish the running jobs and stop the threads. Jobs still queued are not
+// run: drop(arg) is called for each instead, on this thread, and they are
+// then taken with worker_pool_take_completed() like finished ones.
+void worker_pool_shutdown(worker_fn drop) {
+    pthread_mutex_lock(&g_pool.lock);
+    int count = g_pool.thread_count;
+    g_pool.shutdown = 1;
+    pthread_cond_broadcast(&g_pool.cond);
+    pthread_mutex_unlock(&g_pool.lock);
+
+    for (int i = 0; i < count; i++) {
+        pthread_join(g_pool.threads[i], NULL);
+    }
+
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.thread_count = 0;
+    worker_task_t *queued = g_pool.queue_head;
+    g_pool.queue_head = g_pool.queue_tail = NULL;
+    g_pool.queued = 0;
+    pthread_mutex_unlock(&g_pool.lock);
+
+    while (queued) {
+        worker_task_t *next = queued->next;
+        if (drop) drop(queued->arg);
+        completed_push(queued);
+        queued = next;
+    }
+
+    // Jobs completed during the shutdown can still be taken
+    if (g_pool.event_fd != -1) {
+        close(g_pool.event_fd);
+        g_pool.event_fd = -1;
+    }
+}
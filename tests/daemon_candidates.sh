@@ -0,0 +1,25 @@
+#!/bin/bash
+#
+# Daemon candidates test
+#
+# Ctrl+O with a running daemon must still give the shell several suggestions
+# to cycle through. Asks smart-cmd-completion for a completion through the
+# daemon and checks that the daemon answered it with more than one
+# candidate.
+#
+# Usage: tests/daemon_candidates.sh (from the repository root, after make)
+
+source "$(dirname "$0")/lib.sh"
+
+start_mock --latency-ms 50
+write_config '"candidates": 3'
+start_daemon
+
+OUTPUT=$(echo "docker p" | "$ROOT/smart-cmd-completion")
+COUNT=$(printf '%s\n' "$OUTPUT" | grep -c .)
+
+daemon_logged "Received suggestion request: suggestion:docker p" ||
+    fail "the daemon did not answer the completion"
+[ "$COUNT" -gt 1 ] || fail "expected more than one candidate from the daemon, got $COUNT: $OUTPUT"
+
+echo "PASSED: daemon returned $COUNT candidates"
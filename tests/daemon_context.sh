@@ -0,0 +1,33 @@
+#!/bin/bash
+#
+# Daemon context test
+#
+# The daemon answers for the directory the user's shell is in, not its own:
+# the client sends it with the request, and the caches are keyed by it.
+# Asks for the same input in one directory twice and then in another, and
+# checks that only the repeat in the same directory is a cache hit.
+#
+# Usage: tests/daemon_context.sh (from the repository root, after make)
+
+source "$(dirname "$0")/lib.sh"
+
+start_mock --latency-ms 20
+write_config '"cache": {"enabled": true}'
+start_daemon
+
+mkdir -p "$SCRATCH/one" "$SCRATCH/two"
+complete_in() {
+    (cd "$1" && echo "ls -l" | "$ROOT/smart-cmd-completion" >/dev/null 2>&1)
+}
+hits() {
+    cat "$TMPDIR"/smart-cmd.log.* 2>/dev/null | grep -c "Cache hit for: ls -l"
+}
+
+complete_in "$SCRATCH/one"
+complete_in "$SCRATCH/one"
+[ "$(hits)" -eq 1 ] || fail "the repeat in the same directory was not a cache hit"
+
+complete_in "$SCRATCH/two"
+[ "$(hits)" -eq 1 ] || fail "another directory got the first one's cached answer"
+
+echo "PASSED: cached answers stay in the directory they were made in"
@@ -0,0 +1,20 @@
+#!/bin/bash
+#
+# Daemon IPC version 2 test
+#
+# Runs tests/ipc_check against a daemon whose provider takes 300 ms, so the
+# suggestions it pipelines are still in flight when the quick request sent
+# after them is answered.
+#
+# Usage: tests/daemon_ipc.sh (from the repository root, after make)
+
+source "$(dirname "$0")/lib.sh"
+
+start_mock --latency-ms 300
+write_config '"candidates": 1'
+start_daemon
+
+SOCKET=$(ls "$TMPDIR"/smart-cmd.socket.* 2>/dev/null | head -n 1)
+[ -n "$SOCKET" ] || fail "the daemon has no socket"
+
+"$ROOT/tests/ipc_check" "$SOCKET"
@@ -0,0 +1,27 @@
+#!/bin/bash
+#
+# Daemon payload test
+#
+# Command lines and suggestions are ordinary shell text: "..", "~" and "$("
+# must reach the daemon and come back unchanged. Sends such inputs through
+# smart-cmd-completion and checks that the daemon answered each one.
+#
+# Usage: tests/daemon_payload.sh (from the repository root, after make)
+
+source "$(dirname "$0")/lib.sh"
+
+start_mock --latency-ms 20
+write_config '"candidates": 1'
+start_daemon
+
+for input in 'cd ..' 'ls ~/' 'echo $(date'; do
+    OUTPUT=$(echo "$input" | "$ROOT/smart-cmd-completion" 2>"$SCRATCH/stderr")
+    daemon_logged "Received suggestion request: suggestion:$input" ||
+        fail "the daemon did not get: $input"
+    case "$OUTPUT" in
+        "+$input"*) ;;
+        *) fail "expected a completion of '$input', got '$OUTPUT' $(cat "$SCRATCH/stderr")" ;;
+    esac
+done
+
+echo "PASSED: shell text went through the daemon both ways"
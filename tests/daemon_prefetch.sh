@@ -0,0 +1,64 @@
+#!/bin/bash
+#
+# Daemon prefetch test
+#
+# A prefetch made while one shell types answers that shell's next Ctrl+O,
+# and nobody else's. Runs two coproc clients the way smart-cmd.bash does,
+# one per shell, and checks that
+#
+#   - Ctrl+O on the line a shell prefetched is a prefetch hit
+#   - another shell asking for the same line is not
+#   - a prefetch is dropped once its shell runs another command
+#
+# Usage: tests/daemon_prefetch.sh (from the repository root, after make)
+
+source "$(dirname "$0")/lib.sh"
+
+start_mock --latency-ms 20
+write_config '"prefetch": {"enabled": true, "debounce_ms": 50}'
+start_daemon
+
+{ coproc ONE { SMART_CMD_SHELL_PID=111 exec "$ROOT/smart-cmd-completion" --coproc 2>/dev/null; }; } 2>/dev/null
+{ coproc TWO { SMART_CMD_SHELL_PID=222 exec "$ROOT/smart-cmd-completion" --coproc 2>/dev/null; }; } 2>/dev/null
+ONE_IN=${ONE[1]} ONE_OUT=${ONE[0]} TWO_IN=${TWO[1]} TWO_OUT=${TWO[0]}
+SEQ=0
+
+# send <in fd> <line>
+send() {
+    printf '%s\n' "$2" >&"$1"
+}
+
+# complete <in fd> <out fd> <line>: Ctrl+O, waiting for the whole answer
+complete() {
+    local line
+    SEQ=$((SEQ + 1))
+    send "$1" "complete $SEQ $3"
+    while IFS= read -r -t 10 -u "$2" line && [ "$line" != "#$SEQ" ]; do :; done
+    while IFS= read -r -t 10 -u "$2" line && [ -n "$line" ]; do :; done
+}
+
+hits() {
+    cat "$TMPDIR"/smart-cmd.log.* 2>/dev/null | grep -c "Prefetch hit for: $1"
+}
+
+send "$ONE_IN" "prompt 0 $SCRATCH"
+send "$TWO_IN" "prompt 0 $SCRATCH"
+
+# Typed in the first shell, then a pause longer than the debounce delay
+send "$ONE_IN" "prefetch docker p"
+sleep 1
+
+complete "$TWO_IN" "$TWO_OUT" "docker p"
+[ "$(hits "docker p")" -eq 0 ] || fail "another shell got the first one's prefetch"
+
+complete "$ONE_IN" "$ONE_OUT" "docker p"
+[ "$(hits "docker p")" -eq 1 ] || fail "Ctrl+O on the prefetched line was not a prefetch hit"
+
+# Prefetched, but the shell runs a command before Ctrl+O
+send "$ONE_IN" "prefetch git st"
+sleep 1
+send "$ONE_IN" "prompt 0 $SCRATCH"
+complete "$ONE_IN" "$ONE_OUT" "git st"
+[ "$(hits "git st")" -eq 0 ] || fail "a prefetch outlived the command its shell ran"
+
+echo "PASSED: prefetches answered only their own shell's next Ctrl+O"
@@ -0,0 +1,112 @@
+#define _GNU_SOURCE
+#include "../src/smart_cmd.h"
+
+/*
+ * IPC version 2 client check
+ *
+ * Talks to a running daemon the way the coproc client does: offers the
+ * newest protocol version, then sends several requests on one connection
+ * without waiting for the answers. Checks that
+ *
+ *   - the daemon agrees on IPC_VERSION
+ *   - a quick request ("stats") is answered before the suggestions sent
+ *     ahead of it, which wait on the provider
+ *   - every answer carries the request id it belongs to, and each
+ *     suggestion (input plus the client's context) gets one
+ *   - an input longer than any command line comes back as an error frame
+ *
+ * Usage: tests/ipc_check <socket path>, against a daemon whose provider
+ * takes a while to answer (tests/daemon_ipc.sh sets that up)
+ */
+
+static int failures = 0;
+
+static void fail(const char *what) {
+    printf("FAILED: %s\n", what);
+    failures++;
+}
+
+static int send_request(int fd, uint32_t version, uint32_t type, uint32_t id, const char *body) {
+    ipc_frame_t frame = {
+        .version = version,
+        .type = type,
+        .request_id = id,
+        .length = (uint32_t)strlen(body),
+        .body = (char *)body,
+    };
+    return ipc_send_frame(fd, &frame);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <socket path>\n", argv[0]);
+        return 2;
+    }
+
+    int fd = connect_to_daemon_timeout(argv[1], IPC_CONNECT_TIMEOUT_MS, 10000);
+    if (fd == -1) {
+        printf("FAILED: cannot connect to %s\n", argv[1]);
+        return 1;
+    }
+
+    int version = ipc_negotiate(fd, 1000);
+    if (version != IPC_VERSION) {
+        printf("FAILED: negotiated version %d, expected %d\n", version, IPC_VERSION);
+        close(fd);
+        return 1;
+    }
+
+    // Two suggestions, then a command that needs no worker
+    const char *context = "{\"cwd\":\"/tmp\",\"last_status\":0,\"shell_pid\":1,\"prompts\":1}";
+    char body[256];
+    snprintf(body, sizeof(body), "ls -\n%s", context);
+    if (send_request(fd, version, MSG_TYPE_SUGGESTION, 1, body) == -1 ||
+        send_request(fd, version, MSG_TYPE_SUGGESTION, 2, "git st") == -1 ||
+        send_request(fd, version, MSG_TYPE_COMMAND, 3, "stats") == -1) {
+        printf("FAILED: cannot send the requests\n");
+        close(fd);
+        return 1;
+    }
+
+    int answered[4] = {0};
+    for (int i = 0; i < 3; i++) {
+        ipc_frame_t reply;
+        if (ipc_receive_frame(fd, &reply) != 1) {
+            fail("the connection closed before every request was answered");
+            break;
+        }
+        if (reply.request_id < 1 || reply.request_id > 3 || answered[reply.request_id]) {
+            fail("an answer carries an unknown or repeated request id");
+        } else {
+            answered[reply.request_id] = 1;
+        }
+
+        if (i == 0 && reply.request_id != 3) fail("stats waited behind the suggestions");
+        if (reply.type != MSG_TYPE_RESPONSE) fail("a request was answered with an error");
+        if (reply.request_id == 3 && !strstr(reply.body, "ipc_v2_clients=")) fail("stats has no IPC counters");
+        if (reply.request_id != 3 && reply.body[0] != '+' && reply.body[0] != '=') fail("a suggestion came back empty");
+        ipc_frame_free(&reply);
+    }
+
+    // Longer than any command line, but within a version 2 body
+    char *long_input = malloc(MAX_INPUT_LEN * 2 + 1);
+    if (long_input) {
+        memset(long_input, 'x', MAX_INPUT_LEN * 2);
+        long_input[MAX_INPUT_LEN * 2] = '\0';
+
+        ipc_frame_t reply;
+        if (send_request(fd, version, MSG_TYPE_SUGGESTION, 4, long_input) == -1 ||
+            ipc_receive_frame(fd, &reply) != 1) {
+            fail("no answer to an over-long input");
+        } else {
+            if (reply.type != MSG_TYPE_ERROR || reply.request_id != 4) fail("an over-long input was not an error");
+            ipc_frame_free(&reply);
+        }
+        free(long_input);
+    }
+
+    close(fd);
+    if (failures) return 1;
+    printf("PASSED: pipelined version %d requests were answered by id\n", version);
+    return 0;
+}
@@ -0,0 +1,62 @@
+#define _GNU_SOURCE
+#include "../src/smart_cmd.h"
+
+/*
+ * Latency histogram percentile check
+ *
+ * Percentiles are nearest-rank: with fewer than 100 samples p99 must be
+ * the slowest one, not the one before it, and a single sample is every
+ * percentile. Records known samples and checks which bucket each
+ * percentile lands in.
+ *
+ * Build and run: make test-latency
+ */
+
+static int failures = 0;
+
+static void check(const char *what, double got, double want) {
+    if (got != want) {
+        printf("FAILED: %s: got %.2f ms, expected %.2f ms\n", what, got, want);
+        failures++;
+    }
+}
+
+// The value the histogram reports for a sample of ms
+static double reported(double ms) {
+    latency_histogram_t hist = {0};
+    latency_histogram_record(&hist, ms);
+    return latency_histogram_percentile(&hist, 50);
+}
+
+int main(void) {
+    latency_histogram_t hist = {0};
+    check("empty histogram", latency_histogram_percentile(&hist, 99), 0.0);
+
+    latency_histogram_record(&hist, 40);
+    check("p1 of one sample", latency_histogram_percentile(&hist, 1), reported(40));
+    check("p99 of one sample", latency_histogram_percentile(&hist, 99), reported(40));
+
+    // 49 fast samples and one slow one: p99 and p98 are the slow one
+    memset(&hist, 0, sizeof(hist));
+    for (int i = 0; i < 49; i++) latency_histogram_record(&hist, 10);
+    latency_histogram_record(&hist, 900);
+    check("p99 of 50 samples", latency_histogram_percentile(&hist, 99), reported(900));
+    check("p98 of 50 samples", latency_histogram_percentile(&hist, 98), reported(10));
+    check("p50 of 50 samples", latency_histogram_percentile(&hist, 50), reported(10));
+
+    // 7 samples: p50 is the 4th, p90 the 7th
+    memset(&hist, 0, sizeof(hist));
+    for (int i = 1; i <= 7; i++) latency_histogram_record(&hist, i * 100.0);
+    check("p50 of 7 samples", latency_histogram_percentile(&hist, 50), reported(400));
+    check("p90 of 7 samples", latency_histogram_percentile(&hist, 90), reported(700));
+
+    // 100 samples: p95 is exactly the 95th
+    memset(&hist, 0, sizeof(hist));
+    for (int i = 1; i <= 100; i++) latency_histogram_record(&hist, i < 96 ? 10 : 900);
+    check("p95 of 100 samples", latency_histogram_percentile(&hist, 95), reported(10));
+    check("p96 of 100 samples", latency_histogram_percentile(&hist, 96), reported(900));
+
+    if (failures) return 1;
+    printf("PASSED: latency percentiles\n");
+    return 0;
+}
@@ -0,0 +1,73 @@
+#!/bin/bash
+#
+# Shared setup for the daemon tests
+#
+# Runs everything under a scratch HOME and TMPDIR with bench/mock_llm_server
+# as the provider, and stops the daemon and the mock on exit. A test sources
+# this file, then calls start_mock, write_config and start_daemon.
+
+set -u
+
+ROOT=$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)
+SCRATCH=$(mktemp -d "${TMPDIR:-/tmp}/smart-cmd-test.XXXXXX")
+MOCK_PID=""
+PORT=""
+
+cleanup() {
+    "$ROOT/smart-cmd-daemon" --stop >/dev/null 2>&1
+    [ -n "$MOCK_PID" ] && kill "$MOCK_PID" 2>/dev/null
+    rm -rf "$SCRATCH"
+}
+trap cleanup EXIT
+
+fail() {
+    echo "FAILED: $*"
+    exit 1
+}
+
+mkdir -p "$SCRATCH/tmp" "$SCRATCH/.config/smart-cmd"
+export HOME="$SCRATCH" TMPDIR="$SCRATCH/tmp" XDG_RUNTIME_DIR="$SCRATCH/tmp" HISTFILE=/dev/null
+
+# start_mock [mock_llm_server options]
+start_mock() {
+    "$ROOT/bench/mock_llm_server" --jitter-ms 0 "$@" > "$SCRATCH/mock" &
+    MOCK_PID=$!
+    for _ in $(seq 50); do
+        [ -s "$SCRATCH/mock" ] && break
+        sleep 0.1
+    done
+    PORT=$(awk '{print $2}' "$SCRATCH/mock")
+    [ -n "$PORT" ] || fail "mock provider did not start"
+}
+
+# write_config ['"key": value, ...']: the given fields override the defaults,
+# which turn off streaming and every source that answers before the provider
+write_config() {
+    cat > "$SCRATCH/.config/smart-cmd/config.json" <<EOF
+{
+  "llm": {"provider": "openai", "model": "mock", "api_key": "test",
+          "endpoint": "http://127.0.0.1:$PORT/v1/chat/completions"},
+  "enable_proxy_mode": false,
+  "enable_streaming": false,
+  "prefetch": {"enabled": false},
+  "cache": {"enabled": false},
+  "hedge": {"enabled": false},
+  "local_model": {"enabled": false}${1:+,
+  $1}
+}
+EOF
+}
+
+start_daemon() {
+    "$ROOT/smart-cmd-daemon" >/dev/null 2>&1
+    for _ in $(seq 50); do
+        "$ROOT/smart-cmd-daemon" --status >/dev/null 2>&1 && return 0
+        sleep 0.1
+    done
+    fail "daemon did not start"
+}
+
+# Whether the daemon's log has a line with the given text
+daemon_logged() {
+    grep -qF -- "$1" "$TMPDIR"/smart-cmd.log.* 2>/dev/null
+}